@@ -1,8 +1,10 @@
 #include "album.h"
+#include "bloom_filter.h"
 #include "utils.h"
 #include "logger.h"
 
 #include <glib.h>
+#include <string.h>
 
 /**
  * A structure behind album_h handle
@@ -10,12 +12,28 @@
 typedef struct album_s
 {
 	char* name;             /// the name of the album
+	uint64_t inode;         /// the inode number assigned to the album
 	GHashTable* photos;     /// the lookup table of all photos <photo-name, photo-details> [char*,photo_h]
+	GPtrArray* order;       /// the photos in the order in which they have been added [photo_h], borrowed from photos
+	GHashTable* indices;    /// the positions of the photos within order <photo, index> [photo_h, guint]
+	unsigned int version;   /// incremented whenever a photo is added
+	bloom_filter_h names;   /// the file names of the photos, so that the names which don't exist are rejected quickly
+
+	GMutex sorted_lock;     /// guards sorted
+	GPtrArray* sorted;      /// the photos sorted by their file names [photo_h], borrowed from photos, NULL until needed (referenced by the listings in progress)
+
+	album_load_cb loader;           /// retrieves the photos when they're first needed, NULL if they're always present
+	void* loader_data;              /// the user data passed to loader
+	album_release_cb release;       /// frees loader_data along with the album, or NULL
+	GMutex load_lock;               /// serializes the loading of the photos
+	gint loaded;                    /// set once the photos are present, after which they never change
+	unsigned int expected_count;    /// the number of photos reported until they're loaded
+	gint last_used;                 /// the time (in monotonic seconds) of the last lookup or listing of the album
 
 	gint ref_count;         /// reference counter for album_h
 } album_t;
 
-album_h album_create(const char* name)
+album_h album_create(const char* name, uint64_t inode)
 {
 	ASSERT_RET(name != NULL, NULL);
 
@@ -24,7 +42,31 @@ album_h album_create(const char* name)
 
 	handle->ref_count = 1;
 	handle->name = strdup(name);
+	handle->inode = inode;
 	handle->photos = g_hash_table_new_full(g_str_hash, g_str_equal, free, (GDestroyNotify) photo_unref);
+	handle->order = g_ptr_array_new();
+	handle->indices = g_hash_table_new(g_direct_hash, g_direct_equal);
+	handle->loaded = 1;
+	g_mutex_init(&handle->sorted_lock);
+	g_mutex_init(&handle->load_lock);
+
+	return handle;
+}
+
+album_h album_create_lazy(const char* name, uint64_t inode, unsigned int photo_count,
+		album_load_cb loader, void* user_data, album_release_cb release)
+{
+	ASSERT_RET(loader != NULL, NULL);
+
+	album_h handle = album_create(name, inode);
+	if (handle != NULL)
+	{
+		handle->loader = loader;
+		handle->loader_data = user_data;
+		handle->release = release;
+		handle->loaded = 0;
+		handle->expected_count = photo_count;
+	}
 
 	return handle;
 }
@@ -35,23 +77,152 @@ const char* album_get_name(const album_h handle)
 	return handle->name;
 }
 
+uint64_t album_get_inode(const album_h handle)
+{
+	ASSERT_RET(handle != NULL, 0);
+	return handle->inode;
+}
+
+// adds the file name of a photo which has just been appended to order into the filter of names
+static void album_add_name(album_h handle, const char* file_name)
+{
+	if (handle->names != NULL && handle->order->len <= bloom_filter_get_capacity(handle->names))
+	{
+		bloom_filter_add(handle->names, file_name);
+		return;
+	}
+
+	// the filter can't grow, so it's rebuilt twice as large, which keeps adding amortized O(1)
+	bloom_filter_free(handle->names);
+	handle->names = bloom_filter_create(MAX(64, handle->order->len * 2));
+
+	for (guint i = 0; handle->names != NULL && i < handle->order->len; i++)
+	{
+		bloom_filter_add(handle->names, photo_get_file_name((photo_h) g_ptr_array_index(handle->order, i)));
+	}
+}
+
+// marks the album as used now, the time is written only when it changes, so that the album isn't
+// bounced between the caches of the threads looking it up
+static void album_touch(album_h handle)
+{
+	gint now = (gint) (g_get_monotonic_time() / G_USEC_PER_SEC);
+
+	if (g_atomic_int_get(&handle->last_used) != now)
+	{
+		g_atomic_int_set(&handle->last_used, now);
+	}
+}
+
+// drops the photos added by a loader which has failed
+static void album_clear(album_h handle)
+{
+	g_hash_table_remove_all(handle->indices);
+	g_ptr_array_set_size(handle->order, 0);
+	g_hash_table_remove_all(handle->photos);
+
+	bloom_filter_free(handle->names);
+	handle->names = NULL;
+	handle->version++;
+}
+
+// makes sure the photos of a lazily loaded album are present, returns false if they couldn't be loaded
+static bool album_ensure_loaded(album_h handle)
+{
+	if (g_atomic_int_get(&handle->loaded))
+	{
+		return true;
+	}
+
+	g_mutex_lock(&handle->load_lock);
+
+	bool loaded = g_atomic_int_get(&handle->loaded);
+	if (!loaded)
+	{
+		loaded = handle->loader(handle, handle->loader_data);
+
+		if (loaded)
+		{
+			album_touch(handle);
+
+			// published only now, the readers which see it set don't take the lock anymore
+			g_atomic_int_set(&handle->loaded, 1);
+		}
+		else
+		{
+			LOG_WARN("Unable to load the photos of album %s", handle->name);
+			album_clear(handle);
+		}
+	}
+
+	g_mutex_unlock(&handle->load_lock);
+	return loaded;
+}
+
+bool album_is_loaded(const album_h handle)
+{
+	ASSERT_RET(handle != NULL, false);
+	return g_atomic_int_get(&handle->loaded);
+}
+
+bool album_is_idle(const album_h handle, unsigned int timeout)
+{
+	ASSERT_RET(handle != NULL, false);
+
+	if (handle->loader == NULL || !g_atomic_int_get(&handle->loaded))
+	{
+		return false;
+	}
+
+	gint now = (gint) (g_get_monotonic_time() / G_USEC_PER_SEC);
+	return now - g_atomic_int_get(&handle->last_used) >= (gint) timeout;
+}
+
 bool album_add_photo(album_h handle, photo_h photo)
 {
 	ASSERT_RET(handle != NULL, false);
 	ASSERT_RET(photo != NULL, false);
 	ASSERT_RET(photo_get_file_name(photo) != NULL, false);
 
-#ifdef ENABLE_DEBUG_ENVIRONMENT
-	// check if there is no previous photo with this name (IOS should prevent duplicate file names, so this
-	// is checked only in debug mode, and should not be expected to happen in real life)
-	if (g_hash_table_contains(handle->photos, photo_get_file_name(photo)))
+	photo_h previous = (photo_h) g_hash_table_lookup(handle->photos, photo_get_file_name(photo));
+
+	if (previous != NULL)
 	{
+#ifdef ENABLE_DEBUG_ENVIRONMENT
+		// IOS should prevent duplicate file names, so this is reported only in debug mode, and
+		// should not be expected to happen in real life
 		LOG_WARN("Photo at file %s has already been added to album %s, overwriting the previous entry!",
 				photo_get_file_name(photo), handle->name);
-	}
 #endif
 
+		// the previous photo no longer belongs to this album, though it might still belong to others
+		photo_remove_album(previous);
+
+		// the new photo takes the position of the previous one
+		guint index = GPOINTER_TO_UINT(g_hash_table_lookup(handle->indices, previous));
+		g_hash_table_remove(handle->indices, previous);
+		g_ptr_array_index(handle->order, index) = photo;
+		g_hash_table_insert(handle->indices, photo, GUINT_TO_POINTER(index));
+	}
+	else
+	{
+		g_hash_table_insert(handle->indices, photo, GUINT_TO_POINTER(handle->order->len));
+		g_ptr_array_add(handle->order, photo);
+		album_add_name(handle, photo_get_file_name(photo));
+	}
+
 	g_hash_table_insert(handle->photos, strdup(photo_get_file_name(photo)), photo);
+	handle->version++;
+
+	// a listing in progress keeps walking the array it has referenced
+	g_mutex_lock(&handle->sorted_lock);
+	if (handle->sorted != NULL)
+	{
+		g_ptr_array_unref(handle->sorted);
+		handle->sorted = NULL;
+	}
+	g_mutex_unlock(&handle->sorted_lock);
+
 	return true;
 }
 
@@ -60,27 +231,91 @@ bool album_for_each_photo(const album_h handle, album_for_each_photo_cb callback
 	ASSERT_RET(handle != NULL, false);
 	ASSERT_RET(callback != NULL, false);
 
-	GHashTableIter it;
-	gpointer value;
+	if (!album_ensure_loaded(handle))
+	{
+		return false;
+	}
+
+	for (guint i = 0; i < handle->order->len; i++)
+	{
+		if (!callback(handle, (photo_h) g_ptr_array_index(handle->order, i), user_data))
+		{
+			break;
+		}
+	}
+
+	return true;
+}
+
+static gint compare_file_names(gconstpointer a, gconstpointer b)
+{
+	return strcmp(photo_get_file_name(*(const photo_h*) a), photo_get_file_name(*(const photo_h*) b));
+}
+
+/**
+ * Get the photos of a loaded album sorted by their file names, building the array if needed
+ * @note the caller has to release the returned array using g_ptr_array_unref(), since it
+ * may be dropped by album_add_photo() as soon as the lock is released
+ */
+static GPtrArray* album_get_sorted(const album_h handle)
+{
+	g_mutex_lock(&handle->sorted_lock);
+
+	if (handle->sorted == NULL)
+	{
+		handle->sorted = g_ptr_array_sized_new(handle->order->len);
+		for (guint i = 0; i < handle->order->len; i++)
+		{
+			g_ptr_array_add(handle->sorted, g_ptr_array_index(handle->order, i));
+		}
+
+		g_ptr_array_sort(handle->sorted, compare_file_names);
+	}
+
+	GPtrArray* sorted = g_ptr_array_ref(handle->sorted);
+	g_mutex_unlock(&handle->sorted_lock);
+
+	return sorted;
+}
+
+bool album_for_each_photo_sorted(const album_h handle, unsigned int start, album_for_each_photo_cb callback, void* user_data)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(callback != NULL, false);
+
+	album_touch(handle);
 
-	g_hash_table_iter_init(&it, handle->photos);
-	while (g_hash_table_iter_next(&it, NULL, &value))
+	if (!album_ensure_loaded(handle))
 	{
-		if (!callback(handle, (photo_h) value, user_data))
+		return false;
+	}
+
+	GPtrArray* sorted = album_get_sorted(handle);
+
+	for (guint i = start; i < sorted->len; i++)
+	{
+		if (!callback(handle, (photo_h) g_ptr_array_index(sorted, i), user_data))
 		{
 			break;
 		}
 	}
 
+	g_ptr_array_unref(sorted);
 	return true;
 }
 
+unsigned int album_get_version(const album_h handle)
+{
+	ASSERT_RET(handle != NULL, 0);
+	return handle->version;
+}
+
 photo_h album_get_photo_by_file_name(const album_h handle, const char* file_name)
 {
 	ASSERT_RET(handle != NULL, false);
 	ASSERT_RET(file_name != NULL, false);
 
-	photo_h photo = (photo_h) g_hash_table_lookup(handle->photos, file_name);
+	photo_h photo = album_find_photo(handle, file_name);
 	if (photo == NULL)
 	{
 		return NULL;
@@ -89,6 +324,103 @@ photo_h album_get_photo_by_file_name(const album_h handle, const char* file_name
 	return photo_ref(photo);
 }
 
+photo_h album_find_photo(const album_h handle, const char* file_name)
+{
+	ASSERT_RET(handle != NULL, NULL);
+	ASSERT_RET(file_name != NULL, NULL);
+
+	album_touch(handle);
+
+	if (!album_ensure_loaded(handle))
+	{
+		return NULL;
+	}
+
+	// most of the names which don't exist (probed by file managers) are rejected without the lookup
+	if (handle->names != NULL && !bloom_filter_may_contain(handle->names, file_name))
+	{
+		return NULL;
+	}
+
+	return (photo_h) g_hash_table_lookup(handle->photos, file_name);
+}
+
+unsigned int album_get_photo_count(const album_h handle)
+{
+	ASSERT_RET(handle != NULL, 0);
+
+	if (!g_atomic_int_get(&handle->loaded))
+	{
+		return handle->expected_count;
+	}
+
+	return handle->order->len;
+}
+
+int album_get_sorted_index(const album_h handle, const photo_h photo)
+{
+	ASSERT_RET(handle != NULL, -1);
+	ASSERT_RET(photo != NULL, -1);
+
+	if (!album_ensure_loaded(handle))
+	{
+		return -1;
+	}
+
+	GPtrArray* sorted = album_get_sorted(handle);
+	const char* name = photo_get_file_name(photo);
+	int result = -1;
+
+	guint low = 0;
+	guint high = sorted->len;
+	while (low < high)
+	{
+		guint middle = low + (high - low) / 2;
+		photo_h current = (photo_h) g_ptr_array_index(sorted, middle);
+		int comparison = strcmp(photo_get_file_name(current), name);
+
+		if (comparison == 0)
+		{
+			// file names are unique within an album, so this is the only candidate
+			result = current == photo ? (int) middle : -1;
+			break;
+		}
+
+		if (comparison < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	g_ptr_array_unref(sorted);
+	return result;
+}
+
+photo_h album_get_sorted_photo_at(const album_h handle, int index)
+{
+	ASSERT_RET(handle != NULL, NULL);
+
+	if (!album_ensure_loaded(handle) || index < 0)
+	{
+		return NULL;
+	}
+
+	GPtrArray* sorted = album_get_sorted(handle);
+	photo_h result = NULL;
+
+	if ((guint) index < sorted->len)
+	{
+		result = photo_ref((photo_h) g_ptr_array_index(sorted, index));
+	}
+
+	g_ptr_array_unref(sorted);
+	return result;
+}
+
 album_h album_ref(album_h handle)
 {
 	ASSERT_RET(handle, NULL);
@@ -105,6 +437,21 @@ void album_unref(album_h handle)
 
 	if (g_atomic_int_dec_and_test(&handle->ref_count))
 	{
+		if (handle->sorted != NULL)
+		{
+			g_ptr_array_unref(handle->sorted);
+		}
+
+		if (handle->release != NULL)
+		{
+			handle->release(handle->loader_data);
+		}
+
+		bloom_filter_free(handle->names);
+		g_mutex_clear(&handle->load_lock);
+		g_mutex_clear(&handle->sorted_lock);
+		g_hash_table_unref(handle->indices);
+		g_ptr_array_free(handle->order, TRUE);
 		g_hash_table_unref(handle->photos);
 		free(handle->name);
 		free(handle);
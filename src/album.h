@@ -3,6 +3,7 @@
 #include "photo.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
 /**
  * A handle holding information about an album containing photos
@@ -19,12 +20,44 @@ typedef struct album_s* album_h;
  */
 typedef bool (*album_for_each_photo_cb)(const album_h handle, const photo_h photo, void* user_data);
 
+/**
+ * A callback retrieving the photos of a lazily loaded album (see album_create_lazy()), which should
+ * add them to the album with album_add_photo()
+ * @param handle a handle of the album which is being loaded
+ * @param user_data user data passed to album_create_lazy()
+ * @return true on success, false on error (in which case the photos added so far are dropped, and
+ * the album is loaded again when its photos are next needed)
+ */
+typedef bool (*album_load_cb)(album_h handle, void* user_data);
+
+/**
+ * A callback freeing the user data of a lazily loaded album, along with the album
+ * @param user_data user data passed to album_create_lazy()
+ */
+typedef void (*album_release_cb)(void* user_data);
+
 /**
  * Create a new instance of an album
  * @param name the name of an album
+ * @param inode the inode number assigned to the album (see inode.h)
+ * @return a valid handle to the newly created album or NULL on error
+ */
+album_h album_create(const char* name, uint64_t inode);
+
+/**
+ * Create a new instance of an album whose photos are retrieved only when they're first needed, i.e.
+ * by the first function of this module accessing them (except album_add_photo(), which is meant for
+ * the loader, and album_get_photo_count()). Once loaded, the photos never change.
+ * @param name the name of an album
+ * @param inode the inode number assigned to the album (see inode.h)
+ * @param photo_count the number of photos reported by album_get_photo_count() until they're loaded
+ * @param loader the callback adding the photos to the album, invoked at most once at a time
+ * @param user_data the user data which should be passed to the loader
+ * @param release the callback freeing user_data along with the album, or NULL
  * @return a valid handle to the newly created album or NULL on error
  */
-album_h album_create(const char* name);
+album_h album_create_lazy(const char* name, uint64_t inode, unsigned int photo_count,
+		album_load_cb loader, void* user_data, album_release_cb release);
 
 /**
  * Get the name of an album
@@ -33,10 +66,36 @@ album_h album_create(const char* name);
  */
 const char* album_get_name(const album_h handle);
 
+/**
+ * Get the inode number assigned to an album
+ * @param handle a valid album handle
+ * @return the inode number of an album or 0 on error
+ */
+uint64_t album_get_inode(const album_h handle);
+
+/**
+ * Check whether the photos of an album are present, i.e. whether accessing them is going to be cheap
+ * @param handle a valid album handle
+ * @return true if the photos have been loaded (which is always the case unless the album has been
+ * created with album_create_lazy()), false otherwise
+ */
+bool album_is_loaded(const album_h handle);
+
+/**
+ * Check whether the photos of a lazily loaded album have been loaded, but haven't been looked up or
+ * listed (see album_find_photo() and album_for_each_photo_sorted()) for some time, so that the album
+ * may be replaced by a new one which loads them again only when they're needed
+ * @param handle a valid album handle
+ * @param timeout the time (in seconds) after which a loaded album becomes idle
+ * @return true if the album is idle, false otherwise
+ */
+bool album_is_idle(const album_h handle, unsigned int timeout);
+
 /**
  * Adds a photo to the album
  * @param handle a handle of an album to which a photo should be added
- * @param photo a photo which should be added to the album.
+ * @param photo a photo which should be added to the album (see photo_add_album()). A photo with the same
+ * file name is replaced, and recorded as removed from the album (see photo_remove_album()).
  * @return true when a photo was successfully added, false on error
  * @warning this function takes ownership of photo parameter, if you need yourself, you should create
  * a separate reference using photo_ref() and unreference it when you no longer need it.
@@ -44,7 +103,8 @@ const char* album_get_name(const album_h handle);
 bool album_add_photo(album_h handle, photo_h photo);
 
 /**
- * This function synchronously calls the passed callback for each photo from the provided album
+ * This function synchronously calls the passed callback for each photo from the provided album,
+ * in the order in which the photos have been added (i.e. the order of the photo database)
  * @param handle the handle of an album for which the photos should be reported
  * @param callback the callback which should be invoked for each photo from an album
  * @param user_data the user data which should be passed to the callback
@@ -52,6 +112,27 @@ bool album_add_photo(album_h handle, photo_h photo);
  */
 bool album_for_each_photo(const album_h handle, album_for_each_photo_cb callback, void* user_data);
 
+/**
+ * This function synchronously calls the passed callback for the photos from the provided album sorted
+ * by their file names, starting at the given position. The positions are stable for as long as the
+ * album isn't modified (see album_get_version()), so that a listing split into multiple chunks can be
+ * resumed where the previous chunk has ended.
+ * @param handle the handle of an album for which the photos should be reported
+ * @param start the position (in the sorted order) of the first photo which should be reported
+ * @param callback the callback which should be invoked for each photo from an album
+ * @param user_data the user data which should be passed to the callback
+ * @return true on success, false if the provided arguments were incorrect
+ * @note the sorted order is built once, on the first call after the album has been modified
+ */
+bool album_for_each_photo_sorted(const album_h handle, unsigned int start, album_for_each_photo_cb callback, void* user_data);
+
+/**
+ * Get the version of the contents of an album, which changes whenever a photo is added to the album
+ * @param handle a valid album handle
+ * @return the version of the album
+ */
+unsigned int album_get_version(const album_h handle);
+
 /**
  * Get the photo from an album by the photo's file name
  * @param handle a valid handle to the album which should be searched for the photo
@@ -63,6 +144,42 @@ bool album_for_each_photo(const album_h handle, album_for_each_photo_cb callback
  */
 photo_h album_get_photo_by_file_name(const album_h handle, const char* file_name);
 
+/**
+ * Find the photo in an album by the photo's file name, without taking a reference to it
+ * @param handle a valid handle to the album which should be searched for the photo
+ * @param file_name a file name of a photo which should be found in an album
+ * @return a handle to a photo identified by the provided file name or NULL when no
+ * such photo exists in the passed album. The photo is borrowed from the album, so it's
+ * valid only as long as the album is (e.g. within filesystem_enter_catalog()).
+ */
+photo_h album_find_photo(const album_h handle, const char* file_name);
+
+/**
+ * Get the number of photos in an album
+ * @param handle a valid album handle
+ * @return the number of photos in the album, or the number passed to album_create_lazy() if the
+ * photos haven't been loaded yet
+ */
+unsigned int album_get_photo_count(const album_h handle);
+
+/**
+ * Get the position of a photo within an album, in the order reported by album_for_each_photo_sorted()
+ * @param handle a valid album handle
+ * @param photo a photo belonging to the album
+ * @return the position of the photo or -1 if it doesn't belong to the album
+ */
+int album_get_sorted_index(const album_h handle, const photo_h photo);
+
+/**
+ * Get the photo at the given position within an album, in the order reported by album_for_each_photo_sorted()
+ * @param handle a valid album handle
+ * @param index the position of the photo
+ * @return a handle to the photo or NULL if the position is out of range
+ * @note you should unreference the returned value (whenever it's non-null) using
+ * photo_unref() function, when you no longer need it
+ */
+photo_h album_get_sorted_photo_at(const album_h handle, int index);
+
 /**
  * Increase the reference counter of the passed album
  * @param handle a handle which reference counter should be increased
@@ -0,0 +1,401 @@
+#include "async_io.h"
+#include "logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef IPA_HAVE_IO_URING
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <liburing.h>
+#include <sys/sysmacros.h>
+
+/**
+ * The types of the operations which may be submitted
+ */
+typedef enum
+{
+	OPERATION_READ,
+	OPERATION_STAT,
+	OPERATION_OPEN
+} operation_e;
+
+/**
+ * A single submitted operation
+ */
+typedef struct async_request_s
+{
+	operation_e operation;
+	async_io_cb callback;
+	void* user_data;
+
+	int fd;                     /// OPERATION_READ: the descriptor of the file
+	char* buffer;               /// OPERATION_READ: the buffer which should be filled
+	size_t size;                /// OPERATION_READ: the number of bytes which should be read
+	off_t offset;               /// OPERATION_READ: the offset where the reading should begin
+	size_t done;                /// OPERATION_READ: the number of bytes already read
+
+	const char* location;       /// OPERATION_STAT, OPERATION_OPEN: the location of the file
+	struct stat* stbuf;         /// OPERATION_STAT: the structure which should be filled
+	struct statx attributes;    /// OPERATION_STAT: the attributes retrieved by the kernel
+} async_request_t;
+
+/**
+ * A structure behind async_io_h handle
+ */
+struct async_io_s
+{
+	struct io_uring ring;
+	GThread* completer;         /// the thread reaping the completions and invoking the callbacks
+
+	GMutex lock;                /// guards the submission queue and in_flight
+	GCond drained;              /// signalled when the last operation in flight completes
+	unsigned int in_flight;     /// the number of operations submitted and not completed yet
+	unsigned int depth;         /// the maximum number of new operations in flight
+};
+
+// the number of attempts to pass the prepared operations to the kernel before giving up
+#define SUBMIT_ATTEMPTS 3
+
+// the data of the no-ops left behind by the failed submissions, whose completions are ignored
+static char discarded;
+
+// must be called with the lock held, returns false if the operation couldn't be passed to the
+// kernel, in which case the request still belongs to the caller
+static bool submit(async_io_h handle, async_request_t* request)
+{
+	struct io_uring_sqe* sqe = io_uring_get_sqe(&handle->ring);
+	if (sqe == NULL)
+	{
+		// the submission queue is full, flush it and try again
+		io_uring_submit(&handle->ring);
+		sqe = io_uring_get_sqe(&handle->ring);
+	}
+
+	if (sqe == NULL)
+	{
+		return false;
+	}
+
+	switch (request->operation)
+	{
+	case OPERATION_READ:
+		io_uring_prep_read(sqe, request->fd, request->buffer + request->done,
+				request->size - request->done, request->offset + request->done);
+		break;
+	case OPERATION_STAT:
+		io_uring_prep_statx(sqe, AT_FDCWD, request->location, AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS, &request->attributes);
+		break;
+	case OPERATION_OPEN:
+		io_uring_prep_openat(sqe, AT_FDCWD, request->location, O_RDONLY, 0);
+		break;
+	}
+
+	io_uring_sqe_set_data(sqe, request);
+	handle->in_flight++;
+
+	int error = 0;
+	for (int attempt = 0; attempt < SUBMIT_ATTEMPTS; attempt++)
+	{
+		error = io_uring_submit(&handle->ring);
+		if (error >= 0 || (error != -EINTR && error != -EAGAIN && error != -EBUSY))
+		{
+			break;
+		}
+	}
+
+	if (error < 0)
+	{
+		// the entry can't be taken back from the queue, so it's turned into a no-op, which is passed
+		// to the kernel along with the next operation and whose completion is ignored
+		LOG_WARN("Unable to submit asynchronous I/O: %s", strerror(-error));
+
+		io_uring_prep_nop(sqe);
+		io_uring_sqe_set_data(sqe, &discarded);
+		handle->in_flight--;
+
+		return false;
+	}
+
+	return true;
+}
+
+static bool submit_new(async_io_h handle, async_request_t* request)
+{
+	g_mutex_lock(&handle->lock);
+
+	// when the ring is full the caller falls back to the synchronous I/O, so that the completions
+	// never outnumber the completion queue (the resubmitted reads are already counted in)
+	bool submitted = (handle->in_flight < handle->depth) && submit(handle, request);
+
+	g_mutex_unlock(&handle->lock);
+
+	if (!submitted)
+	{
+		free(request);
+	}
+
+	return submitted;
+}
+
+static void fill_stat(const struct statx* attributes, struct stat* stbuf)
+{
+	memset(stbuf, 0, sizeof(struct stat));
+
+	stbuf->st_dev = makedev(attributes->stx_dev_major, attributes->stx_dev_minor);
+	stbuf->st_ino = attributes->stx_ino;
+	stbuf->st_mode = attributes->stx_mode;
+	stbuf->st_nlink = attributes->stx_nlink;
+	stbuf->st_uid = attributes->stx_uid;
+	stbuf->st_gid = attributes->stx_gid;
+	stbuf->st_rdev = makedev(attributes->stx_rdev_major, attributes->stx_rdev_minor);
+	stbuf->st_size = attributes->stx_size;
+	stbuf->st_blksize = attributes->stx_blksize;
+	stbuf->st_blocks = attributes->stx_blocks;
+	stbuf->st_atim.tv_sec = attributes->stx_atime.tv_sec;
+	stbuf->st_atim.tv_nsec = attributes->stx_atime.tv_nsec;
+	stbuf->st_mtim.tv_sec = attributes->stx_mtime.tv_sec;
+	stbuf->st_mtim.tv_nsec = attributes->stx_mtime.tv_nsec;
+	stbuf->st_ctim.tv_sec = attributes->stx_ctime.tv_sec;
+	stbuf->st_ctim.tv_nsec = attributes->stx_ctime.tv_nsec;
+}
+
+// handles a completed operation, returns true if the request has been resubmitted
+static bool complete(async_io_h handle, async_request_t* request, int result)
+{
+	switch (request->operation)
+	{
+	case OPERATION_READ:
+		if (result > 0)
+		{
+			request->done += result;
+
+			// a short read doesn't mean the end of the file, unless the next one returns nothing
+			if (request->done < request->size)
+			{
+				g_mutex_lock(&handle->lock);
+				bool resubmitted = submit(handle, request);
+				g_mutex_unlock(&handle->lock);
+
+				if (resubmitted)
+				{
+					return true;
+				}
+			}
+		}
+
+		// report the error only if nothing could be read
+		if (result >= 0 || request->done > 0)
+		{
+			result = request->done;
+		}
+		break;
+	case OPERATION_STAT:
+		if (result == 0)
+		{
+			fill_stat(&request->attributes, request->stbuf);
+		}
+		break;
+	case OPERATION_OPEN:
+		break;
+	}
+
+	request->callback(result, request->user_data);
+	return false;
+}
+
+static gpointer completer_thread(gpointer data)
+{
+	async_io_h handle = (async_io_h) data;
+
+	while (true)
+	{
+		struct io_uring_cqe* cqe = NULL;
+
+		int error = io_uring_wait_cqe(&handle->ring, &cqe);
+		if (error == -EINTR)
+		{
+			continue;
+		}
+
+		if (error < 0)
+		{
+			LOG_ERROR("Unable to reap the completions of asynchronous I/O: %s", strerror(-error));
+			break;
+		}
+
+		async_request_t* request = (async_request_t*) io_uring_cqe_get_data(cqe);
+		int result = cqe->res;
+		io_uring_cqe_seen(&handle->ring, cqe);
+
+		// a request without data is submitted only to stop this thread
+		if (request == NULL)
+		{
+			break;
+		}
+
+		// the no-op of a failed submission, which has already been reported to its caller
+		if (request == (async_request_t*) &discarded)
+		{
+			continue;
+		}
+
+		if (!complete(handle, request, result))
+		{
+			free(request);
+		}
+
+		g_mutex_lock(&handle->lock);
+		if (--handle->in_flight == 0)
+		{
+			g_cond_broadcast(&handle->drained);
+		}
+		g_mutex_unlock(&handle->lock);
+	}
+
+	return NULL;
+}
+
+async_io_h async_io_create(unsigned int depth)
+{
+	ASSERT_RET(depth > 0, NULL);
+
+	async_io_h handle = (async_io_h) calloc(1, sizeof(struct async_io_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	int error = io_uring_queue_init(depth, &handle->ring, 0);
+	if (error < 0)
+	{
+		LOG_WARN("Unable to initialize io_uring, falling back to synchronous I/O: %s", strerror(-error));
+		free(handle);
+		return NULL;
+	}
+
+	handle->depth = depth;
+	g_mutex_init(&handle->lock);
+	g_cond_init(&handle->drained);
+	handle->completer = g_thread_new("async-io", completer_thread, handle);
+
+	return handle;
+}
+
+bool async_io_read(async_io_h handle, int fd, void* buffer, size_t size, off_t offset, async_io_cb callback, void* user_data)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(buffer != NULL, false);
+	ASSERT_RET(callback != NULL, false);
+
+	async_request_t* request = (async_request_t*) calloc(1, sizeof(async_request_t));
+	ASSERT_RET(request != NULL, false);
+
+	request->operation = OPERATION_READ;
+	request->callback = callback;
+	request->user_data = user_data;
+	request->fd = fd;
+	request->buffer = (char*) buffer;
+	request->size = size;
+	request->offset = offset;
+
+	return submit_new(handle, request);
+}
+
+bool async_io_stat(async_io_h handle, const char* location, struct stat* stbuf, async_io_cb callback, void* user_data)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(location != NULL, false);
+	ASSERT_RET(stbuf != NULL, false);
+	ASSERT_RET(callback != NULL, false);
+
+	async_request_t* request = (async_request_t*) calloc(1, sizeof(async_request_t));
+	ASSERT_RET(request != NULL, false);
+
+	request->operation = OPERATION_STAT;
+	request->callback = callback;
+	request->user_data = user_data;
+	request->location = location;
+	request->stbuf = stbuf;
+
+	return submit_new(handle, request);
+}
+
+bool async_io_open(async_io_h handle, const char* location, async_io_cb callback, void* user_data)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(location != NULL, false);
+	ASSERT_RET(callback != NULL, false);
+
+	async_request_t* request = (async_request_t*) calloc(1, sizeof(async_request_t));
+	ASSERT_RET(request != NULL, false);
+
+	request->operation = OPERATION_OPEN;
+	request->callback = callback;
+	request->user_data = user_data;
+	request->location = location;
+
+	return submit_new(handle, request);
+}
+
+void async_io_free(async_io_h handle)
+{
+	if (handle)
+	{
+		g_mutex_lock(&handle->lock);
+
+		while (handle->in_flight > 0)
+		{
+			g_cond_wait(&handle->drained, &handle->lock);
+		}
+
+		// wake up the completion thread with an empty request, so that it terminates
+		struct io_uring_sqe* sqe = io_uring_get_sqe(&handle->ring);
+		if (sqe == NULL)
+		{
+			io_uring_submit(&handle->ring);
+			sqe = io_uring_get_sqe(&handle->ring);
+		}
+
+		io_uring_prep_nop(sqe);
+		io_uring_sqe_set_data(sqe, NULL);
+		io_uring_submit(&handle->ring);
+
+		g_mutex_unlock(&handle->lock);
+
+		g_thread_join(handle->completer);
+		io_uring_queue_exit(&handle->ring);
+
+		g_cond_clear(&handle->drained);
+		g_mutex_clear(&handle->lock);
+		free(handle);
+	}
+}
+
+#else
+
+async_io_h async_io_create(unsigned int depth)
+{
+	LOG_DEBUG("ipa has been built without io_uring, asynchronous I/O is not available");
+	return NULL;
+}
+
+bool async_io_read(async_io_h handle, int fd, void* buffer, size_t size, off_t offset, async_io_cb callback, void* user_data)
+{
+	return false;
+}
+
+bool async_io_stat(async_io_h handle, const char* location, struct stat* stbuf, async_io_cb callback, void* user_data)
+{
+	return false;
+}
+
+bool async_io_open(async_io_h handle, const char* location, async_io_cb callback, void* user_data)
+{
+	return false;
+}
+
+void async_io_free(async_io_h handle)
+{
+}
+
+#endif
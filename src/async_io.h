@@ -0,0 +1,81 @@
+/*
+ * Asynchronous I/O on the files backing the photos, built on io_uring. Instead of blocking a
+ * worker thread for the whole round trip to a device, the operations are submitted to the kernel
+ * and their callbacks are invoked from a completion thread once they finish, so that many of them
+ * may be in flight at the same time regardless of the number of worker threads.
+ *
+ * The module is available only when ipa has been built with liburing (IPA_HAVE_IO_URING), and the
+ * kernel supports io_uring. Otherwise async_io_create() fails and the callers should fall back to
+ * the synchronous I/O.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/**
+ * A handle of an asynchronous I/O engine
+ */
+typedef struct async_io_s* async_io_h;
+
+/**
+ * A callback invoked once an asynchronous operation finishes
+ * @param result the result of the operation, i.e. the number of bytes read, the opened descriptor
+ * or 0 on success, or a negated errno value on failure
+ * @param user_data user data passed along with the operation
+ * @note the callback is invoked from the completion thread, so it should not block
+ */
+typedef void (*async_io_cb)(int result, void* user_data);
+
+/**
+ * Create a new asynchronous I/O engine
+ * @param depth the maximum number of operations which may be submitted at the same time, the ones submitted
+ * beyond it are rejected (so that the callers fall back to the synchronous I/O)
+ * @return a handle of the engine or NULL if asynchronous I/O is not available
+ */
+async_io_h async_io_create(unsigned int depth);
+
+/**
+ * Read a range of a file, retrying the short reads until the range is read or the end of the file is reached
+ * @param handle a valid handle of an asynchronous I/O engine
+ * @param fd the descriptor of the file
+ * @param[out] buffer the buffer which should be filled with the data, valid until the callback is invoked
+ * @param size the number of bytes which should be read
+ * @param offset the offset within the file where the reading should begin
+ * @param callback the callback invoked with the number of bytes read
+ * @param user_data user data passed to the callback
+ * @return true if the operation has been submitted, false otherwise (the callback won't be invoked)
+ * @note this function is thread-safe
+ */
+bool async_io_read(async_io_h handle, int fd, void* buffer, size_t size, off_t offset, async_io_cb callback, void* user_data);
+
+/**
+ * Retrieve the attributes of a file, in the same way as lstat() does
+ * @param handle a valid handle of an asynchronous I/O engine
+ * @param location the location of the file, valid until the callback is invoked
+ * @param[out] stbuf the structure which should be filled with the attributes, valid until the callback is invoked
+ * @param callback the callback invoked with 0 on success
+ * @param user_data user data passed to the callback
+ * @return true if the operation has been submitted, false otherwise (the callback won't be invoked)
+ * @note this function is thread-safe
+ */
+bool async_io_stat(async_io_h handle, const char* location, struct stat* stbuf, async_io_cb callback, void* user_data);
+
+/**
+ * Open a file for reading
+ * @param handle a valid handle of an asynchronous I/O engine
+ * @param location the location of the file, valid until the callback is invoked
+ * @param callback the callback invoked with the opened descriptor
+ * @param user_data user data passed to the callback
+ * @return true if the operation has been submitted, false otherwise (the callback won't be invoked)
+ * @note this function is thread-safe
+ */
+bool async_io_open(async_io_h handle, const char* location, async_io_cb callback, void* user_data);
+
+/**
+ * Free the asynchronous I/O engine, waiting for all the submitted operations to finish
+ * @param handle a handle of an asynchronous I/O engine which should be freed
+ */
+void async_io_free(async_io_h handle);
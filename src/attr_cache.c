@@ -0,0 +1,92 @@
+#include "attr_cache.h"
+#include "logger.h"
+
+#include <stdlib.h>
+#include <glib.h>
+
+/**
+ * A single entry of the cache
+ */
+typedef struct attr_cache_entry_s
+{
+	uint64_t inode;             /// the inode of the node (also the key in attr_cache_s::entries)
+	struct stat attributes;     /// the cached attributes
+	gint64 expires;             /// the monotonic time (in microseconds) after which the entry is no longer valid
+} attr_cache_entry_t;
+
+/**
+ * A structure behind attr_cache_h handle
+ */
+struct attr_cache_s
+{
+	GMutex lock;                /// guards all accesses to entries
+	GHashTable* entries;        /// the cached attributes <inode, entry> [uint64_t*, attr_cache_entry_t*]
+	gint64 ttl;                 /// the lifetime of entries in microseconds
+};
+
+attr_cache_h attr_cache_create(unsigned int ttl)
+{
+	attr_cache_h handle = (attr_cache_h) calloc(1, sizeof(struct attr_cache_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	g_mutex_init(&handle->lock);
+	handle->entries = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free);
+	handle->ttl = (gint64) ttl * G_USEC_PER_SEC;
+
+	return handle;
+}
+
+bool attr_cache_lookup(attr_cache_h handle, uint64_t inode, struct stat* stbuf)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(stbuf != NULL, false);
+
+	bool found = false;
+
+	g_mutex_lock(&handle->lock);
+
+	attr_cache_entry_t* entry = (attr_cache_entry_t*) g_hash_table_lookup(handle->entries, &inode);
+	if (entry != NULL)
+	{
+		if (entry->expires > g_get_monotonic_time())
+		{
+			*stbuf = entry->attributes;
+			found = true;
+		}
+		else
+		{
+			g_hash_table_remove(handle->entries, &inode);
+		}
+	}
+
+	g_mutex_unlock(&handle->lock);
+
+	return found;
+}
+
+void attr_cache_insert(attr_cache_h handle, uint64_t inode, const struct stat* stbuf)
+{
+	ASSERT_RET(handle != NULL);
+	ASSERT_RET(stbuf != NULL);
+
+	attr_cache_entry_t* entry = (attr_cache_entry_t*) malloc(sizeof(attr_cache_entry_t));
+	ASSERT_RET(entry != NULL);
+
+	entry->inode = inode;
+	entry->attributes = *stbuf;
+	entry->expires = g_get_monotonic_time() + handle->ttl;
+
+	g_mutex_lock(&handle->lock);
+	g_hash_table_replace(handle->entries, &entry->inode, entry);
+	g_mutex_unlock(&handle->lock);
+}
+
+void attr_cache_free(attr_cache_h handle)
+{
+	if (handle)
+	{
+		g_hash_table_unref(handle->entries);
+		g_mutex_clear(&handle->lock);
+		free(handle);
+	}
+}
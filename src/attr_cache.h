@@ -0,0 +1,48 @@
+/*
+ * A cache of file attributes (struct stat) retrieved from the devices, keyed by the inodes of the
+ * nodes they belong to. Every entry expires after a configurable time, after which the attributes
+ * have to be retrieved from the device again.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * A handle of an attribute cache
+ */
+typedef struct attr_cache_s* attr_cache_h;
+
+/**
+ * Create a new attribute cache
+ * @param ttl the time (in seconds) after which the cached attributes expire
+ * @return a handle to the newly created cache or NULL on error
+ */
+attr_cache_h attr_cache_create(unsigned int ttl);
+
+/**
+ * Retrieve the cached attributes of a node
+ * @param handle a valid handle of an attribute cache
+ * @param inode the inode of the node which attributes should be retrieved
+ * @param[out] stbuf the structure which should be filled with the cached attributes
+ * @return true if the attributes were found and have not yet expired, false otherwise
+ * @note this function is thread-safe
+ */
+bool attr_cache_lookup(attr_cache_h handle, uint64_t inode, struct stat* stbuf);
+
+/**
+ * Store the attributes of a node in cache, replacing the previous ones (if any)
+ * @param handle a valid handle of an attribute cache
+ * @param inode the inode of the node to which the attributes belong
+ * @param stbuf the attributes which should be cached
+ * @note this function is thread-safe
+ */
+void attr_cache_insert(attr_cache_h handle, uint64_t inode, const struct stat* stbuf);
+
+/**
+ * Free the attribute cache and all of its entries
+ * @param handle a handle of an attribute cache which should be freed
+ */
+void attr_cache_free(attr_cache_h handle);
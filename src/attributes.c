@@ -0,0 +1,224 @@
+#include "attributes.h"
+#include "attr_cache.h"
+#include "inode.h"
+#include "logger.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_MODE_DIRECTORY S_IFDIR | S_IRUSR | S_IXUSR
+#define DEFAULT_MODE_PHOTO S_IFREG | S_IRUSR
+
+/**
+ * A structure behind attributes_h handle
+ */
+struct attributes_s
+{
+	attr_cache_h cache;         /// attributes retrieved from the devices
+	GThreadPool* prefetchers;   /// the pool of threads retrieving the attributes of photos in advance
+	io_scheduler_h scheduler;   /// the scheduler through which the attributes are retrieved, may be NULL
+
+	GMutex pending_lock;        /// guards pending
+	GHashTable* pending;        /// inodes of photos queued for prefetching [uint64_t*]
+};
+
+/**
+ * A single photo queued for prefetching its attributes
+ */
+typedef struct prefetch_job_s
+{
+	uint64_t inode;             /// the inode of the photo (also the key in attributes_s::pending)
+	photo_h photo;
+} prefetch_job_t;
+
+static void prefetch_job_free(prefetch_job_t* job)
+{
+	photo_unref(job->photo);
+	free(job);
+}
+
+/**
+ * Retrieve the attributes of a file from the device and store them in cache
+ * @param io_class IO_CLASS_METADATA when someone waits for the attributes, IO_CLASS_BULK when they are prefetched
+ * @return true on success, false when the attributes could not be retrieved
+ */
+static bool attributes_retrieve(attributes_h handle, uint64_t inode, const char* location, struct stat* stbuf, io_class_e io_class)
+{
+	io_scheduler_begin(handle->scheduler, io_class, inode_get_device(inode));
+	int result = lstat(location, stbuf);
+	int error = errno;
+	io_scheduler_end(handle->scheduler, io_class, inode_get_device(inode));
+
+	if (result == -1)
+	{
+		// the failure isn't cached, so the next request tries again
+		errno = error;
+		return false;
+	}
+
+	attr_cache_insert(handle->cache, inode, stbuf);
+	return true;
+}
+
+static void attributes_prefetch_worker(gpointer data, gpointer user_data)
+{
+	prefetch_job_t* job = (prefetch_job_t*) data;
+	attributes_h handle = (attributes_h) user_data;
+
+	struct stat stbuf;
+	if (!attr_cache_lookup(handle->cache, job->inode, &stbuf))
+	{
+		attributes_retrieve(handle, job->inode, photo_get_location(job->photo), &stbuf, IO_CLASS_BULK);
+	}
+
+	g_mutex_lock(&handle->pending_lock);
+	g_hash_table_remove(handle->pending, &job->inode);
+	g_mutex_unlock(&handle->pending_lock);
+
+	prefetch_job_free(job);
+}
+
+attributes_h attributes_create(unsigned int ttl, unsigned int prefetch_threads, io_scheduler_h scheduler)
+{
+	ASSERT_RET(prefetch_threads > 0, NULL);
+
+	attributes_h handle = (attributes_h) calloc(1, sizeof(struct attributes_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->cache = attr_cache_create(ttl);
+	handle->scheduler = scheduler;
+	g_mutex_init(&handle->pending_lock);
+	handle->pending = g_hash_table_new(g_int64_hash, g_int64_equal);
+	handle->prefetchers = g_thread_pool_new(attributes_prefetch_worker, handle, prefetch_threads, FALSE, NULL);
+
+	if (handle->cache == NULL || handle->prefetchers == NULL)
+	{
+		LOG_ERROR("Unable to initialize the attribute cache");
+		attributes_free(handle);
+		return NULL;
+	}
+
+	return handle;
+}
+
+void attributes_fill_root(attributes_h handle, struct stat* stbuf)
+{
+	stbuf->st_mode = DEFAULT_MODE_DIRECTORY;
+	stbuf->st_uid = getuid();
+	stbuf->st_gid = getgid();
+	stbuf->st_ino = INODE_ROOT;
+}
+
+void attributes_fill_device(attributes_h handle, const db_h device_db, struct stat* stbuf)
+{
+	if (!attr_cache_lookup(handle->cache, db_get_inode(device_db), stbuf))
+	{
+		attributes_retrieve(handle, db_get_inode(device_db), db_get_root_path(device_db), stbuf, IO_CLASS_METADATA);
+	}
+
+	stbuf->st_mode = DEFAULT_MODE_DIRECTORY;
+	stbuf->st_ino = db_get_inode(device_db);
+}
+
+void attributes_fill_album(attributes_h handle, const db_h device_db, const album_h album, struct stat* stbuf)
+{
+	// albums are purely virtual, they take over the attributes of the root directory of their device
+	attributes_fill_device(handle, device_db, stbuf);
+	stbuf->st_ino = album_get_inode(album);
+}
+
+bool attributes_fill_photo(attributes_h handle, const db_h device_db, const album_h album, const photo_h photo, struct stat* stbuf)
+{
+	if (!attributes_fill_photo_cached(handle, device_db, album, photo, stbuf) &&
+			!attributes_retrieve(handle, photo_get_inode(photo), photo_get_location(photo), stbuf, IO_CLASS_METADATA))
+	{
+		return false;
+	}
+
+	stbuf->st_mode = DEFAULT_MODE_PHOTO;
+	stbuf->st_ino = photo_get_inode(photo);
+	stbuf->st_nlink = MAX(1, photo_get_album_count(photo));
+	return true;
+}
+
+bool attributes_fill_photo_cached(attributes_h handle, const db_h device_db, const album_h album, const photo_h photo, struct stat* stbuf)
+{
+	bool known = photo_get_stat(photo, stbuf) || attr_cache_lookup(handle->cache, photo_get_inode(photo), stbuf);
+	stbuf->st_mode = DEFAULT_MODE_PHOTO;
+	stbuf->st_ino = photo_get_inode(photo);
+	stbuf->st_nlink = MAX(1, photo_get_album_count(photo));
+	return known;
+}
+
+void attributes_store_photo(attributes_h handle, const photo_h photo, struct stat* stbuf)
+{
+	attr_cache_insert(handle->cache, photo_get_inode(photo), stbuf);
+	stbuf->st_mode = DEFAULT_MODE_PHOTO;
+	stbuf->st_ino = photo_get_inode(photo);
+	stbuf->st_nlink = MAX(1, photo_get_album_count(photo));
+}
+
+static bool attributes_prefetch_photo(const album_h album, const photo_h photo, void* user_data)
+{
+	attributes_h handle = (attributes_h) user_data;
+
+	struct stat stbuf;
+	if (photo_get_stat(photo, &stbuf) || attr_cache_lookup(handle->cache, photo_get_inode(photo), &stbuf))
+	{
+		// already known, nothing to retrieve
+		return true;
+	}
+
+	prefetch_job_t* job = (prefetch_job_t*) malloc(sizeof(prefetch_job_t));
+	ASSERT_RET(job != NULL, false);
+
+	job->inode = photo_get_inode(photo);
+	job->photo = photo_ref(photo);
+
+	g_mutex_lock(&handle->pending_lock);
+	bool queued = g_hash_table_contains(handle->pending, &job->inode);
+	if (!queued)
+	{
+		g_hash_table_add(handle->pending, &job->inode);
+	}
+	g_mutex_unlock(&handle->pending_lock);
+
+	if (queued)
+	{
+		prefetch_job_free(job);
+	}
+	else
+	{
+		g_thread_pool_push(handle->prefetchers, job, NULL);
+	}
+
+	return true;
+}
+
+void attributes_prefetch_album(attributes_h handle, const db_h device_db, const album_h album)
+{
+	ASSERT_RET(handle != NULL);
+	ASSERT_RET(album != NULL);
+
+	album_for_each_photo(album, attributes_prefetch_photo, handle);
+}
+
+void attributes_free(attributes_h handle)
+{
+	if (handle)
+	{
+		if (handle->prefetchers)
+		{
+			// let the queued jobs finish, they reference the cache and the pending set
+			g_thread_pool_free(handle->prefetchers, FALSE, TRUE);
+		}
+
+		attr_cache_free(handle->cache);
+		g_hash_table_unref(handle->pending);
+		g_mutex_clear(&handle->pending_lock);
+		free(handle);
+	}
+}
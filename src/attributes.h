@@ -0,0 +1,111 @@
+/*
+ * This module fills the attributes (struct stat) of the nodes presented by the filesystem,
+ * i.e. of the root directory, devices, albums and photos. It's shared by all the engines
+ * serving the filesystem, so that a node looks the same regardless of how it's addressed.
+ *
+ * The attributes known from the photo database are used directly. All the other ones are
+ * retrieved from the device and kept in an attribute cache (see attr_cache.h) for a limited
+ * time. When an album is being listed, the attributes of its photos which are not yet known
+ * can be retrieved in advance by a pool of worker threads (see attributes_prefetch_album()).
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "db.h"
+#include "album.h"
+#include "photo.h"
+#include "io_scheduler.h"
+
+/**
+ * A handle of the attributes module
+ */
+typedef struct attributes_s* attributes_h;
+
+/**
+ * Create a new instance of the attributes module
+ * @param ttl the time (in seconds) for which the attributes retrieved from the device are cached
+ * @param prefetch_threads the maximum number of threads simultaneously retrieving the attributes
+ * of photos in advance (see attributes_prefetch_album())
+ * @param scheduler the scheduler through which the attributes are retrieved from the devices, or NULL
+ * if they are retrieved immediately
+ * @return a handle to the newly created instance or NULL on error
+ */
+attributes_h attributes_create(unsigned int ttl, unsigned int prefetch_threads, io_scheduler_h scheduler);
+
+/**
+ * Fill the attributes of the root directory of the filesystem
+ * @param handle a valid handle of the attributes module
+ * @param[out] stbuf the structure which should be filled with the attributes
+ */
+void attributes_fill_root(attributes_h handle, struct stat* stbuf);
+
+/**
+ * Fill the attributes of a device directory
+ * @param handle a valid handle of the attributes module
+ * @param device_db the database of the device
+ * @param[out] stbuf the structure which should be filled with the attributes
+ */
+void attributes_fill_device(attributes_h handle, const db_h device_db, struct stat* stbuf);
+
+/**
+ * Fill the attributes of an album directory
+ * @param handle a valid handle of the attributes module
+ * @param device_db the database of the device to which the album belongs
+ * @param album the album which attributes should be filled
+ * @param[out] stbuf the structure which should be filled with the attributes
+ */
+void attributes_fill_album(attributes_h handle, const db_h device_db, const album_h album, struct stat* stbuf);
+
+/**
+ * Fill the attributes of a photo file
+ * @param handle a valid handle of the attributes module
+ * @param device_db the database of the device to which the photo belongs
+ * @param album the album to which the photo belongs
+ * @param photo the photo which attributes should be filled
+ * @param[out] stbuf the structure which should be filled with the attributes
+ * @return true on success, false if the attributes couldn't be retrieved from the device (with errno set),
+ * in which case nothing is cached
+ */
+bool attributes_fill_photo(attributes_h handle, const db_h device_db, const album_h album, const photo_h photo, struct stat* stbuf);
+
+/**
+ * Fill the attributes of a photo file without accessing the device, e.g. while the directory of
+ * an album is being listed. The inode, the mode and the number of links (i.e. of the albums to
+ * which the photo belongs) are always filled, the remaining attributes only if they are known
+ * from the photo database or cached.
+ * @param handle a valid handle of the attributes module
+ * @param device_db the database of the device to which the photo belongs
+ * @param album the album to which the photo belongs
+ * @param photo the photo which attributes should be filled
+ * @param[out] stbuf the structure which should be filled with the attributes
+ * @return true if all the attributes have been filled, false if only the inode and the mode
+ */
+bool attributes_fill_photo_cached(attributes_h handle, const db_h device_db, const album_h album, const photo_h photo, struct stat* stbuf);
+
+/**
+ * Store the attributes of a photo file retrieved from the device by the caller (e.g. asynchronously,
+ * after attributes_fill_photo_cached() has failed), and fill in the inode and the mode
+ * @param handle a valid handle of the attributes module
+ * @param photo the photo to which the attributes belong
+ * @param[in,out] stbuf the attributes of the file backing the photo, which are completed in place
+ */
+void attributes_store_photo(attributes_h handle, const photo_h photo, struct stat* stbuf);
+
+/**
+ * Start retrieving the attributes of all photos of an album which are not yet known, so that
+ * they are already cached when requested. The attributes are retrieved in the background by
+ * multiple threads simultaneously, and this function returns immediately.
+ * @param handle a valid handle of the attributes module
+ * @param device_db the database of the device to which the album belongs
+ * @param album the album which photos should be prefetched
+ */
+void attributes_prefetch_album(attributes_h handle, const db_h device_db, const album_h album);
+
+/**
+ * Free the instance of the attributes module. Waits for all the pending prefetches to finish.
+ * @param handle a handle of the attributes module which should be freed
+ */
+void attributes_free(attributes_h handle);
@@ -0,0 +1,358 @@
+#include "block_cache.h"
+#include "logger.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+// the blocks are spread over this many subdirectories, so that none of them grows too large
+#define SUBDIRECTORY_COUNT 256
+
+// the last use of a block is persisted (as its modification time) at most once per this many seconds
+#define TOUCH_INTERVAL 60
+
+// the suffix of the blocks which are still being written
+#define TEMPORARY_SUFFIX ".tmp"
+
+/**
+ * A single cached block
+ */
+typedef struct block_cache_entry_s
+{
+	char* name;         /// the path of the block relative to the cache directory (also the key in block_cache_s::entries)
+	uint64_t length;    /// the length of the block
+	time_t last_used;   /// the time when the block was last used, persisted as its modification time
+	GList link;         /// the link of this entry in block_cache_s::recency
+} block_cache_entry_t;
+
+/**
+ * A structure behind block_cache_h handle
+ */
+struct block_cache_s
+{
+	char* directory;        /// the directory where the blocks are stored
+	uint64_t capacity;      /// the maximum total length of the blocks
+	GMutex lock;            /// guards entries, recency and size
+	GHashTable* entries;    /// all the cached blocks <name, entry> [char*, block_cache_entry_t*]
+	GQueue recency;         /// the cached blocks, the most recently used ones first
+	uint64_t size;          /// the total length of the cached blocks
+};
+
+static char* block_name(const block_cache_key_t* key)
+{
+	char* name = NULL;
+	unsigned int subdirectory = (unsigned int) ((key->inode + key->block) % SUBDIRECTORY_COUNT);
+
+	if (asprintf(&name, "%02x/%016" PRIx64 "-%" PRIx64 "-%" PRIx64 "-%" PRIx64, subdirectory,
+			key->inode, key->size, (uint64_t) key->mtime, key->block) == -1)
+	{
+		return NULL;
+	}
+
+	return name;
+}
+
+static void entry_free(block_cache_entry_t* entry)
+{
+	if (entry)
+	{
+		free(entry->name);
+		free(entry);
+	}
+}
+
+static block_cache_entry_t* entry_add(block_cache_h handle, const char* name, uint64_t length, time_t last_used)
+{
+	block_cache_entry_t* entry = (block_cache_entry_t*) calloc(1, sizeof(block_cache_entry_t));
+	ASSERT_RET(entry != NULL, NULL);
+
+	entry->name = strdup(name);
+	entry->length = length;
+	entry->last_used = last_used;
+	entry->link.data = entry;
+
+	g_hash_table_insert(handle->entries, entry->name, entry);
+	g_queue_push_head_link(&handle->recency, &entry->link);
+	handle->size += length;
+
+	return entry;
+}
+
+// must be called with the lock held
+static void evict(block_cache_h handle)
+{
+	while (handle->size > handle->capacity && handle->recency.tail != NULL)
+	{
+		block_cache_entry_t* entry = (block_cache_entry_t*) handle->recency.tail->data;
+
+		char* path = g_build_filename(handle->directory, entry->name, NULL);
+		if (g_unlink(path) != 0 && errno != ENOENT)
+		{
+			LOG_WARN("Unable to remove cached block %s: %s", path, strerror(errno));
+		}
+		g_free(path);
+
+		g_queue_unlink(&handle->recency, &entry->link);
+		handle->size -= entry->length;
+		g_hash_table_remove(handle->entries, entry->name);
+	}
+}
+
+static gint compare_last_used(gconstpointer a, gconstpointer b)
+{
+	const block_cache_entry_t* first = *(const block_cache_entry_t* const*) a;
+	const block_cache_entry_t* second = *(const block_cache_entry_t* const*) b;
+
+	return (first->last_used > second->last_used) - (first->last_used < second->last_used);
+}
+
+// restores the index of the blocks left by a previous instance of the cache
+static bool scan_directory(block_cache_h handle)
+{
+	GPtrArray* found = g_ptr_array_new();
+
+	for (unsigned int i = 0; i < SUBDIRECTORY_COUNT; i++)
+	{
+		char subdirectory_name[3];
+		snprintf(subdirectory_name, sizeof(subdirectory_name), "%02x", i);
+
+		char* subdirectory = g_build_filename(handle->directory, subdirectory_name, NULL);
+		if (g_mkdir_with_parents(subdirectory, 0700) != 0)
+		{
+			LOG_ERROR("Unable to create the cache directory %s: %s", subdirectory, strerror(errno));
+			g_free(subdirectory);
+			g_ptr_array_free(found, TRUE);
+			return false;
+		}
+
+		GDir* dir = g_dir_open(subdirectory, 0, NULL);
+		const char* file_name = NULL;
+
+		while (dir != NULL && (file_name = g_dir_read_name(dir)) != NULL)
+		{
+			char* path = g_build_filename(subdirectory, file_name, NULL);
+			struct stat st;
+
+			if (STRSTR(file_name, TEMPORARY_SUFFIX))
+			{
+				// a block which was being written when the previous instance was terminated
+				g_unlink(path);
+			}
+			else if (g_stat(path, &st) == 0 && S_ISREG(st.st_mode))
+			{
+				block_cache_entry_t* entry = (block_cache_entry_t*) calloc(1, sizeof(block_cache_entry_t));
+				if (entry != NULL)
+				{
+					entry->name = g_build_filename(subdirectory_name, file_name, NULL);
+					entry->length = st.st_size;
+					entry->last_used = st.st_mtime;
+					g_ptr_array_add(found, entry);
+				}
+			}
+
+			g_free(path);
+		}
+
+		if (dir != NULL)
+		{
+			g_dir_close(dir);
+		}
+
+		g_free(subdirectory);
+	}
+
+	// the least recently used blocks are pushed first, so that they end up at the tail
+	g_ptr_array_sort(found, compare_last_used);
+
+	for (guint i = 0; i < found->len; i++)
+	{
+		block_cache_entry_t* entry = (block_cache_entry_t*) g_ptr_array_index(found, i);
+		entry_add(handle, entry->name, entry->length, entry->last_used);
+
+		g_free(entry->name);
+		free(entry);
+	}
+
+	LOG_DEBUG("Found %u cached blocks (%" PRIu64 " bytes) in %s", found->len, handle->size, handle->directory);
+
+	g_ptr_array_free(found, TRUE);
+	evict(handle);
+
+	return true;
+}
+
+block_cache_h block_cache_create(const char* directory, uint64_t capacity)
+{
+	ASSERT_RET(directory != NULL, NULL);
+
+	block_cache_h handle = (block_cache_h) calloc(1, sizeof(struct block_cache_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->directory = strdup(directory);
+	handle->capacity = capacity;
+	g_mutex_init(&handle->lock);
+	handle->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) entry_free);
+	g_queue_init(&handle->recency);
+
+	if (handle->directory == NULL || !scan_directory(handle))
+	{
+		block_cache_free(handle);
+		return NULL;
+	}
+
+	return handle;
+}
+
+ssize_t block_cache_read(block_cache_h handle, const block_cache_key_t* key, void* buffer, size_t offset, size_t size)
+{
+	ASSERT_RET(handle != NULL, -1);
+	ASSERT_RET(key != NULL, -1);
+	ASSERT_RET(buffer != NULL, -1);
+
+	char* name = block_name(key);
+	if (name == NULL)
+	{
+		return -1;
+	}
+
+	bool cached = false;
+	bool touch = false;
+	time_t now = time(NULL);
+
+	g_mutex_lock(&handle->lock);
+
+	block_cache_entry_t* entry = (block_cache_entry_t*) g_hash_table_lookup(handle->entries, name);
+	if (entry != NULL)
+	{
+		cached = true;
+		g_queue_unlink(&handle->recency, &entry->link);
+		g_queue_push_head_link(&handle->recency, &entry->link);
+
+		if (now - entry->last_used >= TOUCH_INTERVAL)
+		{
+			entry->last_used = now;
+			touch = true;
+		}
+	}
+
+	g_mutex_unlock(&handle->lock);
+
+	ssize_t result = -1;
+
+	if (cached)
+	{
+		char* path = g_build_filename(handle->directory, name, NULL);
+
+		// the block might have been evicted in the meantime, which is simply treated as a miss
+		int fd = open(path, O_RDONLY);
+		if (fd != -1)
+		{
+			result = pread(fd, buffer, size, offset);
+			close(fd);
+
+			if (touch)
+			{
+				utimensat(AT_FDCWD, path, NULL, 0);
+			}
+		}
+
+		g_free(path);
+	}
+
+	free(name);
+	return result;
+}
+
+static bool write_all(int fd, const char* buffer, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t result = write(fd, buffer, length);
+		if (result == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		buffer += result;
+		length -= result;
+	}
+
+	return true;
+}
+
+void block_cache_write(block_cache_h handle, const block_cache_key_t* key, const void* buffer, size_t length)
+{
+	ASSERT_RET(handle != NULL);
+	ASSERT_RET(key != NULL);
+	ASSERT_RET(buffer != NULL);
+	ASSERT_RET(length <= BLOCK_CACHE_BLOCK_SIZE);
+
+	char* name = block_name(key);
+	if (name == NULL)
+	{
+		return;
+	}
+
+	char* path = g_build_filename(handle->directory, name, NULL);
+	char* temporary_path = g_strconcat(path, TEMPORARY_SUFFIX ".XXXXXX", NULL);
+
+	// the block is written under a temporary name first, so that no one reads it half-written
+	int fd = g_mkstemp(temporary_path);
+	if (fd == -1)
+	{
+		LOG_WARN("Unable to create cached block %s: %s", temporary_path, strerror(errno));
+	}
+	else
+	{
+		bool written = write_all(fd, (const char*) buffer, length);
+		close(fd);
+
+		if (!written || g_rename(temporary_path, path) != 0)
+		{
+			LOG_WARN("Unable to write cached block %s: %s", path, strerror(errno));
+			g_unlink(temporary_path);
+		}
+		else
+		{
+			g_mutex_lock(&handle->lock);
+
+			// another thread might have cached the same block concurrently
+			if (!g_hash_table_contains(handle->entries, name))
+			{
+				entry_add(handle, name, length, time(NULL));
+				evict(handle);
+			}
+
+			g_mutex_unlock(&handle->lock);
+		}
+	}
+
+	g_free(temporary_path);
+	g_free(path);
+	free(name);
+}
+
+void block_cache_free(block_cache_h handle)
+{
+	if (handle)
+	{
+		// entries are owned by the hash table, the queue only links them
+		g_hash_table_unref(handle->entries);
+		g_mutex_clear(&handle->lock);
+		free(handle->directory);
+		free(handle);
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * A persistent cache of the contents of photos, kept on the local disk. Every photo is split
+ * into blocks of BLOCK_CACHE_BLOCK_SIZE bytes, each stored in a separate file which name is
+ * derived from the identity of the photo, its size and modification time (as known from the
+ * catalog), and the index of the block. A photo which has changed on the device therefore maps
+ * to different files, while its stale blocks are evicted once the cache exceeds its capacity,
+ * least recently used first. The cache survives restarts of ipa.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// the size of a single cached block of a photo
+#define BLOCK_CACHE_BLOCK_SIZE (1024 * 1024)
+
+/**
+ * A handle of a block cache
+ */
+typedef struct block_cache_s* block_cache_h;
+
+/**
+ * The key identifying a single block of a photo
+ */
+typedef struct block_cache_key_s
+{
+	uint64_t inode;     /// the inode of the photo (see inode.h)
+	uint64_t size;      /// the size of the photo
+	int64_t mtime;      /// the modification time of the photo
+	uint64_t block;     /// the index of the block within the photo
+} block_cache_key_t;
+
+/**
+ * Create a new block cache, or open the one left in the directory by a previous instance
+ * @param directory the directory where the blocks should be stored, created if it doesn't exist
+ * @param capacity the maximum number of bytes which may be occupied by the cached blocks
+ * @return a handle to the block cache or NULL on error
+ */
+block_cache_h block_cache_create(const char* directory, uint64_t capacity);
+
+/**
+ * Read a range of a cached block
+ * @param handle a valid handle of a block cache
+ * @param key the key of the block
+ * @param[out] buffer the buffer which should be filled with the data
+ * @param offset the offset within the block where the range begins
+ * @param size the size of the range
+ * @return the number of bytes read (less than size only if the block is the last one of the photo),
+ * or -1 if the block is not cached
+ * @note this function is thread-safe
+ */
+ssize_t block_cache_read(block_cache_h handle, const block_cache_key_t* key, void* buffer, size_t offset, size_t size);
+
+/**
+ * Store a block in the cache, evicting the least recently used blocks if necessary
+ * @param handle a valid handle of a block cache
+ * @param key the key of the block
+ * @param buffer the contents of the block
+ * @param length the length of the block, i.e. BLOCK_CACHE_BLOCK_SIZE for all but the last block of a photo
+ * @note this function is thread-safe
+ */
+void block_cache_write(block_cache_h handle, const block_cache_key_t* key, const void* buffer, size_t length);
+
+/**
+ * Close the block cache. The cached blocks are kept on the disk.
+ * @param handle a handle of a block cache which should be freed
+ */
+void block_cache_free(block_cache_h handle);
@@ -0,0 +1,109 @@
+#include "bloom_filter.h"
+#include "logger.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// the number of bits per added string and the number of bits set for each of them, which
+// together give about 1% of false positives
+#define BITS_PER_ENTRY 10
+#define HASH_COUNT 7
+
+/**
+ * A structure behind bloom_filter_h handle
+ */
+struct bloom_filter_s
+{
+	unsigned int capacity;  /// the number of strings the filter has been sized for
+	uint64_t bit_count;     /// the number of bits of the filter
+	uint64_t* bits;
+};
+
+// the 64-bit FNV-1a hash, split into two halves for double hashing
+static uint64_t fnv1a(const char* text)
+{
+	uint64_t hash = UINT64_C(14695981039346656037);
+
+	for (const unsigned char* c = (const unsigned char*) text; *c != 0; c++)
+	{
+		hash ^= *c;
+		hash *= UINT64_C(1099511628211);
+	}
+
+	return hash;
+}
+
+// the position of the i-th bit of a string, derived from its hash (Kirsch-Mitzenmacher)
+static uint64_t bit_index(const bloom_filter_h handle, uint64_t hash, unsigned int i)
+{
+	uint64_t first = hash & 0xFFFFFFFF;
+	uint64_t second = (hash >> 32) | 1;
+
+	return (first + i * second) % handle->bit_count;
+}
+
+bloom_filter_h bloom_filter_create(unsigned int capacity)
+{
+	bloom_filter_h handle = (bloom_filter_h) calloc(1, sizeof(struct bloom_filter_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->capacity = capacity;
+	handle->bit_count = ((uint64_t) (capacity > 0 ? capacity : 1) * BITS_PER_ENTRY + 63) / 64 * 64;
+	handle->bits = (uint64_t*) calloc(handle->bit_count / 64, sizeof(uint64_t));
+
+	if (handle->bits == NULL)
+	{
+		bloom_filter_free(handle);
+		return NULL;
+	}
+
+	return handle;
+}
+
+unsigned int bloom_filter_get_capacity(const bloom_filter_h handle)
+{
+	ASSERT_RET(handle != NULL, 0);
+	return handle->capacity;
+}
+
+void bloom_filter_add(bloom_filter_h handle, const char* text)
+{
+	ASSERT_RET(handle != NULL);
+	ASSERT_RET(text != NULL);
+
+	uint64_t hash = fnv1a(text);
+
+	for (unsigned int i = 0; i < HASH_COUNT; i++)
+	{
+		uint64_t index = bit_index(handle, hash, i);
+		handle->bits[index / 64] |= UINT64_C(1) << (index % 64);
+	}
+}
+
+bool bloom_filter_may_contain(const bloom_filter_h handle, const char* text)
+{
+	ASSERT_RET(handle != NULL, true);
+	ASSERT_RET(text != NULL, true);
+
+	uint64_t hash = fnv1a(text);
+
+	for (unsigned int i = 0; i < HASH_COUNT; i++)
+	{
+		uint64_t index = bit_index(handle, hash, i);
+		if ((handle->bits[index / 64] & (UINT64_C(1) << (index % 64))) == 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void bloom_filter_free(bloom_filter_h handle)
+{
+	if (handle)
+	{
+		free(handle->bits);
+		free(handle);
+	}
+}
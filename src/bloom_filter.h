@@ -0,0 +1,53 @@
+/*
+ * A Bloom filter of strings, i.e. a compact set which may only be asked whether it might contain
+ * a string. The answer "no" is always right, while "maybe" is wrong for about 1% of the strings
+ * which have never been added. It's used to reject the names which are looked up but never exist
+ * (e.g. .DS_Store, desktop.ini or ._* files probed by file managers) before the actual lookup.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * A handle of a Bloom filter
+ */
+typedef struct bloom_filter_s* bloom_filter_h;
+
+/**
+ * Create a new, empty Bloom filter
+ * @param capacity the number of strings which will be added, more of them raise the rate of
+ * false positives above the nominal one
+ * @return a handle of the filter or NULL on error
+ */
+bloom_filter_h bloom_filter_create(unsigned int capacity);
+
+/**
+ * Get the number of strings the filter has been created for
+ * @param handle a valid handle of a Bloom filter
+ * @return the capacity passed to bloom_filter_create()
+ */
+unsigned int bloom_filter_get_capacity(const bloom_filter_h handle);
+
+/**
+ * Add a string to the filter
+ * @param handle a valid handle of a Bloom filter
+ * @param text the string which should be added
+ */
+void bloom_filter_add(bloom_filter_h handle, const char* text);
+
+/**
+ * Check whether the filter might contain a string
+ * @param handle a valid handle of a Bloom filter
+ * @param text the string which should be checked
+ * @return false if the string has certainly never been added, true if it might have been
+ * @note this function may be called by multiple threads simultaneously, as long as no string is
+ * being added at the same time
+ */
+bool bloom_filter_may_contain(const bloom_filter_h handle, const char* text);
+
+/**
+ * Free the Bloom filter
+ * @param handle a handle of a Bloom filter which should be freed
+ */
+void bloom_filter_free(bloom_filter_h handle);
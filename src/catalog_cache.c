@@ -0,0 +1,548 @@
+#include "catalog_cache.h"
+#include "logger.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+// identifies the files of the catalog cache
+#define CATALOG_MAGIC "IPACATLG"
+
+// incremented whenever the layout of the file changes, the files in other layouts are ignored
+#define CATALOG_FORMAT_VERSION 2
+
+// the offset and the size of the file change counter within the header of a sqlite database
+#define SQLITE_CHANGE_COUNTER_OFFSET 24
+#define SQLITE_CHANGE_COUNTER_SIZE 4
+
+// the suffix of the write-ahead log of a sqlite database
+#define WAL_SUFFIX "-wal"
+
+// set in catalog_photo_record_t::flags if the attributes of the photo are known
+#define PHOTO_FLAG_HAS_STAT 1
+
+/*
+ * The file begins with the header, followed by the array of the photos, the array of the albums (sorted
+ * by their names, so that they can be found by a binary search), the array of the memberships (indices
+ * of the photos, grouped by the albums) and finally the table of the strings, referred to by their
+ * offsets. The sizes of all the records are multiples of 8 bytes, so that all the arrays are aligned
+ * within the mapped file.
+ */
+
+/**
+ * The header of a file of the catalog cache
+ */
+typedef struct catalog_header_s
+{
+	char magic[8];                  /// CATALOG_MAGIC
+	uint32_t format_version;        /// CATALOG_FORMAT_VERSION
+	uint32_t header_size;           /// the size of this header
+	uint64_t device_inode;          /// the inode of the device of the catalog
+	catalog_key_t key;              /// the state of the photo database the catalog has been extracted from
+	uint32_t photo_count;           /// the number of the photo records
+	uint32_t album_count;           /// the number of the album records
+	uint32_t member_count;          /// the number of the memberships
+	uint32_t strings_size;          /// the size of the table of the strings
+} catalog_header_t;
+
+/**
+ * A photo, as stored in the file
+ */
+typedef struct catalog_photo_record_s
+{
+	uint64_t inode;
+	int64_t asset_pk;
+	uint64_t size;
+	int64_t mtime;
+	int64_t ctime;
+	uint32_t file_name;             /// the offset of the file name within the table of the strings
+	uint32_t location;              /// the offset of the relative location within the table of the strings
+	uint32_t flags;                 /// a combination of PHOTO_FLAG_* values
+	uint32_t album_count;           /// the number of the albums containing the photo
+} catalog_photo_record_t;
+
+/**
+ * An album, as stored in the file
+ */
+typedef struct catalog_album_record_s
+{
+	uint64_t inode;
+	uint32_t name;                  /// the offset of the name within the table of the strings
+	uint32_t first_member;          /// the index of the first membership of the album
+	uint32_t member_count;          /// the number of the memberships of the album
+	uint32_t reserved;
+} catalog_album_record_t;
+
+_Static_assert(sizeof(catalog_header_t) % 8 == 0, "the photo records would be misaligned");
+_Static_assert(sizeof(catalog_photo_record_t) % 8 == 0, "the album records would be misaligned");
+_Static_assert(sizeof(catalog_album_record_t) % 8 == 0, "the memberships would be misaligned");
+
+/**
+ * A structure behind catalog_writer_h handle
+ */
+struct catalog_writer_s
+{
+	GArray* photos;                 /// the records of the photos [catalog_photo_record_t]
+	GArray* albums;                 /// the records of the albums [catalog_album_record_t]
+	GArray* members;                /// the memberships of the photos in the albums [uint32_t]
+	GString* strings;               /// the table of the strings
+};
+
+/**
+ * A structure behind catalog_reader_h handle
+ */
+struct catalog_reader_s
+{
+	void* data;                     /// the mapped file
+	size_t size;                    /// the size of the mapped file
+	const catalog_header_t* header;
+	const catalog_photo_record_t* photos;
+	const catalog_album_record_t* albums;
+	const uint32_t* members;
+	const char* strings;
+};
+
+// the key
+
+bool catalog_key_read(const char* db_location, catalog_key_t* key)
+{
+	ASSERT_RET(db_location != NULL, false);
+	ASSERT_RET(key != NULL, false);
+
+	memset(key, 0, sizeof(catalog_key_t));
+
+	struct stat st;
+	if (g_stat(db_location, &st) != 0)
+	{
+		return false;
+	}
+
+	key->db_size = st.st_size;
+	key->db_mtime = st.st_mtime;
+
+	// the commits which haven't been checkpointed yet only change the log
+	char* wal_location = g_strconcat(db_location, WAL_SUFFIX, NULL);
+	if (g_stat(wal_location, &st) == 0)
+	{
+		key->wal_size = st.st_size;
+		key->wal_mtime = st.st_mtime;
+	}
+	g_free(wal_location);
+
+	// the counter is incremented by every transaction which modifies the database (outside of the
+	// write-ahead log mode), which catches the changes preserving both the size and the modification time
+	int fd = open(db_location, O_RDONLY);
+	if (fd == -1)
+	{
+		return false;
+	}
+
+	unsigned char counter[SQLITE_CHANGE_COUNTER_SIZE];
+	bool read_counter = (pread(fd, counter, sizeof(counter), SQLITE_CHANGE_COUNTER_OFFSET) == sizeof(counter));
+	close(fd);
+
+	if (!read_counter)
+	{
+		return false;
+	}
+
+	key->change_counter = ((uint32_t) counter[0] << 24) | ((uint32_t) counter[1] << 16) |
+			((uint32_t) counter[2] << 8) | (uint32_t) counter[3];
+
+	return true;
+}
+
+// the writer
+
+static uint32_t writer_add_string(catalog_writer_h handle, const char* string)
+{
+	uint32_t offset = handle->strings->len;
+	g_string_append_len(handle->strings, string, strlen(string) + 1);
+
+	return offset;
+}
+
+catalog_writer_h catalog_writer_create(void)
+{
+	catalog_writer_h handle = (catalog_writer_h) calloc(1, sizeof(struct catalog_writer_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->photos = g_array_new(FALSE, FALSE, sizeof(catalog_photo_record_t));
+	handle->albums = g_array_new(FALSE, FALSE, sizeof(catalog_album_record_t));
+	handle->members = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+	handle->strings = g_string_new(NULL);
+
+	return handle;
+}
+
+uint32_t catalog_writer_add_photo(catalog_writer_h handle, const catalog_photo_t* photo)
+{
+	ASSERT_RET(handle != NULL, 0);
+	ASSERT_RET(photo != NULL, 0);
+	ASSERT_RET(photo->file_name != NULL && photo->location != NULL, 0);
+
+	catalog_photo_record_t record = {
+		.inode = photo->inode,
+		.asset_pk = photo->asset_pk,
+		.size = photo->has_stat ? photo->size : 0,
+		.mtime = photo->has_stat ? photo->mtime : 0,
+		.ctime = photo->has_stat ? photo->ctime : 0,
+		.file_name = writer_add_string(handle, photo->file_name),
+		.location = writer_add_string(handle, photo->location),
+		.flags = photo->has_stat ? PHOTO_FLAG_HAS_STAT : 0,
+		.album_count = 0
+	};
+
+	g_array_append_val(handle->photos, record);
+	return handle->photos->len - 1;
+}
+
+void catalog_writer_add_album(catalog_writer_h handle, const catalog_album_t* album)
+{
+	ASSERT_RET(handle != NULL);
+	ASSERT_RET(album != NULL);
+	ASSERT_RET(album->name != NULL);
+
+	catalog_album_record_t record = {
+		.inode = album->inode,
+		.name = writer_add_string(handle, album->name),
+		.first_member = handle->members->len,
+		.member_count = album->photo_count
+	};
+
+	for (uint32_t i = 0; i < album->photo_count; i++)
+	{
+		ASSERT_RET(album->photos[i] < handle->photos->len);
+		g_array_index(handle->photos, catalog_photo_record_t, album->photos[i]).album_count++;
+	}
+
+	g_array_append_vals(handle->members, album->photos, album->photo_count);
+	g_array_append_val(handle->albums, record);
+}
+
+static gint compare_album_records(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const char* strings = (const char*) user_data;
+
+	return strcmp(strings + ((const catalog_album_record_t*) a)->name, strings + ((const catalog_album_record_t*) b)->name);
+}
+
+static bool write_all(int fd, const void* buffer, size_t length)
+{
+	const char* data = (const char*) buffer;
+
+	while (length > 0)
+	{
+		ssize_t result = write(fd, data, length);
+		if (result == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		data += result;
+		length -= result;
+	}
+
+	return true;
+}
+
+bool catalog_writer_save(catalog_writer_h handle, const char* path, uint64_t device_inode, const catalog_key_t* key)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(path != NULL, false);
+	ASSERT_RET(key != NULL, false);
+
+	catalog_header_t header = {
+		.format_version = CATALOG_FORMAT_VERSION,
+		.header_size = sizeof(catalog_header_t),
+		.device_inode = device_inode,
+		.key = *key,
+		.photo_count = handle->photos->len,
+		.album_count = handle->albums->len,
+		.member_count = handle->members->len,
+		.strings_size = handle->strings->len
+	};
+
+	memcpy(header.magic, CATALOG_MAGIC, sizeof(header.magic));
+
+	// the memberships are referred to by the albums, so the albums can be reordered freely
+	g_array_sort_with_data(handle->albums, compare_album_records, handle->strings->str);
+
+	char* directory = g_path_get_dirname(path);
+	g_mkdir_with_parents(directory, 0700);
+	g_free(directory);
+
+	// the catalog is written under a temporary name first, so that no one maps it half-written
+	char* temporary_path = g_strconcat(path, ".XXXXXX", NULL);
+
+	int fd = g_mkstemp(temporary_path);
+	if (fd == -1)
+	{
+		LOG_WARN("Unable to create the catalog cache %s: %s", temporary_path, strerror(errno));
+		g_free(temporary_path);
+		return false;
+	}
+
+	bool written = write_all(fd, &header, sizeof(header)) &&
+			write_all(fd, handle->photos->data, handle->photos->len * sizeof(catalog_photo_record_t)) &&
+			write_all(fd, handle->albums->data, handle->albums->len * sizeof(catalog_album_record_t)) &&
+			write_all(fd, handle->members->data, handle->members->len * sizeof(uint32_t)) &&
+			write_all(fd, handle->strings->str, handle->strings->len);
+
+	written = (close(fd) == 0) && written;
+
+	if (!written || g_rename(temporary_path, path) != 0)
+	{
+		LOG_WARN("Unable to write the catalog cache %s: %s", path, strerror(errno));
+		g_unlink(temporary_path);
+		g_free(temporary_path);
+		return false;
+	}
+
+	g_free(temporary_path);
+	return true;
+}
+
+void catalog_writer_free(catalog_writer_h handle)
+{
+	if (handle)
+	{
+		g_array_free(handle->photos, TRUE);
+		g_array_free(handle->albums, TRUE);
+		g_array_free(handle->members, TRUE);
+		g_string_free(handle->strings, TRUE);
+		free(handle);
+	}
+}
+
+// the reader
+
+// checks that all the records refer to the existing strings and photos, so that they can be trusted afterwards
+static bool reader_validate(catalog_reader_h handle)
+{
+	const catalog_header_t* header = handle->header;
+
+	// every string is terminated within the table if the last one is
+	if (header->strings_size > 0 && handle->strings[header->strings_size - 1] != 0)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header->photo_count; i++)
+	{
+		if (handle->photos[i].file_name >= header->strings_size || handle->photos[i].location >= header->strings_size)
+		{
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < header->album_count; i++)
+	{
+		const catalog_album_record_t* album = &handle->albums[i];
+
+		if (album->name >= header->strings_size ||
+				(uint64_t) album->first_member + album->member_count > header->member_count)
+		{
+			return false;
+		}
+
+		// the albums are found by a binary search, which requires unique names in order
+		if (i > 0 && strcmp(handle->strings + handle->albums[i - 1].name, handle->strings + album->name) >= 0)
+		{
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < header->member_count; i++)
+	{
+		if (handle->members[i] >= header->photo_count)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+catalog_reader_h catalog_reader_open(const char* path, uint64_t device_inode, const catalog_key_t* key)
+{
+	ASSERT_RET(path != NULL, NULL);
+	ASSERT_RET(key != NULL, NULL);
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(catalog_header_t))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		LOG_WARN("Unable to map the catalog cache %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	catalog_reader_h handle = (catalog_reader_h) calloc(1, sizeof(struct catalog_reader_s));
+	if (handle == NULL)
+	{
+		munmap(data, st.st_size);
+		return NULL;
+	}
+
+	handle->data = data;
+	handle->size = st.st_size;
+	handle->header = (const catalog_header_t*) data;
+
+	const catalog_header_t* header = handle->header;
+
+	if (memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) != 0 ||
+			header->format_version != CATALOG_FORMAT_VERSION || header->header_size != sizeof(catalog_header_t))
+	{
+		LOG_DEBUG("Ignoring the catalog cache %s in an unknown format", path);
+		catalog_reader_close(handle);
+		return NULL;
+	}
+
+	if (header->device_inode != device_inode || memcmp(&header->key, key, sizeof(catalog_key_t)) != 0)
+	{
+		LOG_DEBUG("Ignoring the catalog cache %s of a different database", path);
+		catalog_reader_close(handle);
+		return NULL;
+	}
+
+	uint64_t photos_offset = sizeof(catalog_header_t);
+	uint64_t albums_offset = photos_offset + (uint64_t) header->photo_count * sizeof(catalog_photo_record_t);
+	uint64_t members_offset = albums_offset + (uint64_t) header->album_count * sizeof(catalog_album_record_t);
+	uint64_t strings_offset = members_offset + (uint64_t) header->member_count * sizeof(uint32_t);
+
+	if (strings_offset + header->strings_size != handle->size)
+	{
+		LOG_WARN("Ignoring the truncated catalog cache %s", path);
+		catalog_reader_close(handle);
+		return NULL;
+	}
+
+	handle->photos = (const catalog_photo_record_t*) ((const char*) data + photos_offset);
+	handle->albums = (const catalog_album_record_t*) ((const char*) data + albums_offset);
+	handle->members = (const uint32_t*) ((const char*) data + members_offset);
+	handle->strings = (const char*) data + strings_offset;
+
+	if (!reader_validate(handle))
+	{
+		LOG_WARN("Ignoring the malformed catalog cache %s", path);
+		catalog_reader_close(handle);
+		return NULL;
+	}
+
+	return handle;
+}
+
+uint32_t catalog_reader_get_photo_count(const catalog_reader_h handle)
+{
+	ASSERT_RET(handle != NULL, 0);
+	return handle->header->photo_count;
+}
+
+bool catalog_reader_get_photo(const catalog_reader_h handle, uint32_t index, catalog_photo_t* photo)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(index < handle->header->photo_count, false);
+	ASSERT_RET(photo != NULL, false);
+
+	const catalog_photo_record_t* record = &handle->photos[index];
+
+	photo->file_name = handle->strings + record->file_name;
+	photo->location = handle->strings + record->location;
+	photo->inode = record->inode;
+	photo->asset_pk = record->asset_pk;
+	photo->has_stat = (record->flags & PHOTO_FLAG_HAS_STAT) != 0;
+	photo->size = record->size;
+	photo->mtime = record->mtime;
+	photo->ctime = record->ctime;
+	photo->album_count = record->album_count;
+
+	return true;
+}
+
+uint32_t catalog_reader_get_album_count(const catalog_reader_h handle)
+{
+	ASSERT_RET(handle != NULL, 0);
+	return handle->header->album_count;
+}
+
+bool catalog_reader_get_album(const catalog_reader_h handle, uint32_t index, catalog_album_t* album)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(index < handle->header->album_count, false);
+	ASSERT_RET(album != NULL, false);
+
+	const catalog_album_record_t* record = &handle->albums[index];
+
+	album->name = handle->strings + record->name;
+	album->inode = record->inode;
+	album->photos = handle->members + record->first_member;
+	album->photo_count = record->member_count;
+
+	return true;
+}
+
+bool catalog_reader_find_album(const catalog_reader_h handle, const char* name, catalog_album_t* album)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(name != NULL, false);
+	ASSERT_RET(album != NULL, false);
+
+	uint32_t low = 0;
+	uint32_t high = handle->header->album_count;
+
+	while (low < high)
+	{
+		uint32_t middle = low + (high - low) / 2;
+		int order = strcmp(handle->strings + handle->albums[middle].name, name);
+
+		if (order == 0)
+		{
+			return catalog_reader_get_album(handle, middle, album);
+		}
+
+		if (order < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	return false;
+}
+
+void catalog_reader_close(catalog_reader_h handle)
+{
+	if (handle)
+	{
+		munmap(handle->data, handle->size);
+		free(handle);
+	}
+}
@@ -0,0 +1,172 @@
+/*
+ * A persistent cache of the catalogs of the devices. Extracting the catalog from the photo database
+ * of a device takes seconds (see db.c), while the database rarely changes between the mounts. Hence,
+ * once the catalog has been extracted, it's saved in a compact binary file: a table of all the strings,
+ * an array of the photos, an array of the albums and the memberships of the photos in the albums,
+ * all referring to each other by indices.
+ *
+ * The file is identified by the state of the photo database it has been extracted from (see
+ * catalog_key_t). On the next mount the file is mapped into memory and, as long as the database is
+ * still in the same state, the catalog is served from it without querying the database at all: only
+ * the albums are created upfront, and the photos of each of them are read from the mapping when the
+ * album is first needed (see catalog_reader_find_album()).
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The state of a photo database, which changes whenever the database is modified
+ */
+typedef struct catalog_key_s
+{
+	uint64_t db_size;           /// the size of the database file
+	int64_t db_mtime;           /// the modification time of the database file
+	uint64_t wal_size;          /// the size of the write-ahead log of the database, 0 if there is none
+	int64_t wal_mtime;          /// the modification time of the write-ahead log of the database, 0 if there is none
+	uint32_t change_counter;    /// the file change counter from the header of the database
+	uint32_t reserved;          /// always 0
+} catalog_key_t;
+
+/**
+ * Retrieve the current state of a photo database
+ * @param db_location the location of the photo database
+ * @param[out] key the state which should be filled
+ * @return true on success, false if the database couldn't be accessed
+ */
+bool catalog_key_read(const char* db_location, catalog_key_t* key);
+
+/**
+ * A photo stored in the catalog cache
+ */
+typedef struct catalog_photo_s
+{
+	const char* file_name;      /// the file name of the photo
+	const char* location;       /// the location of the photo, relative to the root directory of the device
+	uint64_t inode;             /// the inode of the photo
+	int64_t asset_pk;           /// the primary key of the asset of the photo within the photo database
+	bool has_stat;              /// whether the attributes below are known
+	uint64_t size;              /// the size of the photo
+	int64_t mtime;              /// the modification time of the photo
+	int64_t ctime;              /// the creation time of the photo
+	uint32_t album_count;       /// the number of the albums containing the photo (counted by the writer, see catalog_writer_add_album())
+} catalog_photo_t;
+
+/**
+ * An album stored in the catalog cache
+ */
+typedef struct catalog_album_s
+{
+	const char* name;           /// the name of the album
+	uint64_t inode;             /// the inode of the album
+	const uint32_t* photos;     /// the indices of the photos of the album, in their order within the album
+	uint32_t photo_count;       /// the number of the photos of the album
+} catalog_album_t;
+
+/**
+ * A handle of a catalog being written into the cache
+ */
+typedef struct catalog_writer_s* catalog_writer_h;
+
+/**
+ * Begin writing a catalog
+ * @return a handle of the writer or NULL on error
+ */
+catalog_writer_h catalog_writer_create(void);
+
+/**
+ * Add a photo to the written catalog
+ * @param handle a valid handle of a writer
+ * @param photo the photo which should be added (its strings are copied)
+ * @return the index of the photo, by which the albums refer to it
+ */
+uint32_t catalog_writer_add_photo(catalog_writer_h handle, const catalog_photo_t* photo);
+
+/**
+ * Add an album to the written catalog
+ * @param handle a valid handle of a writer
+ * @param album the album which should be added (its name and the indices of its photos are copied), the
+ * names of the albums must be unique
+ */
+void catalog_writer_add_album(catalog_writer_h handle, const catalog_album_t* album);
+
+/**
+ * Save the written catalog into a file, replacing the previous one atomically
+ * @param handle a valid handle of a writer
+ * @param path the path of the file
+ * @param device_inode the inode of the device of the catalog
+ * @param key the state of the photo database the catalog has been extracted from
+ * @return true on success, false on error
+ */
+bool catalog_writer_save(catalog_writer_h handle, const char* path, uint64_t device_inode, const catalog_key_t* key);
+
+/**
+ * Free the writer
+ * @param handle a handle of a writer which should be freed
+ */
+void catalog_writer_free(catalog_writer_h handle);
+
+/**
+ * A handle of a catalog read from the cache
+ */
+typedef struct catalog_reader_s* catalog_reader_h;
+
+/**
+ * Map a cached catalog into memory
+ * @param path the path of the file of the catalog
+ * @param device_inode the inode of the device of the catalog
+ * @param key the current state of the photo database of the device
+ * @return a handle of the catalog, or NULL if it doesn't exist, is malformed, or has been extracted from
+ * the database in a different state
+ */
+catalog_reader_h catalog_reader_open(const char* path, uint64_t device_inode, const catalog_key_t* key);
+
+/**
+ * Get the number of the photos of a cached catalog
+ * @param handle a valid handle of a cached catalog
+ * @return the number of the photos
+ */
+uint32_t catalog_reader_get_photo_count(const catalog_reader_h handle);
+
+/**
+ * Get a photo of a cached catalog
+ * @param handle a valid handle of a cached catalog
+ * @param index the index of the photo, lower than catalog_reader_get_photo_count()
+ * @param[out] photo the photo which should be filled, its strings point into the mapped catalog
+ * @return true on success, false on invalid arguments
+ */
+bool catalog_reader_get_photo(const catalog_reader_h handle, uint32_t index, catalog_photo_t* photo);
+
+/**
+ * Get the number of the albums of a cached catalog
+ * @param handle a valid handle of a cached catalog
+ * @return the number of the albums
+ */
+uint32_t catalog_reader_get_album_count(const catalog_reader_h handle);
+
+/**
+ * Get an album of a cached catalog
+ * @param handle a valid handle of a cached catalog
+ * @param index the index of the album, lower than catalog_reader_get_album_count()
+ * @param[out] album the album which should be filled, its name and photos point into the mapped catalog
+ * @return true on success, false on invalid arguments
+ */
+bool catalog_reader_get_album(const catalog_reader_h handle, uint32_t index, catalog_album_t* album);
+
+/**
+ * Find an album of a cached catalog by its name, with a binary search over the albums sorted by their names
+ * @param handle a valid handle of a cached catalog
+ * @param name the name of the album
+ * @param[out] album the album which should be filled, its name and photos point into the mapped catalog
+ * @return true if the album has been found, false otherwise
+ */
+bool catalog_reader_find_album(const catalog_reader_h handle, const char* name, catalog_album_t* album);
+
+/**
+ * Unmap the cached catalog
+ * @param handle a handle of a cached catalog which should be closed
+ * @note the strings and arrays retrieved from the catalog are no longer valid afterwards
+ */
+void catalog_reader_close(catalog_reader_h handle);
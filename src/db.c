@@ -2,10 +2,14 @@
 #include "album.h"
 #include "utils.h"
 #include "logger.h"
+#include "inode.h"
+#include "db_snapshot.h"
+#include "catalog_cache.h"
 
 #include <sqlite3.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <inttypes.h>
 
 #include <glib.h>
 
@@ -15,25 +19,77 @@
 // the name of the table containing the photo albums
 #define ALBUM_TABLE_NAME 	"ZGENERICALBUM"
 
+// the name of the table containing additional attributes of the photos (e.g. file sizes)
+#define ATTRIBUTES_TABLE_NAME	"ZADDITIONALASSETATTRIBUTES"
+
+// the dates in the photo database are stored as seconds since 2001-01-01 (Core Data reference date)
+#define CORE_DATA_EPOCH_OFFSET 978307200
+
+// restricts the photo and summary queries to the albums with the title bound as their first parameter
+#define ALBUM_TITLE_CONDITION "and " ALBUM_TABLE_NAME ".ZTITLE = ?1"
+
 /**
- * A structure behind db_h handle
+ * The state of an album within the photo database. Core Data increments Z_OPT of a record whenever
+ * the record is saved, which includes adding and removing the photos of an album, so the albums which
+ * haven't changed since the previous extraction are recognized without querying their photos.
  */
-typedef struct db_s
+typedef struct db_album_state_s
+{
+	int64_t opt;                    /// the version of the album record (Z_OPT)
+	char* title;                    /// the title of the album, or NULL if it has none
+} db_album_state_t;
+
+/**
+ * The photo database of a device, shared by all the catalogs of the device. The lazily loaded albums
+ * (see db_load_album()) query it from the threads serving the filesystem while the catalog may be
+ * refreshed, so the connection is only used with the lock held.
+ */
+typedef struct db_source_s
 {
-	sqlite3* db;                    /// the active connection to the sqlite database
+	GMutex lock;                    /// guards the connection and the schema discovered through it
+	sqlite3* db;                    /// the active connection to the sqlite database, or NULL if it isn't open (see db_source_connect())
+	db_snapshot_h snapshot;         /// the local copy of the database which is queried instead of the original, or NULL
+	char* db_location;              /// the location of the photo database on the device
+	bool use_snapshot;              /// whether the database should be queried through a local snapshot (see db_open())
 	char* device_name;              /// the human-readable of the corresponding device (may not be globally unique)
 	char* root_path;                /// the absolute path to the root directory of the corresponding device
+	uint64_t inode;                 /// the inode number assigned to the corresponding device
 
 	char* assets_table_name;        /// discovered table name storing assets (see verify_database_sanity())
 	char* assets_album_fk;          /// discovered foreign key of album in assets table (see verify_database_sanity())
 	char* assets_photo_fk;          /// discovered foreign key of photo in assets table (see verify_database_sanity())
 
+	const char* created_column;     /// the column with photo creation dates, or "NULL" if missing (see discover_photo_attributes())
+	const char* modified_column;    /// the column with photo modification dates, or "NULL" if missing (see discover_photo_attributes())
+	const char* size_column;        /// the column with photo file sizes, or "NULL" if missing (see discover_photo_attributes())
+
+	GHashTable* photos;             /// the photos of the loaded lazy albums, shared by them <asset-pk, photo details> [int64_t*, photo_h], guarded by the lock
+
+	gint ref_count;                 /// reference counter, held by the catalogs and by the lazily loaded albums
+} db_source_t;
+
+/**
+ * A structure behind db_h handle
+ */
+typedef struct db_s
+{
+	db_source_t* source;            /// the photo database from which the catalog has been extracted
+	char* catalog_path;             /// the file in which the catalog is cached, or NULL if it isn't cached
+	bool has_key;                   /// whether the state of the database the catalog has been extracted from is known
+	catalog_key_t key;              /// the state of the database the catalog has been extracted from
+	bool lazy_albums;               /// whether the photos of the albums are queried only when they're first needed
+
 	GHashTable* albums;             /// lookup table of all albums retrieved from database <album-name, album details> [char*, album_h]
+	GHashTable* photos;             /// lookup table of all photos, shared by the albums <asset-pk, photo details> [int64_t*, photo_h], empty if the albums are lazy or loaded from the cache
+
+	GHashTable* album_states;       /// the states of the extracted albums <album-pk, state> [int64_t*, db_album_state_t*], NULL if unknown
+	int64_t last_asset_pk;          /// the highest primary key of the extracted assets
+	double last_modified;           /// the latest modification date of the extracted assets (in Core Data time)
 
 	gint ref_count;                 /// reference counter for db_h
 } db_t;
 
-static bool verify_database_sanity(db_h handle)
+static bool verify_database_sanity(db_source_t* handle)
 {
 	/*
 	 *  The name of the ASSETS table seems to change between the devices (Z_?ASSETS, where ? is an
@@ -47,7 +103,7 @@ static bool verify_database_sanity(db_h handle)
 
 	int table_query_callback(void* user_data, int col_count, char** record, char** col_names)
 	{
-		db_h handle = (db_h) user_data;
+		db_source_t* handle = (db_source_t*) user_data;
 
 		if (col_count != 1)
 		{
@@ -84,7 +140,7 @@ static bool verify_database_sanity(db_h handle)
 
 	int column_query_callback(void* user_data, int col_count, char** record, char** col_names)
 	{
-		db_h handle = (db_h) user_data;
+		db_source_t* handle = (db_source_t*) user_data;
 
 		if (col_count < 2)
 		{
@@ -121,196 +177,1966 @@ static bool verify_database_sanity(db_h handle)
 	return handle->assets_album_fk != NULL && handle->assets_photo_fk != NULL;
 }
 
-static int db_extract_photos_query_callback(void* user_data, int col_count, char** record, char** col_names)
+static int table_has_column_callback(void* user_data, int col_count, char** record, char** col_names)
+{
+	const char** column = (const char**) user_data;
+
+	if (col_count >= 2 && record[1] != NULL && STREQ(record[1], *column))
+	{
+		// found it, mark by clearing the searched name and stop the query
+		*column = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+static bool table_has_column(db_source_t* handle, const char* table, const char* column)
+{
+	char* query = NULL;
+	asprintf(&query, "pragma table_info('%s')", table);
+	ASSERT_RET(query != NULL, false);
+
+	const char* searched = column;
+	sqlite3_exec(handle->db, query, table_has_column_callback, &searched, NULL);
+	free(query);
+
+	return searched == NULL;
+}
+
+/*
+ * The photo database also holds the basic attributes of the files (sizes, creation and modification
+ * dates), so there is no need to ask the device about them. The layout of these columns changed
+ * between iOS versions though, hence we check which of them are available and substitute NULLs for
+ * the missing ones (in which case the attributes are retrieved from the file itself, see photo_get_stat()).
+ */
+static void discover_photo_attributes(db_source_t* handle)
+{
+	handle->created_column = table_has_column(handle, PHOTO_TABLE_NAME, "ZDATECREATED") ?
+			PHOTO_TABLE_NAME ".ZDATECREATED" : "NULL";
+
+	handle->modified_column = table_has_column(handle, PHOTO_TABLE_NAME, "ZMODIFICATIONDATE") ?
+			PHOTO_TABLE_NAME ".ZMODIFICATIONDATE" : "NULL";
+
+	handle->size_column = (table_has_column(handle, ATTRIBUTES_TABLE_NAME, "ZASSET") &&
+			table_has_column(handle, ATTRIBUTES_TABLE_NAME, "ZORIGINALFILESIZE")) ?
+			ATTRIBUTES_TABLE_NAME ".ZORIGINALFILESIZE" : "NULL";
+
+	LOG_DEBUG("Photo attribute columns for device %s: created %s, modified %s, size %s", handle->device_name,
+			handle->created_column, handle->modified_column, handle->size_column);
+}
+
+// the columns of the photo query (see db_extract_photos())
+enum
+{
+	PHOTO_COLUMN_FILE_NAME,
+	PHOTO_COLUMN_DIRECTORY,
+	PHOTO_COLUMN_ALBUM_TITLE,
+	PHOTO_COLUMN_ASSET_PK,
+	PHOTO_COLUMN_ALBUM_PK,
+	PHOTO_COLUMN_CREATED,
+	PHOTO_COLUMN_MODIFIED,
+	PHOTO_COLUMN_SIZE,
+	PHOTO_COLUMN_COUNT
+};
+
+// fills the attributes of a photo with the values known from the catalog
+static void db_make_photo_stat(off_t size, time_t mtime, time_t ctime, struct stat* stbuf)
 {
-	db_h handle = (db_h) user_data;
-	ASSERT_RET(handle != NULL, -1);
+	memset(stbuf, 0, sizeof(struct stat));
+
+	stbuf->st_size = size;
+	stbuf->st_mtime = mtime;
+	stbuf->st_ctime = ctime;
+	stbuf->st_atime = stbuf->st_mtime;
+	stbuf->st_nlink = 1;
+	stbuf->st_uid = getuid();
+	stbuf->st_gid = getgid();
+	stbuf->st_blksize = 4096;
+	stbuf->st_blocks = (stbuf->st_size + 511) / 512;
+}
 
-	if (col_count != 3)
+/**
+ * Fill the attributes of a photo with the values retrieved from the photo database
+ * @return true if the attributes have been filled, false if some of the required values are missing
+ */
+static bool db_fill_photo_stat(sqlite3_stmt* statement, struct stat* stbuf)
+{
+	if (sqlite3_column_type(statement, PHOTO_COLUMN_MODIFIED) == SQLITE_NULL ||
+			sqlite3_column_type(statement, PHOTO_COLUMN_SIZE) == SQLITE_NULL)
 	{
-		LOG_ERROR("The query should return exactly three columns");
-		return -1;
+		return false;
 	}
 
-	const char* file_name = record[0];
-	const char* location = record[1];
-	const char* album_name = record[2];
+	time_t mtime = (time_t) sqlite3_column_double(statement, PHOTO_COLUMN_MODIFIED) + CORE_DATA_EPOCH_OFFSET;
+	time_t ctime = (sqlite3_column_type(statement, PHOTO_COLUMN_CREATED) != SQLITE_NULL) ?
+			(time_t) sqlite3_column_double(statement, PHOTO_COLUMN_CREATED) + CORE_DATA_EPOCH_OFFSET : mtime;
+
+	db_make_photo_stat(sqlite3_column_int64(statement, PHOTO_COLUMN_SIZE), mtime, ctime, stbuf);
+	return true;
+}
+
+/**
+ * Get the album of a row of the photo query, creating it when it's seen for the first time
+ * @param albums the albums already seen by the query <album-pk, album details> [int64_t*, album_h], borrowed
+ */
+static album_h db_extract_album(db_h handle, sqlite3_stmt* statement, GHashTable* albums)
+{
+	int64_t album_pk = sqlite3_column_int64(statement, PHOTO_COLUMN_ALBUM_PK);
 
-	ASSERT_RET(file_name != NULL, -1);
-	ASSERT_RET(location != NULL, -1);
-	ASSERT_RET(album_name != NULL, -1);
+	album_h album = (album_h) g_hash_table_lookup(albums, &album_pk);
+	if (album != NULL)
+	{
+		return album;
+	}
 
-	char* absolute_location = NULL;
-	asprintf(&absolute_location, "%s%s/%s", handle->root_path, location, file_name)
-	ASSERT_RET(absolute_location != NULL, -1);
+	const char* album_name = (const char*) sqlite3_column_text(statement, PHOTO_COLUMN_ALBUM_TITLE);
+	if (album_name == NULL)
+	{
+		return NULL;
+	}
 
-	album_h album = g_hash_table_lookup(handle->albums, album_name);
+	// the albums sharing a title are presented as a single directory
+	album = (album_h) g_hash_table_lookup(handle->albums, album_name);
 	if (album == NULL)
 	{
-		album = album_create(album_name);
+		album = album_create(album_name, inode_for_album(handle->source->inode, album_pk));
+		ASSERT_RET(album != NULL, NULL);
+
 		g_hash_table_insert(handle->albums, strdup(album_name), album);
 	}
 
-	album_add_photo(album, photo_create(file_name, absolute_location));
+	int64_t* key = (int64_t*) malloc(sizeof(int64_t));
+	ASSERT_RET(key != NULL, NULL);
+	*key = album_pk;
 
-	free(absolute_location);
-	return 0;
+	g_hash_table_insert(albums, key, album);
+	return album;
 }
 
-static bool db_extract_photos(db_h handle)
+/**
+ * Create a photo from a row of the photo query
+ * @param location the buffer for the absolute location of the photo, holding the root path of the device
+ * @return the photo or NULL if the row is malformed
+ */
+static photo_h db_create_photo(db_source_t* source, sqlite3_stmt* statement, GString* location)
 {
-	ASSERT_RET(handle != NULL, false);
+	const char* file_name = (const char*) sqlite3_column_text(statement, PHOTO_COLUMN_FILE_NAME);
+	const char* directory = (const char*) sqlite3_column_text(statement, PHOTO_COLUMN_DIRECTORY);
 
+	if (file_name == NULL || directory == NULL || sqlite3_column_type(statement, PHOTO_COLUMN_ASSET_PK) == SQLITE_NULL)
+	{
+		return NULL;
+	}
+
+	// only the part following the root path is rewritten for each photo
+	g_string_truncate(location, strlen(source->root_path));
+	g_string_append(location, directory);
+	g_string_append_c(location, '/');
+	g_string_append(location, file_name);
+
+	int64_t asset_pk = sqlite3_column_int64(statement, PHOTO_COLUMN_ASSET_PK);
+
+	photo_h photo = photo_create(file_name, location->str, inode_for_photo(source->inode, asset_pk));
+	ASSERT_RET(photo != NULL, NULL);
+
+	struct stat stbuf;
+	if (db_fill_photo_stat(statement, &stbuf))
+	{
+		photo_set_stat(photo, &stbuf);
+	}
+
+	return photo;
+}
+
+/**
+ * Add a row of the photo query to the catalog
+ * @param location the buffer for the absolute location of the photo, holding the root path of the device
+ * @return false if the row is malformed, in which case it's skipped
+ */
+static bool db_extract_photo(db_h handle, sqlite3_stmt* statement, GHashTable* albums, GString* location)
+{
+	if (sqlite3_column_type(statement, PHOTO_COLUMN_FILE_NAME) == SQLITE_NULL ||
+			sqlite3_column_type(statement, PHOTO_COLUMN_DIRECTORY) == SQLITE_NULL ||
+			sqlite3_column_type(statement, PHOTO_COLUMN_ASSET_PK) == SQLITE_NULL ||
+			sqlite3_column_type(statement, PHOTO_COLUMN_ALBUM_PK) == SQLITE_NULL)
+	{
+		return false;
+	}
+
+	album_h album = db_extract_album(handle, statement, albums);
+	if (album == NULL)
+	{
+		return false;
+	}
+
+	// an asset belonging to multiple albums is a single photo, linked from each of them
+	int64_t asset_pk = sqlite3_column_int64(statement, PHOTO_COLUMN_ASSET_PK);
+
+	photo_h photo = g_hash_table_lookup(handle->photos, &asset_pk);
+	if (photo == NULL)
+	{
+		photo = db_create_photo(handle->source, statement, location);
+		ASSERT_RET(photo != NULL, false);
+
+		int64_t* key = (int64_t*) malloc(sizeof(int64_t));
+		ASSERT_RET(key != NULL, false);
+		*key = asset_pk;
+
+		g_hash_table_insert(handle->photos, key, photo);
+	}
+
+	photo_add_album(photo);
+	album_add_photo(album, photo_ref(photo));
+
+	// the assets added or modified later than these are queried by db_refresh()
+	handle->last_asset_pk = MAX(handle->last_asset_pk, asset_pk);
+
+	if (sqlite3_column_type(statement, PHOTO_COLUMN_MODIFIED) != SQLITE_NULL)
+	{
+		handle->last_modified = MAX(handle->last_modified, sqlite3_column_double(statement, PHOTO_COLUMN_MODIFIED));
+	}
+
+	return true;
+}
+
+// prepares a query built by db_prepare_photo_query() or db_prepare_summary_query(), returns NULL on error
+static sqlite3_stmt* db_prepare_query(db_source_t* handle, char* query, int column_count)
+{
+	ASSERT_RET(query != NULL, NULL);
+
+	LOG_DEBUG("Query of device %s: %s", handle->device_name, query);
+
+	sqlite3_stmt* statement = NULL;
+	int rc = sqlite3_prepare_v2(handle->db, query, -1, &statement, NULL);
+	free(query);
+
+	if (rc != SQLITE_OK)
+	{
+		LOG_ERROR("Unable to prepare a query of device %s (%s)", handle->device_name, sqlite3_errmsg(handle->db));
+		return NULL;
+	}
+
+	if (sqlite3_column_count(statement) != column_count)
+	{
+		LOG_ERROR("The query should return exactly %d columns", column_count);
+		sqlite3_finalize(statement);
+		return NULL;
+	}
+
+	return statement;
+}
+
+/**
+ * Prepare the query of the photos of the user-created albums
+ * @param condition an additional condition of the where clause (starting with "and"), or an empty string
+ * @return the prepared statement or NULL on error
+ */
+static sqlite3_stmt* db_prepare_photo_query(db_source_t* handle, const char* condition)
+{
 	/*
 	 * In here we extract all photos assigned to each user-created album. We know an album
 	 * has been created by the user if it has ZKIND = 2 (magic numbers, yay!)
 	 */
 
+	// the file sizes are stored in a separate table, join it only if it's there
+	char* attributes_join = NULL;
+	if (STREQ(handle->size_column, "NULL"))
+	{
+		attributes_join = strdup("");
+	}
+	else
+	{
+		asprintf(&attributes_join, "left join %s on %s.ZASSET = %s.Z_PK",
+			ATTRIBUTES_TABLE_NAME, ATTRIBUTES_TABLE_NAME, PHOTO_TABLE_NAME);
+	}
+
 	char* query = NULL;
-	asprintf(&query, "select %s.ZFILENAME, %s.ZDIRECTORY, %s.ZTITLE "
+	asprintf(&query, "select %s.ZFILENAME, %s.ZDIRECTORY, %s.ZTITLE, %s.Z_PK, %s.Z_PK, %s, %s, %s "
 		"from %s "
 		"inner join %s on %s.Z_PK = %s.%s "
 		"inner join %s on %s.%s = %s.Z_PK "
-		"where %s.ZKIND = 2;",
-		PHOTO_TABLE_NAME, PHOTO_TABLE_NAME, ALBUM_TABLE_NAME,
+		"%s "
+		"where %s.ZKIND = 2 %s;",
+		PHOTO_TABLE_NAME, PHOTO_TABLE_NAME, ALBUM_TABLE_NAME, PHOTO_TABLE_NAME, ALBUM_TABLE_NAME,
+		handle->created_column, handle->modified_column, handle->size_column,
 		PHOTO_TABLE_NAME,
 		handle->assets_table_name, PHOTO_TABLE_NAME, handle->assets_table_name, handle->assets_photo_fk,
 		ALBUM_TABLE_NAME, handle->assets_table_name, handle->assets_album_fk, ALBUM_TABLE_NAME,
-		ALBUM_TABLE_NAME);
+		attributes_join,
+		ALBUM_TABLE_NAME, condition);
+	free(attributes_join);
 
-	LOG_DEBUG("Photo query: %s", query);
+	return db_prepare_query(handle, query, PHOTO_COLUMN_COUNT);
+}
 
-	sqlite3_exec(handle->db, query, db_extract_photos_query_callback, handle, NULL);
-	free(query);
+// adds all the rows of a prepared photo query to the catalog
+static bool db_extract_photos(db_h handle, sqlite3_stmt* statement)
+{
+	// the albums are looked up by their primary keys rather than titles, only while extracting
+	GHashTable* albums = g_hash_table_new_full(g_int64_hash, g_int64_equal, free, NULL);
+	GString* location = g_string_new(handle->source->root_path);
 
-	return true;
+	unsigned int skipped = 0;
+	int rc;
+
+	while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		if (!db_extract_photo(handle, statement, albums, location))
+		{
+			skipped++;
+		}
+	}
+
+	if (skipped > 0)
+	{
+		LOG_WARN("Skipped %u malformed photo records of device %s", skipped, handle->source->device_name);
+	}
+
+	if (rc != SQLITE_DONE)
+	{
+		LOG_ERROR("Unable to extract the photos of device %s (%s)", handle->source->device_name, sqlite3_errmsg(handle->source->db));
+	}
+
+	g_string_free(location, TRUE);
+	g_hash_table_unref(albums);
+
+	return rc == SQLITE_DONE;
 }
 
-db_h db_create(const char* db_location, const char* device_name, const char* root_path)
+static void db_album_state_free(db_album_state_t* state)
 {
-	ASSERT_RET(db_location != NULL, NULL);
-	ASSERT_RET(device_name != NULL, NULL);
-	ASSERT_RET(root_path != NULL, NULL);
+	if (state)
+	{
+		free(state->title);
+		free(state);
+	}
+}
 
-	db_h handle = calloc(1, sizeof(struct db_s));
+/**
+ * Retrieve the states of all user-created albums
+ * @return the states <album-pk, state> [int64_t*, db_album_state_t*] or NULL on error, e.g. if the
+ * album table has no Z_OPT column, in which case the catalog can only be refreshed as a whole
+ */
+static GHashTable* db_read_album_states(db_source_t* handle)
+{
+	static const char* query = "select Z_PK, ZTITLE, Z_OPT from " ALBUM_TABLE_NAME " where ZKIND = 2;";
 
-	if (handle)
+	sqlite3_stmt* statement = NULL;
+	if (sqlite3_prepare_v2(handle->db, query, -1, &statement, NULL) != SQLITE_OK)
 	{
-		LOG_DEBUG("DB path for device %s: %s", device_name, db_location);
-		handle->ref_count = 1;
-		handle->device_name = strdup(device_name);
-		handle->root_path = strdup(root_path);
-		handle->albums = g_hash_table_new_full(g_str_hash, g_str_equal, free, (GDestroyNotify) album_unref);
+		LOG_WARN("Unable to query the album states of device %s (%s), it will be refreshed as a whole",
+				handle->device_name, sqlite3_errmsg(handle->db));
+		return NULL;
+	}
 
-		if (access(db_location, F_OK) == -1)
-		{
-			LOG_ERROR("Unable to open database %s (improper path)", db_location);
-			db_unref(handle);
-			return NULL;
-		}
+	GHashTable* states = g_hash_table_new_full(g_int64_hash, g_int64_equal, free, (GDestroyNotify) db_album_state_free);
+	int rc;
 
-		int rc = sqlite3_open_v2(db_location, &handle->db, SQLITE_OPEN_READONLY, NULL);
+	while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		int64_t* key = (int64_t*) malloc(sizeof(int64_t));
+		db_album_state_t* state = (db_album_state_t*) calloc(1, sizeof(db_album_state_t));
 
-		if (rc != SQLITE_OK)
+		if (key == NULL || state == NULL)
 		{
-			LOG_ERROR("Unable to open database of device %s (%s)", device_name, sqlite3_errmsg(handle->db));
-			db_unref(handle);
-			return NULL;
+			free(key);
+			free(state);
+			rc = SQLITE_NOMEM;
+			break;
 		}
 
-		if (!verify_database_sanity(handle))
-		{
-			LOG_ERROR("Malformed photo database of device %s", device_name);
-			db_unref(handle);
-			return NULL;
-		}
+		const char* title = (const char*) sqlite3_column_text(statement, 1);
+
+		*key = sqlite3_column_int64(statement, 0);
+		state->opt = sqlite3_column_int64(statement, 2);
+		state->title = (title != NULL) ? strdup(title) : NULL;
+
+		g_hash_table_insert(states, key, state);
 	}
 
-	if (!db_extract_photos(handle))
+	sqlite3_finalize(statement);
+
+	if (rc != SQLITE_DONE)
 	{
-		LOG_ERROR("Unable to perform an initial photo extraction of device %s", device_name);
-		db_unref(handle);
+		LOG_WARN("Unable to query the album states of device %s (%s)", handle->device_name, sqlite3_errmsg(handle->db));
+		g_hash_table_unref(states);
 		return NULL;
 	}
 
-	return handle;
+	return states;
 }
 
-const char* db_get_device_name(const db_h handle)
+// opens the connection to the database, or to its local snapshot if it's requested and can be made
+static bool db_open(db_source_t* handle)
 {
-	ASSERT_RET(handle, NULL);
-	return handle->device_name;
-}
+	if (handle->use_snapshot)
+	{
+		handle->snapshot = db_snapshot_create(handle->db_location);
+		if (handle->snapshot == NULL)
+		{
+			LOG_WARN("Unable to make a snapshot of the database of device %s, querying it in place", handle->device_name);
+		}
+	}
 
-const char* db_get_root_path(const db_h handle)
-{
-	ASSERT_RET(handle, NULL);
-	return handle->root_path;
-}
+	if (handle->snapshot == NULL)
+	{
+		return sqlite3_open_v2(handle->db_location, &handle->db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK;
+	}
 
-bool db_for_each_album(const db_h handle, db_for_each_album_cb callback, void* user_data)
-{
-	ASSERT_RET(handle != NULL, false);
-	ASSERT_RET(callback != NULL, false);
+	if (sqlite3_open_v2(db_snapshot_get_uri(handle->snapshot), &handle->db, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, NULL) != SQLITE_OK)
+	{
+		return false;
+	}
 
-	GHashTableIter it;
-	gpointer value;
+	// the snapshot is local and never changes, so it's mapped into memory as a whole
+	char* pragma = NULL;
+	asprintf(&pragma, "pragma mmap_size=%" PRIu64, db_snapshot_get_size(handle->snapshot));
 
-	g_hash_table_iter_init(&it, handle->albums);
-	while (g_hash_table_iter_next(&it, NULL, &value))
+	if (pragma != NULL)
 	{
-		if (!callback(handle, (album_h) value, user_data))
-		{
-			break;
-		}
+		sqlite3_exec(handle->db, pragma, NULL, NULL, NULL);
+		free(pragma);
 	}
 
 	return true;
 }
 
-album_h db_get_album_by_name(const db_h handle, const char* album_name)
+// closes the connection to the database, along with the schema discovered through it
+static void db_source_close(db_source_t* handle)
 {
-	ASSERT_RET(handle, NULL);
-	ASSERT_RET(album_name, NULL);
+	if (handle->db != NULL)
+	{
+		sqlite3_close(handle->db);
+		handle->db = NULL;
+	}
 
-	album_h album = (album_h) g_hash_table_lookup(handle->albums, album_name);
+	db_snapshot_free(handle->snapshot);
+	handle->snapshot = NULL;
 
-	if (album == NULL)
+	free(handle->assets_table_name);
+	free(handle->assets_album_fk);
+	free(handle->assets_photo_fk);
+
+	handle->assets_table_name = NULL;
+	handle->assets_album_fk = NULL;
+	handle->assets_photo_fk = NULL;
+}
+
+/**
+ * Open the connection to the database, unless it's already open
+ * @return true on success, false on error (in which case it's opened again on the next call)
+ * @note this function must be called with the lock of the source held
+ */
+static bool db_source_connect(db_source_t* handle)
+{
+	if (handle->db != NULL)
 	{
-		return NULL;
+		return true;
 	}
 
-	return album_ref(album);
+	if (!db_open(handle))
+	{
+		LOG_ERROR("Unable to open database of device %s (%s)", handle->device_name, sqlite3_errmsg(handle->db));
+		db_source_close(handle);
+		return false;
+	}
+
+	if (!verify_database_sanity(handle))
+	{
+		LOG_ERROR("Malformed photo database of device %s", handle->device_name);
+		db_source_close(handle);
+		return false;
+	}
+
+	discover_photo_attributes(handle);
+	return true;
 }
 
-db_h db_ref(db_h handle)
+static db_source_t* db_source_create(const char* db_location, uint64_t inode, const char* device_name,
+		const char* root_path, bool snapshot)
 {
-	ASSERT_RET(handle, NULL);
-	ASSERT_RET(handle->ref_count > 0, handle);
+	db_source_t* handle = (db_source_t*) calloc(1, sizeof(db_source_t));
+	ASSERT_RET(handle != NULL, NULL);
+
+	g_mutex_init(&handle->lock);
+	handle->ref_count = 1;
+	handle->db_location = strdup(db_location);
+	handle->use_snapshot = snapshot;
+	handle->device_name = strdup(device_name);
+	handle->root_path = strdup(root_path);
+	handle->inode = inode;
+	handle->photos = g_hash_table_new_full(g_int64_hash, g_int64_equal, free, (GDestroyNotify) photo_unref);
 
-	g_atomic_int_inc(&handle->ref_count);
 	return handle;
 }
 
-void db_unref(db_h handle)
+static db_source_t* db_source_ref(db_source_t* handle)
 {
-	ASSERT_RET(handle);
-	ASSERT_RET(handle->ref_count > 0);
+	g_atomic_int_inc(&handle->ref_count);
+	return handle;
+}
 
-	if (g_atomic_int_dec_and_test(&handle->ref_count))
+static void db_source_unref(db_source_t* handle)
+{
+	if (handle && g_atomic_int_dec_and_test(&handle->ref_count))
 	{
-		LOG_INFO("Freeing database...");
-		if (handle->db)
-		{
-			sqlite3_close(handle->db);
-		}
+		db_source_close(handle);
+		g_hash_table_unref(handle->photos);
+		g_mutex_clear(&handle->lock);
 
-		g_hash_table_unref(handle->albums);
+		free(handle->db_location);
 		free(handle->device_name);
 		free(handle->root_path);
-		free(handle->assets_table_name);
-		free(handle->assets_album_fk);
-		free(handle->assets_photo_fk);
+		free(handle);
+	}
+}
+
+// the columns of the album summary query (see db_prepare_summary_query())
+enum
+{
+	SUMMARY_COLUMN_ALBUM_PK,
+	SUMMARY_COLUMN_ALBUM_TITLE,
+	SUMMARY_COLUMN_PHOTO_COUNT,
+	SUMMARY_COLUMN_COUNT
+};
+
+/**
+ * Prepare the query of the numbers of photos of the user-created albums, which is all that's known
+ * about the lazily loaded albums until their photos are needed (see db_load_album())
+ * @param condition an additional condition of the where clause (starting with "and"), or an empty string
+ * @return the prepared statement or NULL on error
+ */
+static sqlite3_stmt* db_prepare_summary_query(db_source_t* handle, const char* condition)
+{
+	// joined the same way as the photo query, so that the numbers match the photos loaded later on
+	char* query = NULL;
+	asprintf(&query, "select %s.Z_PK, %s.ZTITLE, count(*) "
+		"from %s "
+		"inner join %s on %s.Z_PK = %s.%s "
+		"inner join %s on %s.%s = %s.Z_PK "
+		"where %s.ZKIND = 2 and %s.ZFILENAME is not null and %s.ZDIRECTORY is not null %s "
+		"group by %s.Z_PK order by %s.Z_PK;",
+		ALBUM_TABLE_NAME, ALBUM_TABLE_NAME,
+		PHOTO_TABLE_NAME,
+		handle->assets_table_name, PHOTO_TABLE_NAME, handle->assets_table_name, handle->assets_photo_fk,
+		ALBUM_TABLE_NAME, handle->assets_table_name, handle->assets_album_fk, ALBUM_TABLE_NAME,
+		ALBUM_TABLE_NAME, PHOTO_TABLE_NAME, PHOTO_TABLE_NAME, condition,
+		ALBUM_TABLE_NAME, ALBUM_TABLE_NAME);
+
+	return db_prepare_query(handle, query, SUMMARY_COLUMN_COUNT);
+}
+
+/**
+ * Retrieve the highest primary key and the latest modification date of all the assets, which are
+ * otherwise learnt from the extracted photos (see db_extract_photo()), so that db_refresh() can find
+ * the assets added or modified later on even if the photos of the albums haven't been loaded
+ * @return true on success, false on error
+ */
+static bool db_read_watermarks(db_h handle)
+{
+	db_source_t* source = handle->source;
+
+	char* query = NULL;
+	asprintf(&query, "select max(Z_PK), max(%s) from %s;", source->modified_column, PHOTO_TABLE_NAME);
+	ASSERT_RET(query != NULL, false);
+
+	sqlite3_stmt* statement = NULL;
+	int rc = sqlite3_prepare_v2(source->db, query, -1, &statement, NULL);
+	free(query);
+
+	if (rc == SQLITE_OK && (rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		handle->last_asset_pk = sqlite3_column_int64(statement, 0);
+		handle->last_modified = sqlite3_column_double(statement, 1);
+	}
+	else
+	{
+		LOG_ERROR("Unable to query the latest assets of device %s (%s)", source->device_name, sqlite3_errmsg(source->db));
+	}
+
+	sqlite3_finalize(statement);
+	return rc == SQLITE_ROW;
+}
+
+/**
+ * The user data of a lazily loaded album (see db_load_album())
+ */
+typedef struct db_lazy_album_s
+{
+	db_source_t* source;            /// the photo database from which the photos are queried
+	GPtrArray* photos;              /// the photos added to the album by the loader [photo_h], borrowed from the album
+} db_lazy_album_t;
+
+/**
+ * Record that the photos added by the loader of a lazy album no longer belong to it, and drop the ones
+ * left without any album from the photo table of the source
+ * @note this function must be called with the lock of the source held
+ */
+static void db_lazy_album_release_photos(db_lazy_album_t* handle)
+{
+	for (guint i = 0; i < handle->photos->len; i++)
+	{
+		photo_h photo = (photo_h) g_ptr_array_index(handle->photos, i);
+		int64_t asset_pk = inode_get_pk(photo_get_inode(photo));
+
+		// the table might already hold a new photo of the asset, if it has been modified
+		if (photo_remove_album(photo) && g_hash_table_lookup(handle->source->photos, &asset_pk) == photo)
+		{
+			g_hash_table_remove(handle->source->photos, &asset_pk);
+		}
+	}
+
+	g_ptr_array_set_size(handle->photos, 0);
+}
+
+// invoked along with the last reference to the album, i.e. once it has been evicted or replaced and is no longer read
+static void db_lazy_album_release(db_lazy_album_t* handle)
+{
+	g_mutex_lock(&handle->source->lock);
+	db_lazy_album_release_photos(handle);
+	g_mutex_unlock(&handle->source->lock);
+
+	g_ptr_array_free(handle->photos, TRUE);
+	db_source_unref(handle->source);
+	free(handle);
+}
+
+/**
+ * Query the photos of a lazily loaded album (see album_load_cb), i.e. of all the albums sharing its title.
+ * An asset belonging to multiple loaded albums is a single photo, found in the photo table of the source.
+ */
+static bool db_load_album(album_h album, void* user_data)
+{
+	db_lazy_album_t* lazy = (db_lazy_album_t*) user_data;
+	db_source_t* source = lazy->source;
+	int rc = SQLITE_ERROR;
+
+	g_mutex_lock(&source->lock);
+
+	sqlite3_stmt* statement = db_source_connect(source) ? db_prepare_photo_query(source, ALBUM_TITLE_CONDITION) : NULL;
+	if (statement != NULL)
+	{
+		GString* location = g_string_new(source->root_path);
+		GHashTable* names = g_hash_table_new(g_str_hash, g_str_equal);
+		sqlite3_bind_text(statement, 1, album_get_name(album), -1, SQLITE_STATIC);
+
+		while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+		{
+			if (sqlite3_column_type(statement, PHOTO_COLUMN_ASSET_PK) == SQLITE_NULL)
+			{
+				continue;
+			}
+
+			int64_t asset_pk = sqlite3_column_int64(statement, PHOTO_COLUMN_ASSET_PK);
+
+			photo_h photo = (photo_h) g_hash_table_lookup(source->photos, &asset_pk);
+			if (photo == NULL && (photo = db_create_photo(source, statement, location)) != NULL)
+			{
+				int64_t* key = (int64_t*) malloc(sizeof(int64_t));
+				if (key == NULL)
+				{
+					photo_unref(photo);
+					rc = SQLITE_NOMEM;
+					break;
+				}
+
+				*key = asset_pk;
+				g_hash_table_insert(source->photos, key, photo);
+			}
+
+			if (photo != NULL)
+			{
+				// a photo replaced by another one with the same name is released by album_add_photo()
+				photo_h previous = (photo_h) g_hash_table_lookup(names, photo_get_file_name(photo));
+
+				photo_add_album(photo);
+				album_add_photo(album, photo_ref(photo));
+				g_ptr_array_add(lazy->photos, photo);
+				g_hash_table_replace(names, (gpointer) photo_get_file_name(photo), photo);
+
+				if (previous != NULL)
+				{
+					g_ptr_array_remove_fast(lazy->photos, previous);
+
+					int64_t previous_pk = inode_get_pk(photo_get_inode(previous));
+					if (photo_get_album_count(previous) == 0 && g_hash_table_lookup(source->photos, &previous_pk) == previous)
+					{
+						g_hash_table_remove(source->photos, &previous_pk);
+					}
+				}
+			}
+		}
+
+		if (rc != SQLITE_DONE)
+		{
+			LOG_ERROR("Unable to load the photos of album %s of device %s (%s)", album_get_name(album),
+					source->device_name, sqlite3_errmsg(source->db));
+
+			// the album drops the photos added so far, so they no longer belong to it
+			db_lazy_album_release_photos(lazy);
+		}
+
+		g_hash_table_unref(names);
+		g_string_free(location, TRUE);
+		sqlite3_finalize(statement);
+	}
+
+	g_mutex_unlock(&source->lock);
+
+	if (rc == SQLITE_DONE)
+	{
+		LOG_DEBUG("Loaded %u photos of album %s of device %s", lazy->photos->len, album_get_name(album), source->device_name);
+	}
+
+	return rc == SQLITE_DONE;
+}
+
+// creates an album whose photos are queried only when they're first needed (see db_load_album())
+static album_h db_create_lazy_album(db_h handle, const char* title, uint64_t inode, unsigned int photo_count)
+{
+	db_lazy_album_t* lazy = (db_lazy_album_t*) calloc(1, sizeof(db_lazy_album_t));
+	ASSERT_RET(lazy != NULL, NULL);
+
+	lazy->source = db_source_ref(handle->source);
+	lazy->photos = g_ptr_array_new();
+
+	album_h album = album_create_lazy(title, inode, photo_count, db_load_album, lazy, (album_release_cb) db_lazy_album_release);
+	if (album == NULL)
+	{
+		// nothing has been loaded yet, and the lock of the source may be held (see db_summarize_albums())
+		g_ptr_array_free(lazy->photos, TRUE);
+		db_source_unref(lazy->source);
+		free(lazy);
+	}
+
+	return album;
+}
+
+typedef struct
+{
+	uint64_t inode;             /// the inode of the album
+	unsigned int photo_count;   /// the number of photos of all the albums sharing the title
+} db_album_summary_t;
+
+/**
+ * Replace the albums reported by a prepared summary query by lazily loaded ones. The albums sharing a
+ * title are merged, the same as when the photos are extracted (see db_extract_album()), and an album
+ * which already exists keeps its inode (see db_rebuild_album()).
+ * @return true on success, false on error
+ */
+static bool db_summarize_albums(db_h handle, sqlite3_stmt* statement)
+{
+	GHashTable* summaries = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+	int rc;
+
+	while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		const char* title = (const char*) sqlite3_column_text(statement, SUMMARY_COLUMN_ALBUM_TITLE);
+		if (title == NULL)
+		{
+			continue;
+		}
+
+		db_album_summary_t* summary = (db_album_summary_t*) g_hash_table_lookup(summaries, title);
+		if (summary == NULL)
+		{
+			summary = (db_album_summary_t*) calloc(1, sizeof(db_album_summary_t));
+			if (summary == NULL)
+			{
+				rc = SQLITE_NOMEM;
+				break;
+			}
+
+			// the rows are ordered by the primary keys, so a new album is named after the first one
+			album_h previous = (album_h) g_hash_table_lookup(handle->albums, title);
+			summary->inode = (previous != NULL) ? album_get_inode(previous) :
+					inode_for_album(handle->source->inode, sqlite3_column_int64(statement, SUMMARY_COLUMN_ALBUM_PK));
+
+			g_hash_table_insert(summaries, strdup(title), summary);
+		}
+
+		summary->photo_count += sqlite3_column_int(statement, SUMMARY_COLUMN_PHOTO_COUNT);
+	}
+
+	if (rc != SQLITE_DONE)
+	{
+		LOG_ERROR("Unable to summarize the albums of device %s (%s)", handle->source->device_name,
+				sqlite3_errmsg(handle->source->db));
+	}
+
+	GHashTableIter it;
+	gpointer title, value;
+
+	g_hash_table_iter_init(&it, summaries);
+	while (rc == SQLITE_DONE && g_hash_table_iter_next(&it, &title, &value))
+	{
+		db_album_summary_t* summary = (db_album_summary_t*) value;
+
+		album_h album = db_create_lazy_album(handle, (const char*) title, summary->inode, summary->photo_count);
+		if (album != NULL)
+		{
+			g_hash_table_replace(handle->albums, strdup((const char*) title), album);
+		}
+	}
+
+	g_hash_table_unref(summaries);
+	return rc == SQLITE_DONE;
+}
+
+// extracts the whole catalog (only the summaries of the albums, if they're lazy), along with the states needed to refresh it later on
+static bool db_extract_catalog(db_h handle)
+{
+	db_source_t* source = handle->source;
+
+	sqlite3_stmt* statement = handle->lazy_albums ?
+			db_prepare_summary_query(source, "") : db_prepare_photo_query(source, "");
+
+	if (statement == NULL)
+	{
+		return false;
+	}
+
+	// a single read transaction, so that the states match the photos even if the database is being modified
+	sqlite3_exec(source->db, "begin", NULL, NULL, NULL);
+
+	handle->album_states = db_read_album_states(source);
+	bool extracted = handle->lazy_albums ?
+			db_read_watermarks(handle) && db_summarize_albums(handle, statement) : db_extract_photos(handle, statement);
+
+	sqlite3_exec(source->db, "commit", NULL, NULL, NULL);
+	sqlite3_finalize(statement);
+
+	return extracted;
+}
+
+/**
+ * A catalog mapped from the cache (see catalog_cache.h), shared by the albums created from it. The photos
+ * are created from the mapping only when the first of their albums is loaded (see db_load_cached_album()),
+ * and then shared with the other albums.
+ */
+typedef struct db_cached_catalog_s
+{
+	GMutex lock;                    /// guards photos
+	catalog_reader_h reader;        /// the mapped catalog
+	db_source_t* source;            /// the photo database from which the catalog has been extracted
+	photo_h* photos;                /// the photos created so far, by their indices within the catalog [photo_h], NULL if not yet created
+	gint ref_count;                 /// reference counter, held by the albums
+} db_cached_catalog_t;
+
+static db_cached_catalog_t* db_cached_catalog_ref(db_cached_catalog_t* handle)
+{
+	g_atomic_int_inc(&handle->ref_count);
+	return handle;
+}
+
+static void db_cached_catalog_unref(db_cached_catalog_t* handle)
+{
+	if (handle && g_atomic_int_dec_and_test(&handle->ref_count))
+	{
+		for (uint32_t i = 0; i < catalog_reader_get_photo_count(handle->reader); i++)
+		{
+			if (handle->photos[i] != NULL)
+			{
+				photo_unref(handle->photos[i]);
+			}
+		}
+
+		free(handle->photos);
+		catalog_reader_close(handle->reader);
+		db_source_unref(handle->source);
+		g_mutex_clear(&handle->lock);
+		free(handle);
+	}
+}
+
+// maps the cached catalog, returns NULL if it's not cached (or malformed)
+static db_cached_catalog_t* db_cached_catalog_open(db_source_t* source, const char* path, const catalog_key_t* key)
+{
+	catalog_reader_h reader = catalog_reader_open(path, source->inode, key);
+	if (reader == NULL)
+	{
+		return NULL;
+	}
+
+	db_cached_catalog_t* handle = (db_cached_catalog_t*) calloc(1, sizeof(db_cached_catalog_t));
+	photo_h* photos = (photo_h*) calloc(MAX(1, catalog_reader_get_photo_count(reader)), sizeof(photo_h));
+
+	if (handle == NULL || photos == NULL)
+	{
+		free(handle);
+		free(photos);
+		catalog_reader_close(reader);
+		return NULL;
+	}
+
+	g_mutex_init(&handle->lock);
+	handle->reader = reader;
+	handle->source = db_source_ref(source);
+	handle->photos = photos;
+	handle->ref_count = 1;
+
+	return handle;
+}
+
+/**
+ * Get the photo with the given index within the cached catalog, creating it on its first use
+ * @param location the buffer for the absolute location of the photo, holding the root path of the device
+ * @return the photo (borrowed from the catalog) or NULL on error
+ * @note this function must be called with the lock of the catalog held
+ */
+static photo_h db_cached_catalog_get_photo(db_cached_catalog_t* handle, uint32_t index, GString* location)
+{
+	if (handle->photos[index] != NULL)
+	{
+		return handle->photos[index];
+	}
+
+	catalog_photo_t cached;
+	catalog_reader_get_photo(handle->reader, index, &cached);
+
+	g_string_truncate(location, strlen(handle->source->root_path));
+	g_string_append(location, cached.location);
+
+	photo_h photo = photo_create(cached.file_name, location->str, cached.inode);
+	if (photo == NULL)
+	{
+		return NULL;
+	}
+
+	if (cached.has_stat)
+	{
+		struct stat stbuf;
+		db_make_photo_stat(cached.size, cached.mtime, cached.ctime, &stbuf);
+		photo_set_stat(photo, &stbuf);
+	}
+
+	// the albums which haven't been loaded yet are counted as well, so the number of links is right from the start
+	for (uint32_t i = 0; i < cached.album_count; i++)
+	{
+		photo_add_album(photo);
+	}
+
+	handle->photos[index] = photo;
+	return photo;
+}
+
+// adds the photos of an album of a cached catalog to the album (see album_load_cb)
+static bool db_load_cached_album(album_h album, void* user_data)
+{
+	db_cached_catalog_t* handle = (db_cached_catalog_t*) user_data;
+
+	catalog_album_t cached;
+	if (!catalog_reader_find_album(handle->reader, album_get_name(album), &cached))
+	{
+		LOG_ERROR("Album %s of device %s is missing from the catalog cache", album_get_name(album), handle->source->device_name);
+		return false;
+	}
+
+	GString* location = g_string_new(handle->source->root_path);
+	unsigned int count = 0;
+
+	g_mutex_lock(&handle->lock);
+
+	for (uint32_t i = 0; i < cached.photo_count; i++)
+	{
+		photo_h photo = db_cached_catalog_get_photo(handle, cached.photos[i], location);
+		if (photo != NULL)
+		{
+			album_add_photo(album, photo_ref(photo));
+			count++;
+		}
+	}
+
+	g_mutex_unlock(&handle->lock);
+	g_string_free(location, TRUE);
+
+	LOG_DEBUG("Loaded %u photos of album %s of device %s from the catalog cache", count, album_get_name(album),
+			handle->source->device_name);
+
+	return true;
+}
+
+// creates the albums of the cached catalog, returns false if it's not cached (or malformed)
+static bool db_load_catalog(db_h handle, const char* path, const catalog_key_t* key)
+{
+	db_cached_catalog_t* cache = db_cached_catalog_open(handle->source, path, key);
+	if (cache == NULL)
+	{
+		return false;
+	}
+
+	// only the albums are created upfront, their photos are read from the mapping once they're needed
+	for (uint32_t i = 0; i < catalog_reader_get_album_count(cache->reader); i++)
+	{
+		catalog_album_t cached;
+		catalog_reader_get_album(cache->reader, i, &cached);
+
+		album_h album = album_create_lazy(cached.name, cached.inode, cached.photo_count, db_load_cached_album,
+				db_cached_catalog_ref(cache), (album_release_cb) db_cached_catalog_unref);
+
+		if (album == NULL)
+		{
+			db_cached_catalog_unref(cache);
+			continue;
+		}
+
+		g_hash_table_insert(handle->albums, strdup(cached.name), album);
+	}
+
+	db_cached_catalog_unref(cache);
+	return true;
+}
+
+typedef struct
+{
+	catalog_writer_h writer;
+	GHashTable* indices;        /// the indices of the photos within the written catalog <photo, index + 1> [photo_h, uint32_t]
+	GArray* members;            /// the indices of the photos of the album being written [uint32_t]
+} db_save_catalog_params_t;
+
+static bool db_save_catalog_for_each_photo(const album_h handle, const photo_h photo, void* user_data)
+{
+	db_save_catalog_params_t* params = (db_save_catalog_params_t*) user_data;
+
+	uint32_t index = GPOINTER_TO_UINT(g_hash_table_lookup(params->indices, photo)) - 1;
+	g_array_append_val(params->members, index);
+
+	return true;
+}
+
+// stores the extracted catalog in the cache, so that the next mount doesn't have to query the database
+static void db_save_catalog(db_h handle, const char* path, const catalog_key_t* key)
+{
+	db_save_catalog_params_t params = {
+		.writer = catalog_writer_create(),
+		.indices = g_hash_table_new(g_direct_hash, g_direct_equal),
+		.members = g_array_new(FALSE, FALSE, sizeof(uint32_t))
+	};
+
+	if (params.writer == NULL)
+	{
+		g_hash_table_unref(params.indices);
+		g_array_free(params.members, TRUE);
+		return;
+	}
+
+	GHashTableIter it;
+	gpointer asset_pk, value;
+	size_t root_length = strlen(handle->source->root_path);
+
+	g_hash_table_iter_init(&it, handle->photos);
+	while (g_hash_table_iter_next(&it, &asset_pk, &value))
+	{
+		photo_h photo = (photo_h) value;
+		struct stat stbuf;
+
+		catalog_photo_t cached = {
+			.file_name = photo_get_file_name(photo),
+			.location = photo_get_location(photo) + root_length,
+			.inode = photo_get_inode(photo),
+			.asset_pk = *(int64_t*) asset_pk,
+			.has_stat = photo_get_stat(photo, &stbuf)
+		};
+
+		if (cached.has_stat)
+		{
+			cached.size = stbuf.st_size;
+			cached.mtime = stbuf.st_mtime;
+			cached.ctime = stbuf.st_ctime;
+		}
+
+		uint32_t index = catalog_writer_add_photo(params.writer, &cached);
+		g_hash_table_insert(params.indices, photo, GUINT_TO_POINTER(index + 1));
+	}
+
+	g_hash_table_iter_init(&it, handle->albums);
+	while (g_hash_table_iter_next(&it, NULL, &value))
+	{
+		album_h album = (album_h) value;
+
+		g_array_set_size(params.members, 0);
+		album_for_each_photo(album, db_save_catalog_for_each_photo, &params);
+
+		catalog_album_t cached = {
+			.name = album_get_name(album),
+			.inode = album_get_inode(album),
+			.photos = (const uint32_t*) params.members->data,
+			.photo_count = params.members->len
+		};
+
+		catalog_writer_add_album(params.writer, &cached);
+	}
+
+	if (catalog_writer_save(params.writer, path, handle->source->inode, key))
+	{
+		LOG_DEBUG("Saved the catalog of device %s into %s", handle->source->device_name, path);
+	}
+
+	catalog_writer_free(params.writer);
+	g_hash_table_unref(params.indices);
+	g_array_free(params.members, TRUE);
+}
+
+// allocates an empty catalog of a device
+static db_h db_alloc(db_source_t* source, bool lazy_albums)
+{
+	db_h handle = calloc(1, sizeof(struct db_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->ref_count = 1;
+	handle->source = db_source_ref(source);
+	handle->lazy_albums = lazy_albums;
+	handle->albums = g_hash_table_new_full(g_str_hash, g_str_equal, free, (GDestroyNotify) album_unref);
+	handle->photos = g_hash_table_new_full(g_int64_hash, g_int64_equal, free, (GDestroyNotify) photo_unref);
+
+	return handle;
+}
+
+// allocates a catalog holding the same albums as the passed one, which then may be replaced one by one
+static db_h db_copy(db_h previous)
+{
+	db_h handle = db_alloc(previous->source, previous->lazy_albums);
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->catalog_path = (previous->catalog_path != NULL) ? g_strdup(previous->catalog_path) : NULL;
+	handle->has_key = previous->has_key;
+	handle->key = previous->key;
+	handle->album_states = (previous->album_states != NULL) ? g_hash_table_ref(previous->album_states) : NULL;
+	handle->last_asset_pk = previous->last_asset_pk;
+	handle->last_modified = previous->last_modified;
+
+	GHashTableIter it;
+	gpointer name, album;
+
+	g_hash_table_iter_init(&it, previous->albums);
+	while (g_hash_table_iter_next(&it, &name, &album))
+	{
+		g_hash_table_insert(handle->albums, strdup((const char*) name), album_ref((album_h) album));
+	}
+
+	return handle;
+}
+
+db_h db_create(const char* db_location, const char* device_uid, const char* device_name, const char* root_path,
+		bool snapshot, bool lazy_albums, const char* catalog_cache_dir)
+{
+	ASSERT_RET(db_location != NULL, NULL);
+	ASSERT_RET(device_uid != NULL, NULL);
+	ASSERT_RET(device_name != NULL, NULL);
+	ASSERT_RET(root_path != NULL, NULL);
+
+	db_source_t* source = db_source_create(db_location, inode_for_device(device_uid), device_name, root_path, snapshot);
+	ASSERT_RET(source != NULL, NULL);
+
+	db_h handle = db_alloc(source, lazy_albums);
+	db_source_unref(source);
+
+	if (handle)
+	{
+		LOG_DEBUG("DB path for device %s: %s", device_name, db_location);
+
+		if (access(db_location, F_OK) == -1)
+		{
+			LOG_ERROR("Unable to open database %s (improper path)", db_location);
+			db_unref(handle);
+			return NULL;
+		}
+
+		// the state of the database is retrieved before it's read, so that the changes made in the
+		// meantime invalidate the cached catalog (and are picked up by the next db_refresh())
+		handle->has_key = catalog_key_read(db_location, &handle->key);
+
+		// the lazily loaded albums don't know their photos, so they're never cached
+		if (catalog_cache_dir != NULL && handle->has_key && !lazy_albums)
+		{
+			char* file_name = g_strconcat(device_uid, ".catalog", NULL);
+			g_strdelimit(file_name, G_DIR_SEPARATOR_S, '_');
+
+			handle->catalog_path = g_build_filename(catalog_cache_dir, file_name, NULL);
+			g_free(file_name);
+		}
+
+		if (handle->catalog_path != NULL && db_load_catalog(handle, handle->catalog_path, &handle->key))
+		{
+			LOG_INFO("Loaded the catalog of device %s from %s", device_name, handle->catalog_path);
+			return handle;
+		}
+
+		g_mutex_lock(&source->lock);
+
+		bool connected = db_source_connect(source);
+		bool extracted = connected && db_extract_catalog(handle);
+
+		g_mutex_unlock(&source->lock);
+
+		if (!connected)
+		{
+			db_unref(handle);
+			return NULL;
+		}
+
+		if (!extracted)
+		{
+			LOG_ERROR("Unable to perform an initial photo extraction of device %s", device_name);
+			db_unref(handle);
+			return NULL;
+		}
+
+		if (handle->catalog_path != NULL)
+		{
+			db_save_catalog(handle, handle->catalog_path, &handle->key);
+		}
+	}
+
+	return handle;
+}
+
+// adds a title to the set of the titles of the albums which should be rebuilt
+static void db_add_title(GHashTable* titles, const char* title)
+{
+	if (title != NULL && !g_hash_table_contains(titles, title))
+	{
+		g_hash_table_add(titles, strdup(title));
+	}
+}
+
+// collects the titles of the albums which have been added, removed or modified since the previous extraction
+static void db_collect_changed_albums(GHashTable* states, GHashTable* previous_states, GHashTable* titles)
+{
+	GHashTableIter it;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&it, states);
+	while (g_hash_table_iter_next(&it, &key, &value))
+	{
+		db_album_state_t* state = (db_album_state_t*) value;
+		db_album_state_t* previous = (db_album_state_t*) g_hash_table_lookup(previous_states, key);
+
+		if (previous == NULL || previous->opt != state->opt)
+		{
+			// a renamed album changes both the directory it leaves and the one it joins
+			db_add_title(titles, state->title);
+
+			if (previous != NULL)
+			{
+				db_add_title(titles, previous->title);
+			}
+		}
+	}
+
+	g_hash_table_iter_init(&it, previous_states);
+	while (g_hash_table_iter_next(&it, &key, &value))
+	{
+		if (!g_hash_table_contains(states, key))
+		{
+			db_add_title(titles, ((db_album_state_t*) value)->title);
+		}
+	}
+}
+
+/**
+ * Collect the titles of the albums containing the assets added or modified since the previous extraction,
+ * and drop the photos of these assets from the lookup table, so that they are created anew
+ * @return true on success, false on error
+ */
+static bool db_collect_modified_photos(db_h handle, GHashTable* titles)
+{
+	// comparing with the "NULL" substituted for a missing column is never true, so only new assets are found then
+	db_source_t* source = handle->source;
+
+	char* condition = NULL;
+	asprintf(&condition, "and (%s.Z_PK > ?1 or %s > ?2)", PHOTO_TABLE_NAME, source->modified_column);
+	ASSERT_RET(condition != NULL, false);
+
+	sqlite3_stmt* statement = db_prepare_photo_query(source, condition);
+	free(condition);
+
+	if (statement == NULL)
+	{
+		return false;
+	}
+
+	sqlite3_bind_int64(statement, 1, handle->last_asset_pk);
+	sqlite3_bind_double(statement, 2, handle->last_modified);
+
+	int rc;
+	while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		db_add_title(titles, (const char*) sqlite3_column_text(statement, PHOTO_COLUMN_ALBUM_TITLE));
+
+		// the lazily loaded albums share the photos through the source (its lock is held while refreshing)
+		int64_t asset_pk = sqlite3_column_int64(statement, PHOTO_COLUMN_ASSET_PK);
+		g_hash_table_remove(handle->lazy_albums ? source->photos : handle->photos, &asset_pk);
+	}
+
+	if (rc != SQLITE_DONE)
+	{
+		LOG_ERROR("Unable to query the modified photos of device %s (%s)", source->device_name, sqlite3_errmsg(source->db));
+	}
+
+	sqlite3_finalize(statement);
+	return rc == SQLITE_DONE;
+}
+
+static void db_add_asset(GHashTable* assets, int64_t asset_pk)
+{
+	if (!g_hash_table_contains(assets, &asset_pk))
+	{
+		int64_t* key = (int64_t*) malloc(sizeof(int64_t));
+		ASSERT_RET(key != NULL);
+		*key = asset_pk;
+
+		g_hash_table_add(assets, key);
+	}
+}
+
+static bool db_collect_asset(const album_h album, const photo_h photo, void* user_data)
+{
+	db_add_asset((GHashTable*) user_data, inode_get_pk(photo_get_inode(photo)));
+	return true;
+}
+
+typedef struct
+{
+	db_h handle;
+	GHashTable* affected;       /// the assets whose photos are created anew for the refreshed catalog [int64_t*]
+	album_h copy;               /// the album to which the photos are copied
+	bool found;                 /// whether any of the affected assets has been found
+} db_copy_album_params_t;
+
+static bool db_find_affected_photo(const album_h album, const photo_h photo, void* user_data)
+{
+	db_copy_album_params_t* params = (db_copy_album_params_t*) user_data;
+	int64_t asset_pk = inode_get_pk(photo_get_inode(photo));
+
+	params->found = g_hash_table_contains(params->affected, &asset_pk);
+	return !params->found;
+}
+
+static bool db_copy_album_photo(const album_h album, const photo_h photo, void* user_data)
+{
+	db_copy_album_params_t* params = (db_copy_album_params_t*) user_data;
+	int64_t asset_pk = inode_get_pk(photo_get_inode(photo));
+
+	if (!g_hash_table_contains(params->affected, &asset_pk))
+	{
+		// none of the albums of the photo has changed, so it's shared with the previous catalog as it is
+		album_add_photo(params->copy, photo_ref(photo));
+		return true;
+	}
+
+	photo_h fresh = (photo_h) g_hash_table_lookup(params->handle->photos, &asset_pk);
+	if (fresh == NULL)
+	{
+		fresh = photo_create(photo_get_file_name(photo), photo_get_location(photo), photo_get_inode(photo));
+		ASSERT_RET(fresh != NULL, false);
+
+		struct stat stbuf;
+		if (photo_get_stat(photo, &stbuf))
+		{
+			photo_set_stat(fresh, &stbuf);
+		}
+
+		int64_t* key = (int64_t*) malloc(sizeof(int64_t));
+		ASSERT_RET(key != NULL, false);
+		*key = asset_pk;
+
+		g_hash_table_insert(params->handle->photos, key, fresh);
+	}
+
+	photo_add_album(fresh);
+	album_add_photo(params->copy, photo_ref(fresh));
+	return true;
+}
+
+/**
+ * Replace the albums which haven't been rebuilt, but hold photos whose number of albums may have changed,
+ * by copies linking to the photos created anew (see db_refresh_albums())
+ * @param rebuilt the titles of the rebuilt albums
+ * @param affected the assets of the photos which have been created anew [int64_t*]
+ */
+static void db_copy_affected_albums(db_h handle, GHashTable* rebuilt, GHashTable* affected)
+{
+	db_copy_album_params_t params = {
+		.handle = handle,
+		.affected = affected
+	};
+
+	GHashTableIter it;
+	gpointer name, value;
+
+	g_hash_table_iter_init(&it, handle->albums);
+	while (g_hash_table_iter_next(&it, &name, &value))
+	{
+		album_h album = (album_h) value;
+
+		params.found = false;
+		if (g_hash_table_contains(rebuilt, name) || !album_for_each_photo(album, db_find_affected_photo, &params) ||
+				!params.found)
+		{
+			continue;
+		}
+
+		params.copy = album_create(album_get_name(album), album_get_inode(album));
+		if (params.copy == NULL)
+		{
+			continue;
+		}
+
+		album_for_each_photo(album, db_copy_album_photo, &params);
+		g_hash_table_iter_replace(&it, params.copy);
+	}
+}
+
+/**
+ * Replace the album with the given title by a new one, holding the photos which currently belong to it
+ * @param statement the photo query restricted to the albums with the title bound as its first parameter
+ * @param affected the assets whose number of albums may have changed [int64_t*], to which the assets
+ * of the replaced album are added
+ * @return true on success, false on error
+ */
+static bool db_rebuild_album(db_h handle, sqlite3_stmt* statement, const char* title, GHashTable* affected)
+{
+	album_h previous = (album_h) g_hash_table_lookup(handle->albums, title);
+
+	if (previous != NULL)
+	{
+		album_for_each_photo(previous, db_collect_asset, affected);
+
+		// the album isn't modified in place, as the previous catalog might still be read, but the new one
+		// keeps its inode (the photos are then added to it by db_extract_album())
+		album_h album = album_create(title, album_get_inode(previous));
+		ASSERT_RET(album != NULL, false);
+
+		g_hash_table_replace(handle->albums, strdup(title), album);
+	}
+
+	sqlite3_reset(statement);
+	sqlite3_bind_text(statement, 1, title, -1, SQLITE_STATIC);
+
+	bool extracted = db_extract_photos(handle, statement);
+
+	// the albums without any photos are not presented, the same as when the whole catalog is extracted
+	album_h album = (album_h) g_hash_table_lookup(handle->albums, title);
+	if (album != NULL && album_get_photo_count(album) == 0)
+	{
+		g_hash_table_remove(handle->albums, title);
+	}
+
+	return extracted;
+}
+
+/**
+ * Replace the album with the given title by a new lazily loaded one (see db_rebuild_album())
+ * @param statement the summary query restricted to the albums with the title bound as its first parameter
+ * @return true on success, false on error
+ */
+static bool db_summarize_album(db_h handle, sqlite3_stmt* statement, const char* title)
+{
+	album_h previous = (album_h) g_hash_table_lookup(handle->albums, title);
+
+	sqlite3_reset(statement);
+	sqlite3_bind_text(statement, 1, title, -1, SQLITE_STATIC);
+
+	bool summarized = db_summarize_albums(handle, statement);
+
+	// the album which hasn't been replaced has no photos anymore
+	if (summarized && previous != NULL && g_hash_table_lookup(handle->albums, title) == previous)
+	{
+		g_hash_table_remove(handle->albums, title);
+	}
+
+	return summarized;
+}
+
+/**
+ * Bring the catalog up to date by rebuilding only the albums which have changed since the previous extraction
+ * @param previous_states the states of the albums at the time of the previous extraction (see db_read_album_states())
+ * @return true on success, false on error
+ */
+static bool db_refresh_albums(db_h handle, GHashTable* previous_states)
+{
+	db_source_t* source = handle->source;
+
+	handle->album_states = db_read_album_states(source);
+	if (handle->album_states == NULL)
+	{
+		return false;
+	}
+
+	GHashTable* titles = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+	GHashTable* affected = g_hash_table_new_full(g_int64_hash, g_int64_equal, free, NULL);
+	sqlite3_stmt* statement = NULL;
+
+	db_collect_changed_albums(handle->album_states, previous_states, titles);
+	bool refreshed = db_collect_modified_photos(handle, titles);
+
+	// the photos of the lazily loaded albums don't tell which assets have been extracted
+	if (refreshed && handle->lazy_albums)
+	{
+		refreshed = db_read_watermarks(handle);
+	}
+
+	if (refreshed && g_hash_table_size(titles) > 0)
+	{
+		statement = handle->lazy_albums ? db_prepare_summary_query(source, ALBUM_TITLE_CONDITION) :
+				db_prepare_photo_query(source, ALBUM_TITLE_CONDITION);
+		refreshed = (statement != NULL);
+	}
+
+	// the photos reachable from the previous catalog are never modified, as it might still be read, so the rebuilt
+	// albums are extracted into photos created anew, and so are the photos of the other albums they share
+	GHashTable* shared = handle->photos;
+	if (!handle->lazy_albums)
+	{
+		handle->photos = g_hash_table_new_full(g_int64_hash, g_int64_equal, free, (GDestroyNotify) photo_unref);
+	}
+
+	GHashTableIter it;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&it, titles);
+	while (refreshed && g_hash_table_iter_next(&it, &key, NULL))
+	{
+		refreshed = handle->lazy_albums ? db_summarize_album(handle, statement, (const char*) key) :
+				db_rebuild_album(handle, statement, (const char*) key, affected);
+	}
+
+	if (refreshed && !handle->lazy_albums)
+	{
+		g_hash_table_iter_init(&it, handle->photos);
+		while (g_hash_table_iter_next(&it, &key, NULL))
+		{
+			db_add_asset(affected, *(int64_t*) key);
+		}
+
+		db_copy_affected_albums(handle, titles, affected);
+
+		// the photos created anew replace the previous ones of their assets
+		g_hash_table_iter_init(&it, affected);
+		while (g_hash_table_iter_next(&it, &key, NULL))
+		{
+			g_hash_table_remove(shared, key);
+		}
+
+		g_hash_table_iter_init(&it, handle->photos);
+		while (g_hash_table_iter_next(&it, &key, &value))
+		{
+			g_hash_table_iter_steal(&it);
+			g_hash_table_insert(shared, key, value);
+		}
+	}
+
+	if (shared != handle->photos)
+	{
+		g_hash_table_unref(handle->photos);
+		handle->photos = shared;
+	}
+
+	if (refreshed)
+	{
+		LOG_INFO("Refreshed %u albums of device %s", g_hash_table_size(titles), source->device_name);
+	}
+
+	sqlite3_finalize(statement);
+	g_hash_table_unref(affected);
+	g_hash_table_unref(titles);
+
+	return refreshed;
+}
+
+db_h db_refresh(db_h handle)
+{
+	ASSERT_RET(handle != NULL, NULL);
+
+	db_source_t* source = handle->source;
+
+	catalog_key_t key;
+	if (!catalog_key_read(source->db_location, &key))
+	{
+		LOG_WARN("Unable to access database of device %s, its catalog is not refreshed", source->device_name);
+		return db_ref(handle);
+	}
+
+	if (handle->has_key && memcmp(&key, &handle->key, sizeof(catalog_key_t)) == 0)
+	{
+		return db_ref(handle);
+	}
+
+	// the catalog loaded from the cache has no states of the albums, so it's extracted as a whole
+	bool incremental = (handle->album_states != NULL);
+
+	// the albums which haven't changed are shared with the previous catalog
+	db_h refreshed = db_copy(handle);
+	ASSERT_RET(refreshed != NULL, NULL);
+
+	refreshed->has_key = true;
+	refreshed->key = key;
+
+	g_mutex_lock(&source->lock);
+
+	// a connection to the database itself sees its changes, while a snapshot has to be copied anew
+	if (source->snapshot != NULL)
+	{
+		db_source_close(source);
+	}
+
+	if (!db_source_connect(source))
+	{
+		g_mutex_unlock(&source->lock);
+		db_unref(refreshed);
+		return NULL;
+	}
+
+	if (incremental)
+	{
+		// the lookup table of the photos is only used while extracting, so it's moved rather than copied
+		GHashTable* photos = refreshed->photos;
+		refreshed->photos = handle->photos;
+		handle->photos = photos;
+
+		// the states are read anew (see db_refresh_albums())
+		g_hash_table_unref(refreshed->album_states);
+		refreshed->album_states = NULL;
+
+		sqlite3_exec(source->db, "begin", NULL, NULL, NULL);
+		incremental = db_refresh_albums(refreshed, handle->album_states);
+		sqlite3_exec(source->db, "commit", NULL, NULL, NULL);
+
+		if (!incremental)
+		{
+			LOG_WARN("Unable to refresh the changed albums of device %s, extracting all of them", source->device_name);
+		}
+	}
+
+	if (!incremental)
+	{
+		g_hash_table_remove_all(refreshed->albums);
+		g_hash_table_remove_all(refreshed->photos);
+
+		if (refreshed->album_states != NULL)
+		{
+			g_hash_table_unref(refreshed->album_states);
+			refreshed->album_states = NULL;
+		}
+
+		refreshed->last_asset_pk = 0;
+		refreshed->last_modified = 0;
+	}
+
+	if (!incremental && !db_extract_catalog(refreshed))
+	{
+		g_mutex_unlock(&source->lock);
+		LOG_ERROR("Unable to refresh the catalog of device %s", source->device_name);
+
+		// the photos might have been moved out of the previous catalog, so it can't be refreshed incrementally
+		if (handle->album_states != NULL)
+		{
+			g_hash_table_unref(handle->album_states);
+			handle->album_states = NULL;
+		}
+
+		db_unref(refreshed);
+		return NULL;
+	}
+
+	g_mutex_unlock(&source->lock);
+
+	if (refreshed->catalog_path != NULL)
+	{
+		db_save_catalog(refreshed, refreshed->catalog_path, &refreshed->key);
+	}
+
+	return refreshed;
+}
+
+db_h db_evict_albums(db_h handle, unsigned int idle_timeout)
+{
+	ASSERT_RET(handle != NULL, NULL);
+
+	db_h evicted = NULL;
+	unsigned int count = 0;
+
+	GHashTableIter it;
+	gpointer name, value;
+
+	g_hash_table_iter_init(&it, handle->albums);
+	while (handle->lazy_albums && idle_timeout > 0 && g_hash_table_iter_next(&it, &name, &value))
+	{
+		album_h album = (album_h) value;
+		if (!album_is_idle(album, idle_timeout))
+		{
+			continue;
+		}
+
+		if (evicted == NULL && (evicted = db_copy(handle)) == NULL)
+		{
+			break;
+		}
+
+		// the album isn't unloaded in place, as it might still be read, but replaced by one which is loaded again if it's needed
+		album_h lazy = db_create_lazy_album(evicted, (const char*) name, album_get_inode(album), album_get_photo_count(album));
+		if (lazy != NULL)
+		{
+			g_hash_table_replace(evicted->albums, strdup((const char*) name), lazy);
+			count++;
+		}
+	}
+
+	if (evicted == NULL)
+	{
+		return db_ref(handle);
+	}
+
+	LOG_DEBUG("Evicted the photos of %u idle albums of device %s", count, handle->source->device_name);
+	return evicted;
+}
+
+const char* db_get_device_name(const db_h handle)
+{
+	ASSERT_RET(handle, NULL);
+	return handle->source->device_name;
+}
+
+const char* db_get_root_path(const db_h handle)
+{
+	ASSERT_RET(handle, NULL);
+	return handle->source->root_path;
+}
+
+uint64_t db_get_inode(const db_h handle)
+{
+	ASSERT_RET(handle, 0);
+	return handle->source->inode;
+}
+
+bool db_for_each_album(const db_h handle, db_for_each_album_cb callback, void* user_data)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(callback != NULL, false);
+
+	GHashTableIter it;
+	gpointer value;
+
+	g_hash_table_iter_init(&it, handle->albums);
+	while (g_hash_table_iter_next(&it, NULL, &value))
+	{
+		if (!callback(handle, (album_h) value, user_data))
+		{
+			break;
+		}
+	}
+
+	return true;
+}
+
+album_h db_get_album_by_name(const db_h handle, const char* album_name)
+{
+	ASSERT_RET(handle, NULL);
+	ASSERT_RET(album_name, NULL);
+
+	album_h album = db_find_album(handle, album_name);
+
+	if (album == NULL)
+	{
+		return NULL;
+	}
+
+	return album_ref(album);
+}
+
+album_h db_find_album(const db_h handle, const char* album_name)
+{
+	ASSERT_RET(handle, NULL);
+	ASSERT_RET(album_name, NULL);
+
+	return (album_h) g_hash_table_lookup(handle->albums, album_name);
+}
+
+// whether a photo presented under the same name and inode differs from its previous version
+static bool db_photo_changed(const photo_h previous, const photo_h photo)
+{
+	struct stat previous_stbuf, stbuf;
+	bool previous_has_stat = photo_get_stat(previous, &previous_stbuf);
+	bool has_stat = photo_get_stat(photo, &stbuf);
+
+	if (!STREQ(photo_get_location(previous), photo_get_location(photo)) || previous_has_stat != has_stat)
+	{
+		return true;
+	}
+
+	// the number of albums is reported as the number of links of the photo
+	if (photo_get_album_count(previous) != photo_get_album_count(photo))
+	{
+		return true;
+	}
+
+	return has_stat && (previous_stbuf.st_size != stbuf.st_size || previous_stbuf.st_mtime != stbuf.st_mtime);
+}
+
+typedef struct
+{
+	db_h handle;
+	album_h other;              /// the album with which the reported photos are compared
+	db_for_each_change_cb callback;
+	void* user_data;
+	bool proceed;               /// cleared when the callback asks to stop
+} db_for_each_change_params_t;
+
+static bool db_report_removed_photo(const album_h previous, const photo_h photo, void* user_data)
+{
+	db_for_each_change_params_t* params = (db_for_each_change_params_t*) user_data;
+	photo_h current = (params->other != NULL) ? album_find_photo(params->other, photo_get_file_name(photo)) : NULL;
+
+	if (current == photo)
+	{
+		return true;
+	}
+
+	db_change_e change = DB_CHANGE_PHOTO_REMOVED;
+	if (current != NULL && photo_get_inode(current) == photo_get_inode(photo))
+	{
+		if (!db_photo_changed(photo, current))
+		{
+			return true;
+		}
+
+		change = DB_CHANGE_PHOTO_MODIFIED;
+	}
+
+	params->proceed = params->callback(params->handle, change, album_get_inode(previous), photo_get_inode(photo),
+			photo_get_file_name(photo), params->user_data);
+	return params->proceed;
+}
+
+static bool db_report_added_photo(const album_h album, const photo_h photo, void* user_data)
+{
+	db_for_each_change_params_t* params = (db_for_each_change_params_t*) user_data;
+
+	// the photos replacing the ones with the same name have already been reported as removed or modified
+	if (album_find_photo(params->other, photo_get_file_name(photo)) != NULL)
+	{
+		return true;
+	}
+
+	params->proceed = params->callback(params->handle, DB_CHANGE_PHOTO_ADDED, album_get_inode(album), photo_get_inode(photo),
+			photo_get_file_name(photo), params->user_data);
+	return params->proceed;
+}
+
+bool db_for_each_change(const db_h previous, const db_h handle, db_for_each_change_cb callback, void* user_data)
+{
+	ASSERT_RET(previous != NULL, false);
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(callback != NULL, false);
+
+	if (previous == handle)
+	{
+		return true;
+	}
+
+	db_for_each_change_params_t params = {
+		.handle = handle,
+		.callback = callback,
+		.user_data = user_data,
+		.proceed = true
+	};
+
+	GHashTableIter it;
+	gpointer name, value;
+
+	// the albums which haven't changed are shared by both catalogs (see db_refresh())
+	g_hash_table_iter_init(&it, handle->albums);
+	while (params.proceed && g_hash_table_iter_next(&it, &name, &value))
+	{
+		album_h album = (album_h) value;
+		album_h other = (album_h) g_hash_table_lookup(previous->albums, name);
+
+		if (other == album)
+		{
+			continue;
+		}
+
+		if (other == NULL || album_get_inode(other) != album_get_inode(album))
+		{
+			if (other != NULL)
+			{
+				params.proceed = callback(handle, DB_CHANGE_ALBUM_REMOVED, handle->source->inode, album_get_inode(other), name, user_data);
+			}
+
+			params.proceed = params.proceed &&
+					callback(handle, DB_CHANGE_ALBUM_ADDED, handle->source->inode, album_get_inode(album), name, user_data);
+			continue;
+		}
+
+		params.proceed = callback(handle, DB_CHANGE_ALBUM_MODIFIED, handle->source->inode, album_get_inode(album), name, user_data);
+
+		// the albums which haven't been loaded aren't compared, as that would load them, the photos which
+		// have been loaded into the previous one are reported as removed instead
+		if (!album_is_loaded(album) || !album_is_loaded(other))
+		{
+			params.other = NULL;
+			if (params.proceed && album_is_loaded(other))
+			{
+				album_for_each_photo(other, db_report_removed_photo, &params);
+			}
+
+			continue;
+		}
+
+		params.other = album;
+		if (params.proceed)
+		{
+			album_for_each_photo(other, db_report_removed_photo, &params);
+		}
+
+		params.other = other;
+		if (params.proceed)
+		{
+			album_for_each_photo(album, db_report_added_photo, &params);
+		}
+	}
+
+	g_hash_table_iter_init(&it, previous->albums);
+	while (params.proceed && g_hash_table_iter_next(&it, &name, &value))
+	{
+		if (!g_hash_table_contains(handle->albums, name))
+		{
+			params.proceed = callback(handle, DB_CHANGE_ALBUM_REMOVED, handle->source->inode, album_get_inode((album_h) value), name, user_data);
+		}
+	}
+
+	return true;
+}
+
+db_h db_ref(db_h handle)
+{
+	ASSERT_RET(handle, NULL);
+	ASSERT_RET(handle->ref_count > 0, handle);
+
+	g_atomic_int_inc(&handle->ref_count);
+	return handle;
+}
+
+void db_unref(db_h handle)
+{
+	ASSERT_RET(handle);
+	ASSERT_RET(handle->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&handle->ref_count))
+	{
+		LOG_INFO("Freeing database...");
+
+		if (handle->album_states != NULL)
+		{
+			g_hash_table_unref(handle->album_states);
+		}
+
+		g_hash_table_unref(handle->albums);
+		g_hash_table_unref(handle->photos);
+		g_free(handle->catalog_path);
+		db_source_unref(handle->source);
 		free(handle);
 	}
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "album.h"
 
@@ -24,17 +25,100 @@ typedef struct db_s* db_h;
  */
 typedef bool (*db_for_each_album_cb)(const db_h handle, const album_h album, void* user_data);
 
+/**
+ * The kinds of the changes of a catalog reported by db_for_each_change()
+ */
+typedef enum
+{
+	DB_CHANGE_ALBUM_ADDED,      //!< a new album has appeared on the device
+	DB_CHANGE_ALBUM_REMOVED,    //!< an album has disappeared from the device
+	DB_CHANGE_ALBUM_MODIFIED,   //!< the photos of an album have changed (and are reported separately)
+	DB_CHANGE_PHOTO_ADDED,      //!< a photo has been added to an album
+	DB_CHANGE_PHOTO_REMOVED,    //!< a photo has been removed from an album
+	DB_CHANGE_PHOTO_MODIFIED    //!< the file or the attributes of a photo have changed
+} db_change_e;
+
+/**
+ * A callback invoked by db_for_each_change() for each change between two catalogs of a device
+ * @param handle a handle of the current catalog of the device
+ * @param change the kind of the change
+ * @param parent_inode the inode of the directory containing the changed entry (the device for albums,
+ * the album for photos)
+ * @param inode the inode of the changed entry (its previous inode, if it has been removed)
+ * @param name the name of the changed entry within the directory
+ * @param user_data user data passed to db_for_each_change()
+ * @return true if you want to continue invoking this callback for subsequent changes, or false if
+ * you don't care about the remaining changes and db_for_each_change() should be immediately terminated.
+ */
+typedef bool (*db_for_each_change_cb)(const db_h handle, db_change_e change, uint64_t parent_inode, uint64_t inode,
+		const char* name, void* user_data);
+
 /**
  * Creates the instance of db for the specified location
  * @param[in] db_location a location of the database which should be opened
+ * @param[in] device_uid the uid of the device corresponding to the database, from which
+ * the inode numbers of the device and its contents are derived
  * @param[in] device_name a name of the device corresponding to the database
  * passed in db_location (performs purely informative function and is only used
  * in messages passed to the user, instead of db_location)
  * @param[in] root_path an absolute path to the root directory of the corresponding
  * device
+ * @param[in] snapshot whether the database should be copied into a local snapshot (see
+ * db_snapshot.h) with a few sequential reads, and queried there instead of on the device
+ * @param[in] lazy_albums whether only the names and the numbers of photos of the albums should be extracted,
+ * and the photos of each album queried when it's first listed or looked up into (see album_create_lazy())
+ * @param[in] catalog_cache_dir the directory of the catalog cache (see catalog_cache.h), from which the catalog
+ * is loaded without querying the database if it hasn't changed since the previous mount, or NULL if the
+ * catalog shouldn't be cached (the catalog of lazily loaded albums never is)
  * @return A handle for the db of the passed device
+ * @note the inode numbers of the device, its albums and photos (see inode.h) are assigned by this function,
+ * based on the device uid and the primary keys of the albums and assets
+ */
+db_h db_create(const char* db_location, const char* device_uid, const char* device_name, const char* root_path,
+		bool snapshot, bool lazy_albums, const char* catalog_cache_dir);
+
+/**
+ * Bring the catalog of a device up to date with its photo database. The state of the database (see
+ * catalog_key_t) is checked first, so this function is cheap as long as the database hasn't changed.
+ * Otherwise only the albums whose records have changed (or which contain the photos added or modified
+ * since the previous extraction) are queried again, and the rest of the albums is shared with the
+ * previous catalog.
+ * @param handle a valid database handle
+ * @return a handle of the refreshed catalog, or a new reference to the passed one if the database hasn't
+ * changed, or NULL on error (in which case the passed catalog remains valid). The result should be
+ * unreferenced with db_unref() when it's no longer needed.
+ * @note the catalogs are never modified once they're created, so the passed catalog may still be read while
+ * it's being refreshed. It shouldn't be refreshed again though, the refreshed one should be used instead.
+ * @warning a device must not be refreshed by multiple threads at the same time
+ */
+db_h db_refresh(db_h handle);
+
+/**
+ * Drop the photos of the lazily loaded albums (see db_create()) which haven't been listed or looked up
+ * into for some time, by replacing these albums with ones which load their photos again when needed
+ * @param handle a valid database handle
+ * @param idle_timeout the time (in seconds) after which a loaded album is evicted, 0 if it never is
+ * @return a handle of the catalog without the photos of the idle albums, or a new reference to the
+ * passed one if there are none, or NULL on error. The result should be unreferenced with db_unref()
+ * when it's no longer needed.
+ * @note the same as db_refresh(), this function doesn't modify the passed catalog, and the changes
+ * between both catalogs are reported by db_for_each_change()
  */
-db_h db_create(const char* db_location, const char* device_name, const char* root_path);
+db_h db_evict_albums(db_h handle, unsigned int idle_timeout);
+
+/**
+ * This function synchronously calls the passed callback for each change between the previous and the
+ * refreshed catalog of a device (see db_refresh()), e.g. so that the kernel can be told which of the
+ * entries it has cached are no longer valid
+ * @param previous a valid handle of the previous catalog of a device
+ * @param handle a valid handle of the refreshed catalog of the same device
+ * @param callback the callback which should be invoked for each change
+ * @param user_data the user data which should be passed to the callback
+ * @return true on success, false if the provided arguments were incorrect
+ * @note only the albums which have been rebuilt by db_refresh() are compared photo by photo, and only if both
+ * their versions have been loaded (otherwise the loaded photos of the previous version are reported as removed)
+ */
+bool db_for_each_change(const db_h previous, const db_h handle, db_for_each_change_cb callback, void* user_data);
 
 /**
  * Get the device name of the device corresponding to that db
@@ -50,6 +134,13 @@ const char* db_get_device_name(const db_h handle);
  */
 const char* db_get_root_path(const db_h handle);
 
+/**
+ * Get the inode number assigned to the device corresponding to that db
+ * @param handle a valid database handle
+ * @return the inode number of the corresponding device or 0 on invalid argument
+ */
+uint64_t db_get_inode(const db_h handle);
+
 /**
  * This function synchronously calls the passed callback for each album from the provided device database
  * @param handle the handle of a device database for which the albums should be reported
@@ -69,6 +160,16 @@ bool db_for_each_album(const db_h handle, db_for_each_album_cb callback, void* u
  */
 album_h db_get_album_by_name(const db_h handle, const char* album_name);
 
+/**
+ * Find album in the database by its name, without taking a reference to it
+ * @param handle a valid database handle
+ * @param album_name the name of the album which should be found
+ * @return the handle of the album with the provided album_name or NULL when no such
+ * album has been found. The album is borrowed from the database, so it's valid only
+ * as long as the database is (e.g. within filesystem_enter_catalog()).
+ */
+album_h db_find_album(const db_h handle, const char* album_name);
+
 /**
  * Increases the reference counter of the passed db handle
  * @param handle the handle which reference counter should be increased
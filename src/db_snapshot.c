@@ -0,0 +1,252 @@
+#include "db_snapshot.h"
+#include "logger.h"
+#include "utils.h"
+
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+// the size of a single read from the device, large enough to make the copy sequential
+#define COPY_CHUNK_SIZE (4 * 1024 * 1024)
+
+// the name of the copy within the private directory of the snapshot
+#define SNAPSHOT_FILE_NAME "Photos.sqlite"
+
+// the suffixes of the files sqlite keeps next to a database in the write-ahead log mode
+#define WAL_SUFFIX "-wal"
+#define SHM_SUFFIX "-shm"
+
+/**
+ * A structure behind db_snapshot_h handle
+ */
+struct db_snapshot_s
+{
+	char* directory;    /// the private directory holding the copy
+	char* path;         /// the path of the copy
+	char* uri;          /// the URI opening the copy as immutable
+	uint64_t size;      /// the size of the copy
+};
+
+static bool write_all(int fd, const char* buffer, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t result = write(fd, buffer, length);
+		if (result == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		buffer += result;
+		length -= result;
+	}
+
+	return true;
+}
+
+// copies a file with large sequential reads, returns false with errno set on error
+static bool copy_file(const char* source, const char* destination, char* buffer)
+{
+	int in = open(source, O_RDONLY);
+	if (in == -1)
+	{
+		return false;
+	}
+
+	int out = open(destination, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (out == -1)
+	{
+		int error = errno;
+		close(in);
+		errno = error;
+		return false;
+	}
+
+	posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	bool copied = true;
+
+	while (true)
+	{
+		ssize_t length = read(in, buffer, COPY_CHUNK_SIZE);
+		if (length == -1 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (length <= 0)
+		{
+			copied = (length == 0);
+			break;
+		}
+
+		if (!write_all(out, buffer, length))
+		{
+			copied = false;
+			break;
+		}
+	}
+
+	int error = errno;
+	close(in);
+
+	if (close(out) != 0 && copied)
+	{
+		error = errno;
+		copied = false;
+	}
+
+	errno = error;
+	return copied;
+}
+
+// merges the write-ahead log into the copy, so that it can be opened as immutable
+static bool merge_wal(db_snapshot_h handle)
+{
+	sqlite3* db = NULL;
+
+	int rc = sqlite3_open_v2(handle->path, &db, SQLITE_OPEN_READWRITE, NULL);
+	if (rc == SQLITE_OK)
+	{
+		// leaving the write-ahead log mode checkpoints the log into the database and removes it
+		rc = sqlite3_exec(db, "pragma journal_mode=delete", NULL, NULL, NULL);
+	}
+
+	if (rc != SQLITE_OK)
+	{
+		LOG_ERROR("Unable to merge the write-ahead log into %s (%s)", handle->path, sqlite3_errmsg(db));
+	}
+
+	sqlite3_close(db);
+	return rc == SQLITE_OK;
+}
+
+db_snapshot_h db_snapshot_create(const char* db_location)
+{
+	ASSERT_RET(db_location != NULL, NULL);
+
+	db_snapshot_h handle = (db_snapshot_h) calloc(1, sizeof(struct db_snapshot_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->directory = g_dir_make_tmp("ipa-XXXXXX", NULL);
+	if (handle->directory == NULL)
+	{
+		LOG_ERROR("Unable to create a directory for the snapshot of %s", db_location);
+		db_snapshot_free(handle);
+		return NULL;
+	}
+
+	handle->path = g_build_filename(handle->directory, SNAPSHOT_FILE_NAME, NULL);
+
+	char* buffer = (char*) malloc(COPY_CHUNK_SIZE);
+	if (buffer == NULL)
+	{
+		db_snapshot_free(handle);
+		return NULL;
+	}
+
+	bool copied = copy_file(db_location, handle->path, buffer);
+	bool has_wal = false;
+
+	if (!copied)
+	{
+		LOG_ERROR("Unable to copy %s into %s: %s", db_location, handle->path, strerror(errno));
+	}
+	else
+	{
+		// the shared memory index is not copied, sqlite rebuilds it from the log
+		char* wal_location = g_strconcat(db_location, WAL_SUFFIX, NULL);
+		char* wal_path = g_strconcat(handle->path, WAL_SUFFIX, NULL);
+
+		if (access(wal_location, F_OK) == 0)
+		{
+			has_wal = copied = copy_file(wal_location, wal_path, buffer);
+			if (!copied)
+			{
+				LOG_ERROR("Unable to copy %s into %s: %s", wal_location, wal_path, strerror(errno));
+			}
+		}
+
+		g_free(wal_path);
+		g_free(wal_location);
+	}
+
+	free(buffer);
+
+	if (!copied || (has_wal && !merge_wal(handle)))
+	{
+		db_snapshot_free(handle);
+		return NULL;
+	}
+
+	struct stat st;
+	char* file_uri = g_filename_to_uri(handle->path, NULL, NULL);
+
+	if (file_uri == NULL || g_stat(handle->path, &st) != 0)
+	{
+		LOG_ERROR("Unable to access the snapshot %s", handle->path);
+		g_free(file_uri);
+		db_snapshot_free(handle);
+		return NULL;
+	}
+
+	handle->uri = g_strconcat(file_uri, "?immutable=1", NULL);
+	handle->size = st.st_size;
+	g_free(file_uri);
+
+	LOG_DEBUG("Copied %s (%" PRIu64 " bytes) into %s", db_location, handle->size, handle->path);
+	return handle;
+}
+
+const char* db_snapshot_get_uri(const db_snapshot_h handle)
+{
+	ASSERT_RET(handle != NULL, NULL);
+	return handle->uri;
+}
+
+uint64_t db_snapshot_get_size(const db_snapshot_h handle)
+{
+	ASSERT_RET(handle != NULL, 0);
+	return handle->size;
+}
+
+void db_snapshot_free(db_snapshot_h handle)
+{
+	if (handle)
+	{
+		if (handle->path != NULL)
+		{
+			char* wal_path = g_strconcat(handle->path, WAL_SUFFIX, NULL);
+			char* shm_path = g_strconcat(handle->path, SHM_SUFFIX, NULL);
+
+			g_unlink(wal_path);
+			g_unlink(shm_path);
+			g_unlink(handle->path);
+
+			g_free(shm_path);
+			g_free(wal_path);
+		}
+
+		if (handle->directory != NULL)
+		{
+			g_rmdir(handle->directory);
+		}
+
+		g_free(handle->uri);
+		g_free(handle->path);
+		g_free(handle->directory);
+		free(handle);
+	}
+}
@@ -0,0 +1,46 @@
+/*
+ * The photo database of a device is a sqlite file on the device itself, so querying it in place
+ * turns every page touched by sqlite into a random read over USB. This module copies the database
+ * (together with its write-ahead log, if there is one) into a private local file with a few large
+ * sequential reads instead, so that the copy is the only thing which ever touches the device.
+ *
+ * The log is merged into the copy right away, after which the copy never changes and can be opened
+ * as immutable (see db_snapshot_get_uri()), i.e. without any locking or checks for other writers.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * A handle of a local snapshot of a photo database
+ */
+typedef struct db_snapshot_s* db_snapshot_h;
+
+/**
+ * Copy the photo database into a new local snapshot
+ * @param db_location the location of the photo database on the device
+ * @return a handle of the snapshot or NULL on error
+ */
+db_snapshot_h db_snapshot_create(const char* db_location);
+
+/**
+ * Get the sqlite URI of the snapshot, which opens it as immutable
+ * @param handle a valid handle of a snapshot
+ * @return the URI, which should be passed to sqlite3_open_v2() with SQLITE_OPEN_URI, or NULL on invalid argument
+ */
+const char* db_snapshot_get_uri(const db_snapshot_h handle);
+
+/**
+ * Get the size of the snapshot, e.g. so that it can be mapped into memory as a whole
+ * @param handle a valid handle of a snapshot
+ * @return the size of the snapshot in bytes
+ */
+uint64_t db_snapshot_get_size(const db_snapshot_h handle);
+
+/**
+ * Remove the snapshot and free the handle
+ * @param handle a handle of a snapshot which should be freed
+ * @warning the snapshot must no longer be opened when it's removed
+ */
+void db_snapshot_free(db_snapshot_h handle);
@@ -0,0 +1,219 @@
+#include "epoch.h"
+#include "logger.h"
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// the size of a cache line, the records of the readers are aligned to it so they don't share any
+#define CACHE_LINE_SIZE 64
+
+// the epoch of a reader which is not within a critical section
+#define EPOCH_QUIESCENT 0
+
+// the time (in microseconds) between the checks whether the readers have left
+#define RETIRE_POLL_INTERVAL 100
+
+/**
+ * The states of the record of a reader
+ */
+typedef enum
+{
+	READER_FREE = 0,    //!< the thread owning the record has exited, so it may be taken by another one
+	READER_USED,        //!< the record is owned by a thread
+	READER_ORPHANED     //!< the domain has been freed while the owning thread still lives, which frees the record
+} reader_state_e;
+
+/**
+ * The state of a single reading thread, written only by that thread
+ */
+typedef struct epoch_reader_s
+{
+	gint epoch;                 /// the global epoch observed when entering the critical section, or EPOCH_QUIESCENT
+	unsigned int nesting;       /// the depth of the nested critical sections
+	gint state;                 /// the state of the record (see reader_state_e), the only field written by other threads
+	struct epoch_reader_s* next;/// the next reader of the domain, immutable once the reader is registered
+} __attribute__((aligned(CACHE_LINE_SIZE))) epoch_reader_t;
+
+/**
+ * A structure behind epoch_h handle
+ */
+struct epoch_s
+{
+	gint epoch;                 /// the global epoch, advanced by every retirement
+	epoch_reader_t* readers;    /// the records of the readers, never removed but reused once their threads exit
+	GMutex lock;                /// serializes the registration of the readers and the retirements
+};
+
+/**
+ * The record of the calling thread in the domain it has used last. There is a single domain per
+ * filesystem, so a thread registers itself only once.
+ */
+static __thread epoch_h current_domain = NULL;
+static __thread epoch_reader_t* current_reader = NULL;
+
+// gives the record of a reader back to its domain, so that it's reused by another thread
+static void release_reader(gpointer data)
+{
+	epoch_reader_t* reader = (epoch_reader_t*) data;
+
+	if (!g_atomic_int_compare_and_exchange(&reader->state, READER_USED, READER_FREE))
+	{
+		// the domain is gone and has left the record to this thread
+		free(reader);
+	}
+}
+
+/**
+ * The record of the calling thread, released when the thread exits. The threads of the pools come
+ * and go, so otherwise the domain would collect a record for every thread which has ever been started.
+ */
+static GPrivate thread_reader = G_PRIVATE_INIT(release_reader);
+
+static epoch_reader_t* get_reader(epoch_h handle)
+{
+	if (current_domain == handle)
+	{
+		return current_reader;
+	}
+
+	if (current_reader != NULL)
+	{
+		release_reader(current_reader);
+	}
+
+	// take over the record of a thread which has exited, if there is any
+	epoch_reader_t* reader = NULL;
+	for (reader = g_atomic_pointer_get(&handle->readers); reader != NULL; reader = reader->next)
+	{
+		if (g_atomic_int_compare_and_exchange(&reader->state, READER_FREE, READER_USED))
+		{
+			break;
+		}
+	}
+
+	if (reader == NULL)
+	{
+		if (posix_memalign((void**) &reader, CACHE_LINE_SIZE, sizeof(epoch_reader_t)) != 0)
+		{
+			return NULL;
+		}
+
+		reader->epoch = EPOCH_QUIESCENT;
+		reader->state = READER_USED;
+
+		g_mutex_lock(&handle->lock);
+		reader->next = handle->readers;
+		g_atomic_pointer_set(&handle->readers, reader);
+		g_mutex_unlock(&handle->lock);
+	}
+
+	// the record has been left quiescent by its previous thread
+	reader->nesting = 0;
+
+	g_private_set(&thread_reader, reader);
+	current_domain = handle;
+	current_reader = reader;
+	return reader;
+}
+
+epoch_h epoch_create(void)
+{
+	epoch_h handle = (epoch_h) calloc(1, sizeof(struct epoch_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->epoch = EPOCH_QUIESCENT + 1;
+	g_mutex_init(&handle->lock);
+
+	return handle;
+}
+
+void epoch_enter(epoch_h handle)
+{
+	ASSERT_RET(handle != NULL);
+
+	epoch_reader_t* reader = get_reader(handle);
+	ASSERT_RET(reader != NULL);
+
+	if (reader->nesting++ == 0)
+	{
+		g_atomic_int_set(&reader->epoch, g_atomic_int_get(&handle->epoch));
+
+		// a full barrier, so that the shared data is read only after the epoch has been published
+		__sync_synchronize();
+	}
+}
+
+void epoch_leave(epoch_h handle)
+{
+	ASSERT_RET(handle != NULL);
+	ASSERT_RET(current_domain == handle && current_reader->nesting > 0);
+
+	if (--current_reader->nesting == 0)
+	{
+		g_atomic_int_set(&current_reader->epoch, EPOCH_QUIESCENT);
+	}
+}
+
+// whether any reader has entered its critical section before the given epoch and is still within it
+static bool has_older_readers(epoch_h handle, gint epoch)
+{
+	for (epoch_reader_t* reader = g_atomic_pointer_get(&handle->readers); reader != NULL; reader = reader->next)
+	{
+		gint observed = g_atomic_int_get(&reader->epoch);
+		if (observed != EPOCH_QUIESCENT && observed < epoch)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void epoch_retire(epoch_h handle, void* data, epoch_destroy_cb destroy)
+{
+	ASSERT_RET(handle != NULL);
+	ASSERT_RET(destroy != NULL);
+
+	g_mutex_lock(&handle->lock);
+
+	// the readers which observe the new epoch have entered after the data became unreachable
+	gint epoch = g_atomic_int_add(&handle->epoch, 1) + 1;
+	while (has_older_readers(handle, epoch))
+	{
+		g_usleep(RETIRE_POLL_INTERVAL);
+	}
+
+	g_mutex_unlock(&handle->lock);
+
+	destroy(data);
+}
+
+void epoch_free(epoch_h handle)
+{
+	if (handle)
+	{
+		if (current_domain == handle)
+		{
+			g_private_set(&thread_reader, NULL);
+			g_atomic_int_set(&current_reader->state, READER_FREE);
+			current_domain = NULL;
+			current_reader = NULL;
+		}
+
+		while (handle->readers != NULL)
+		{
+			epoch_reader_t* reader = handle->readers;
+			handle->readers = reader->next;
+
+			// the records of the threads which still live are freed once they exit
+			if (!g_atomic_int_compare_and_exchange(&reader->state, READER_USED, READER_ORPHANED))
+			{
+				free(reader);
+			}
+		}
+
+		g_mutex_clear(&handle->lock);
+		free(handle);
+	}
+}
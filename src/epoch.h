@@ -0,0 +1,61 @@
+/*
+ * Epoch-based reclamation, i.e. a way of freeing shared data which is read without any locks or
+ * reference counting. The readers announce that they might be accessing the shared data with
+ * epoch_enter() and epoch_leave(), which only touch a record private to the calling thread. The
+ * writers replace the shared data (e.g. swap a pointer) and retire the old one with epoch_retire(),
+ * which waits until all the readers which might still see it have left, and frees it. Writing is
+ * therefore slow, which suits data replaced rarely and read by every request.
+ */
+
+#pragma once
+
+/**
+ * A handle of an epoch domain, i.e. of a set of readers and of the data they share
+ */
+typedef struct epoch_s* epoch_h;
+
+/**
+ * A function freeing retired data
+ * @param data the data passed to epoch_retire()
+ */
+typedef void (*epoch_destroy_cb)(void* data);
+
+/**
+ * Create a new epoch domain
+ * @return a handle of the domain or NULL on error
+ */
+epoch_h epoch_create(void);
+
+/**
+ * Enter a read-side critical section, during which the shared data retired by others is not freed.
+ * The sections may be nested.
+ * @param handle a valid handle of an epoch domain
+ * @note this function is thread-safe, and doesn't write to any memory shared with the other threads
+ * (except the first time it's called by a thread)
+ */
+void epoch_enter(epoch_h handle);
+
+/**
+ * Leave a read-side critical section entered with epoch_enter()
+ * @param handle the handle passed to epoch_enter()
+ */
+void epoch_leave(epoch_h handle);
+
+/**
+ * Wait until no reader may be accessing the data anymore, and free it. The data must have been made
+ * unreachable to the readers entering their critical sections from now on (e.g. replaced by new data)
+ * beforehand.
+ * @param handle a valid handle of an epoch domain
+ * @param data the data which should be freed
+ * @param destroy the function which frees the data
+ * @note this function is thread-safe, but it must not be called from within a read-side critical
+ * section, as it would wait for itself
+ */
+void epoch_retire(epoch_h handle, void* data, epoch_destroy_cb destroy);
+
+/**
+ * Free the epoch domain
+ * @param handle a handle of an epoch domain which should be freed
+ * @warning no thread may be within a read-side critical section when the domain is freed
+ */
+void epoch_free(epoch_h handle);
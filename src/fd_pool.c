@@ -0,0 +1,294 @@
+#include "fd_pool.h"
+#include "inode.h"
+#include "logger.h"
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+/**
+ * A single descriptor kept by the pool
+ */
+typedef struct fd_pool_entry_s
+{
+	uint64_t inode;         /// the inode of the photo (also the key in fd_pool_s::entries)
+	int fd;
+	unsigned int users;     /// the number of acquisitions which have not been released yet
+	gint64 idle_since;      /// the monotonic time when the descriptor has been released by its last user
+	GList link;             /// the link of this entry in fd_pool_s::idle, valid only when users is 0
+} fd_pool_entry_t;
+
+/**
+ * A structure behind fd_pool_h handle
+ */
+struct fd_pool_s
+{
+	unsigned int max_open;  /// the number of descriptors above which the idle ones are closed
+	gint64 idle_timeout;    /// the time (in microseconds) after which an idle descriptor is closed
+	io_scheduler_h scheduler; /// the scheduler through which the files are opened, may be NULL
+
+	GMutex lock;            /// guards all of the fields below
+	GCond changed;          /// signalled when the pool is being freed or the first descriptor becomes idle
+	bool stopping;          /// whether the pool is being freed
+	GHashTable* entries;    /// all the open descriptors <inode, entry> [uint64_t*, fd_pool_entry_t*]
+	GHashTable* evicted;    /// the evicted descriptors which are still in use <fd, entry> [int*, fd_pool_entry_t*]
+	GQueue idle;            /// the descriptors which are not used, the most recently released ones first
+	GThread* reaper;        /// closes the descriptors which have been idle for too long
+};
+
+static void entry_free(fd_pool_entry_t* entry)
+{
+	close(entry->fd);
+	free(entry);
+}
+
+// must be called with the lock held
+static void close_idle(fd_pool_h handle, gint64 idle_before)
+{
+	while (handle->idle.tail != NULL)
+	{
+		fd_pool_entry_t* entry = (fd_pool_entry_t*) handle->idle.tail->data;
+
+		bool over_limit = g_hash_table_size(handle->entries) > handle->max_open;
+		if (!over_limit && entry->idle_since > idle_before)
+		{
+			break;
+		}
+
+		g_queue_unlink(&handle->idle, &entry->link);
+		g_hash_table_remove(handle->entries, &entry->inode);
+	}
+}
+
+static gpointer reaper_thread(gpointer data)
+{
+	fd_pool_h handle = (fd_pool_h) data;
+
+	g_mutex_lock(&handle->lock);
+
+	while (!handle->stopping)
+	{
+		gint64 now = g_get_monotonic_time();
+		close_idle(handle, now - handle->idle_timeout);
+
+		if (handle->idle.tail == NULL)
+		{
+			g_cond_wait(&handle->changed, &handle->lock);
+		}
+		else
+		{
+			// wake up when the least recently released descriptor is due to be closed
+			gint64 wake_up = ((fd_pool_entry_t*) handle->idle.tail->data)->idle_since + handle->idle_timeout;
+			g_cond_wait_until(&handle->changed, &handle->lock, wake_up);
+		}
+	}
+
+	g_mutex_unlock(&handle->lock);
+	return NULL;
+}
+
+fd_pool_h fd_pool_create(unsigned int max_open, unsigned int idle_timeout, io_scheduler_h scheduler)
+{
+	ASSERT_RET(max_open > 0, NULL);
+
+	fd_pool_h handle = (fd_pool_h) calloc(1, sizeof(struct fd_pool_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->max_open = max_open;
+	handle->idle_timeout = (gint64) idle_timeout * G_USEC_PER_SEC;
+	handle->scheduler = scheduler;
+	g_mutex_init(&handle->lock);
+	g_cond_init(&handle->changed);
+	handle->entries = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, (GDestroyNotify) entry_free);
+	handle->evicted = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, (GDestroyNotify) entry_free);
+	g_queue_init(&handle->idle);
+	handle->reaper = g_thread_new("fd-pool", reaper_thread, handle);
+
+	return handle;
+}
+
+// must be called with the lock held
+static int entry_acquire(fd_pool_h handle, fd_pool_entry_t* entry)
+{
+	if (entry->users++ == 0)
+	{
+		g_queue_unlink(&handle->idle, &entry->link);
+	}
+
+	return entry->fd;
+}
+
+int fd_pool_acquire_open(fd_pool_h handle, uint64_t inode)
+{
+	ASSERT_RET(handle != NULL, -1);
+
+	int fd = -1;
+
+	g_mutex_lock(&handle->lock);
+
+	fd_pool_entry_t* entry = (fd_pool_entry_t*) g_hash_table_lookup(handle->entries, &inode);
+	if (entry != NULL)
+	{
+		fd = entry_acquire(handle, entry);
+	}
+
+	g_mutex_unlock(&handle->lock);
+	return fd;
+}
+
+int fd_pool_adopt(fd_pool_h handle, uint64_t inode, int fd)
+{
+	ASSERT_RET(handle != NULL, -1);
+	ASSERT_RET(fd != -1, -1);
+
+	g_mutex_lock(&handle->lock);
+
+	fd_pool_entry_t* entry = (fd_pool_entry_t*) g_hash_table_lookup(handle->entries, &inode);
+	if (entry != NULL)
+	{
+		// the photo has been opened concurrently by someone else, share their descriptor
+		close(fd);
+		fd = entry_acquire(handle, entry);
+	}
+	else
+	{
+		entry = (fd_pool_entry_t*) calloc(1, sizeof(fd_pool_entry_t));
+		if (entry == NULL)
+		{
+			g_mutex_unlock(&handle->lock);
+			close(fd);
+			errno = ENOMEM;
+			return -1;
+		}
+
+		entry->inode = inode;
+		entry->fd = fd;
+		entry->users = 1;
+		entry->link.data = entry;
+
+		g_hash_table_insert(handle->entries, &entry->inode, entry);
+		close_idle(handle, 0);
+	}
+
+	g_mutex_unlock(&handle->lock);
+	return fd;
+}
+
+int fd_pool_acquire(fd_pool_h handle, uint64_t inode, const char* location)
+{
+	ASSERT_RET(handle != NULL, -1);
+	ASSERT_RET(location != NULL, -1);
+
+	int fd = fd_pool_acquire_open(handle, inode);
+	if (fd != -1)
+	{
+		return fd;
+	}
+
+	// the file is opened without the lock, as it takes a while and other photos shouldn't wait for it
+	io_scheduler_begin(handle->scheduler, IO_CLASS_METADATA, inode_get_device(inode));
+	fd = open(location, O_RDONLY);
+	int error = errno;
+	io_scheduler_end(handle->scheduler, IO_CLASS_METADATA, inode_get_device(inode));
+
+	if (fd == -1)
+	{
+		errno = error;
+		return -1;
+	}
+
+	return fd_pool_adopt(handle, inode, fd);
+}
+
+void fd_pool_release(fd_pool_h handle, uint64_t inode, int fd)
+{
+	ASSERT_RET(handle != NULL);
+
+	g_mutex_lock(&handle->lock);
+
+	fd_pool_entry_t* entry = (fd_pool_entry_t*) g_hash_table_lookup(handle->entries, &inode);
+	if (entry == NULL || entry->fd != fd)
+	{
+		// the descriptor may have been evicted while it was in use
+		fd_pool_entry_t* evicted = (fd_pool_entry_t*) g_hash_table_lookup(handle->evicted, &fd);
+		if (evicted != NULL && evicted->inode == inode)
+		{
+			if (--evicted->users == 0)
+			{
+				g_hash_table_remove(handle->evicted, &evicted->fd);
+			}
+
+			g_mutex_unlock(&handle->lock);
+			return;
+		}
+
+		entry = NULL;
+	}
+
+	if (entry == NULL || entry->users == 0)
+	{
+		LOG_WARN("Releasing descriptor of inode %" PRIu64 " which has not been acquired", inode);
+	}
+	else if (--entry->users == 0)
+	{
+		entry->idle_since = g_get_monotonic_time();
+		g_queue_push_head_link(&handle->idle, &entry->link);
+		close_idle(handle, entry->idle_since - handle->idle_timeout);
+
+		if (handle->idle.length == 1)
+		{
+			// the reaper has nothing to wait for until now
+			g_cond_signal(&handle->changed);
+		}
+	}
+
+	g_mutex_unlock(&handle->lock);
+}
+
+void fd_pool_evict(fd_pool_h handle, uint64_t inode)
+{
+	ASSERT_RET(handle != NULL);
+
+	g_mutex_lock(&handle->lock);
+
+	fd_pool_entry_t* entry = (fd_pool_entry_t*) g_hash_table_lookup(handle->entries, &inode);
+	if (entry != NULL)
+	{
+		if (entry->users == 0)
+		{
+			g_queue_unlink(&handle->idle, &entry->link);
+			g_hash_table_remove(handle->entries, &entry->inode);
+		}
+		else
+		{
+			// the current users keep reading the descriptor, which is closed once they release it
+			g_hash_table_steal(handle->entries, &entry->inode);
+			g_hash_table_insert(handle->evicted, &entry->fd, entry);
+		}
+	}
+
+	g_mutex_unlock(&handle->lock);
+}
+
+void fd_pool_free(fd_pool_h handle)
+{
+	if (handle)
+	{
+		g_mutex_lock(&handle->lock);
+		handle->stopping = true;
+		g_cond_signal(&handle->changed);
+		g_mutex_unlock(&handle->lock);
+
+		g_thread_join(handle->reaper);
+
+		g_hash_table_unref(handle->entries);
+		g_hash_table_unref(handle->evicted);
+		g_cond_clear(&handle->changed);
+		g_mutex_clear(&handle->lock);
+		free(handle);
+	}
+}
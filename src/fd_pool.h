@@ -0,0 +1,86 @@
+/*
+ * Every open() of a file on the device is a round trip over USB, while thumbnailers and viewers
+ * tend to open the same photo many times in a row. This module keeps the descriptors of the files
+ * backing the photos open and shares them between all the concurrent and subsequent opens of the
+ * same photo. Descriptors which are no longer used are closed once they have been idle for a while,
+ * or when the number of open descriptors exceeds the configured limit.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "io_scheduler.h"
+
+/**
+ * A handle of a descriptor pool
+ */
+typedef struct fd_pool_s* fd_pool_h;
+
+/**
+ * Create a new descriptor pool
+ * @param max_open the number of descriptors above which the idle ones are closed immediately
+ * @param idle_timeout the time (in seconds) after which an unused descriptor is closed
+ * @param scheduler the scheduler through which the files are opened, or NULL if they are opened immediately
+ * @return a handle of the pool or NULL on error
+ */
+fd_pool_h fd_pool_create(unsigned int max_open, unsigned int idle_timeout, io_scheduler_h scheduler);
+
+/**
+ * Get a read-only descriptor of a file backing a photo, opening the file if it's not open yet
+ * @param handle a valid handle of a descriptor pool
+ * @param inode the inode of the photo (see inode.h)
+ * @param location the location of the file backing the photo
+ * @return the descriptor or -1 on error, in which case errno is set appropriately
+ * @note the descriptor is shared, so it may only be used with positional reads (e.g. pread()),
+ * and must be returned with fd_pool_release() instead of being closed
+ * @note this function is thread-safe
+ */
+int fd_pool_acquire(fd_pool_h handle, uint64_t inode, const char* location);
+
+/**
+ * Get the descriptor of a file backing a photo, but only if the file is already open
+ * @param handle a valid handle of a descriptor pool
+ * @param inode the inode of the photo (see inode.h)
+ * @return the descriptor or -1 if the file is not open
+ * @note see the notes of fd_pool_acquire()
+ */
+int fd_pool_acquire_open(fd_pool_h handle, uint64_t inode);
+
+/**
+ * Hand a descriptor of a file backing a photo, opened by the caller, over to the pool. Afterwards
+ * the descriptor is treated as if it has been acquired with fd_pool_acquire().
+ * @param handle a valid handle of a descriptor pool
+ * @param inode the inode of the photo (see inode.h)
+ * @param fd the read-only descriptor of the file backing the photo
+ * @return the descriptor which should be used from now on, which is different from fd (which is then
+ * closed) if the file has been opened concurrently, or -1 on error
+ * @note see the notes of fd_pool_acquire()
+ */
+int fd_pool_adopt(fd_pool_h handle, uint64_t inode, int fd);
+
+/**
+ * Return a descriptor acquired with fd_pool_acquire()
+ * @param handle a valid handle of a descriptor pool
+ * @param inode the inode of the photo passed to fd_pool_acquire()
+ * @param fd the descriptor returned by fd_pool_acquire()
+ * @note this function is thread-safe
+ */
+void fd_pool_release(fd_pool_h handle, uint64_t inode, int fd);
+
+/**
+ * Stop sharing the descriptor of a file backing a photo, e.g. after the photo has been replaced
+ * on the device, so that the file is opened again by the next fd_pool_acquire()
+ * @param handle a valid handle of a descriptor pool
+ * @param inode the inode of the photo (see inode.h)
+ * @note a descriptor which is in use is closed once it's released by all of its current users
+ * @note this function is thread-safe
+ */
+void fd_pool_evict(fd_pool_h handle, uint64_t inode);
+
+/**
+ * Close all the descriptors and free the pool
+ * @param handle a handle of a descriptor pool which should be freed
+ * @warning all the acquired descriptors must be released before the pool is freed
+ */
+void fd_pool_free(fd_pool_h handle);
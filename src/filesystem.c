@@ -1,232 +1,545 @@
 #include "filesystem.h"
 
 #include "path_parser.h"
+#include "session_loop.h"
+#include "attributes.h"
+#include "filesystem_lowlevel.h"
+#include "photo_file.h"
+#include "prefetcher.h"
 #include "logger.h"
 #include "utils.h"
 #include "db.h"
+#include "epoch.h"
 
 #define FUSE_USE_VERSION 29
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <glib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 
-typedef struct filesystem_s
-{
-	GHashTable* devices;         /// lookup table for databases of devices <unique-device-name,database details> [char*,db_h]
-	path_parser_h parser;
-} filesystem_t;
+// the signal on which the catalog is refreshed right away, e.g. after new photos have been taken
+#define REFRESH_SIGNAL SIGUSR1
 
 /**
- * The currently running filesystem instance. This value is stored to be reutilized by fs_* events
- * from fuse. This can be done like that, since we assume that at most one filesystem is running
- * at any moment in time.
+ * A snapshot of the catalog, i.e. of the devices with their albums and photos. A snapshot never
+ * changes once it's published, it's replaced by a new one instead, so that the readers may access
+ * it without any locks or reference counting (see filesystem_enter_catalog()).
  */
-static filesystem_h fs_instance = NULL;
-
-#define DEFAULT_MODE_DIRECTORY S_IFDIR | S_IRUSR | S_IXUSR
-#define DEFAULT_MODE_PHOTO S_IFREG | S_IRUSR
-
-static void getaatr_root(void* user_data)
+typedef struct catalog_s
 {
-	struct stat* stbuf = (struct stat*) user_data;
-	stbuf->st_mode = DEFAULT_MODE_DIRECTORY;
-	stbuf->st_uid = getuid();
-	stbuf->st_gid = getgid();
-}
+	GHashTable* devices;         /// lookup table for databases of devices <unique-device-name,database details> [char*,db_h]
+	unsigned int version;        /// the version of the snapshot, incremented with every new one
+} catalog_t;
 
-static void getaatr_device(const db_h db, void* user_data)
+typedef struct filesystem_s
 {
-	struct stat* stbuf = (struct stat*) user_data;
-	lstat(db_get_root_path(db), stbuf);
-	stbuf->st_mode = DEFAULT_MODE_DIRECTORY;
-}
+	catalog_t* catalog;          /// the current snapshot of the catalog
+	epoch_h epoch;               /// protects the snapshots of the catalog which are being read
+	GMutex catalog_lock;         /// serializes the replacements of the catalog
+	path_parser_h parser;
+	attributes_h attributes;     /// provides the attributes of all nodes of the filesystem
+	io_scheduler_h scheduler;    /// orders the operations performed on the devices
+	photo_file_context_t files;  /// the descriptor pool, block cache etc. through which the photos are read
+	prefetcher_h prefetcher;     /// reads the photos which are likely to be opened next, NULL if it's disabled
+	options_t options;           /// the options with which the filesystem has been created
+	GMutex channel_lock;         /// guards the channel, which is attached and detached by the engine
+	struct fuse_chan* channel;   /// the channel of the running low level session, used for invalidations
+	filesystem_catalog_cb catalog_listener;  /// invoked whenever the catalog is replaced, guarded by catalog_lock
+	void* catalog_listener_data; /// the user data passed to catalog_listener
+	pthread_t refresher;         /// the thread refreshing the catalog while the filesystem is running
+	gint refresher_stop;         /// set when the refresher should exit
+} filesystem_t;
 
-static void getattr_album(const db_h db, const album_h album, void* user_data)
+/**
+ * Retrieve the filesystem instance serving the current FUSE request. The instance is passed
+ * to fuse as the private data of the filesystem, so each request (possibly served by
+ * multiple threads simultaneously) obtains it from its own context.
+ */
+static filesystem_h current_fs(void)
 {
-	struct stat* stbuf = (struct stat*) user_data;
-	lstat(db_get_root_path(db), stbuf);
-	stbuf->st_mode = DEFAULT_MODE_DIRECTORY;
+	return (filesystem_h) fuse_get_context()->private_data;
 }
 
-static void getattr_photo(const db_h device_db, const album_h album, const photo_h photo, void* user_data)
+/**
+ * Get the current snapshot of the catalog, which remains valid until filesystem_leave_catalog()
+ * is called, if it's retrieved within filesystem_enter_catalog()
+ */
+static catalog_t* current_catalog(filesystem_h handle)
 {
-	struct stat* stbuf = (struct stat*) user_data;
-	lstat(photo_get_location(photo), stbuf);
-	stbuf->st_mode = DEFAULT_MODE_PHOTO;
+	return (catalog_t*) g_atomic_pointer_get(&handle->catalog);
 }
 
 static int fs_getattr(const char* path, struct stat* stbuf)
 {
-	ASSERT_RET(fs_instance != NULL, -ENOENT);
+	filesystem_h fs = current_fs();
+	ASSERT_RET(fs != NULL, -ENOENT);
 	ASSERT_RET(path != NULL, -ENOENT);
 
-	if (path_parser_execute(fs_instance->parser, path, (path_parser_cb_t) {
-		.on_root = getaatr_root,
-		.on_device = getaatr_device,
-		.on_album = getattr_album,
-		.on_photo = getattr_photo,
-		.on_root_user_data = stbuf,
-		.on_device_user_data = stbuf,
-		.on_album_user_data = stbuf,
-		.on_photo_user_data = stbuf
-	}))
+	filesystem_enter_catalog(fs);
+
+	path_node_t node;
+	if (!path_parser_resolve(fs->parser, path, &node))
 	{
-		return 0;
+		filesystem_leave_catalog(fs);
+		return -ENOENT;
 	}
 
-	return -ENOENT;
+	switch (node.type)
+	{
+	case PATH_NODE_ROOT:
+		attributes_fill_root(fs->attributes, stbuf);
+		break;
+	case PATH_NODE_DEVICE:
+		attributes_fill_device(fs->attributes, node.device, stbuf);
+		break;
+	case PATH_NODE_ALBUM:
+		attributes_fill_album(fs->attributes, node.device, node.album, stbuf);
+		break;
+	case PATH_NODE_PHOTO:
+		if (!attributes_fill_photo(fs->attributes, node.device, node.album, node.photo, stbuf))
+		{
+			int error = errno;
+			filesystem_leave_catalog(fs);
+			return (error == ENOENT) ? -ENOENT : -EIO;
+		}
+		break;
+	}
+
+	filesystem_leave_catalog(fs);
+	return 0;
 }
 
 typedef struct
 {
+	filesystem_h fs;
+	db_h db;
 	void* buf;
 	fuse_fill_dir_t filler;
+	off_t offset;               /// the offset of the last reported entry, the photos of an album are numbered from 1
 } fuse_readdir_params_t;
 
-static void readdir_root(void* user_data)
+static void readdir_root(fuse_readdir_params_t* params)
 {
-	fuse_readdir_params_t* params = (fuse_readdir_params_t*) user_data;
-
 	GHashTableIter it;
-	gpointer key;
+	gpointer key, value;
 
-	g_hash_table_iter_init(&it, fs_instance->devices);
-	while (g_hash_table_iter_next(&it, &key, NULL))
+	g_hash_table_iter_init(&it, current_catalog(params->fs)->devices);
+	while (g_hash_table_iter_next(&it, &key, &value))
 	{
-		params->filler(params->buf, (const char*) key, NULL, 0);
+		struct stat stbuf = {
+			.st_ino = db_get_inode((db_h) value),
+			.st_mode = S_IFDIR
+		};
+
+		params->filler(params->buf, (const char*) key, &stbuf, 0);
 	}
 }
 
 static bool readdir_device_for_each_album(const db_h handle, const album_h album, void* user_data)
 {
 	fuse_readdir_params_t* params = (fuse_readdir_params_t*) user_data;
-	params->filler(params->buf, album_get_name(album), NULL, 0);
+	struct stat stbuf = {
+		.st_ino = album_get_inode(album),
+		.st_mode = S_IFDIR
+	};
+
+	params->filler(params->buf, album_get_name(album), &stbuf, 0);
 	return true;
 }
 
-static void readdir_device(const db_h db, void* user_data)
+static void readdir_device(const db_h db, fuse_readdir_params_t* params)
 {
-	db_for_each_album(db, readdir_device_for_each_album, user_data);
+	db_for_each_album(db, readdir_device_for_each_album, params);
 }
 
 static bool readdir_album_for_each_photo(const album_h handle, const photo_h photo, void* user_data)
 {
 	fuse_readdir_params_t* params = (fuse_readdir_params_t*) user_data;
-	params->filler(params->buf, photo_get_file_name(photo), NULL, 0);
-	return true;
+
+	struct stat stbuf = { 0 };
+	attributes_fill_photo_cached(params->fs->attributes, params->db, handle, photo, &stbuf);
+
+	// the filler reports a full buffer, the kernel continues from the last offset with the next request
+	params->offset++;
+	return params->filler(params->buf, photo_get_file_name(photo), &stbuf, params->offset) == 0;
 }
 
-static void readdir_album(const db_h db, const album_h album, void* user_data)
+static void readdir_album(const db_h db, const album_h album, fuse_readdir_params_t* params)
 {
-	album_for_each_photo(album, readdir_album_for_each_photo, user_data);
+	params->db = db;
+
+	if (params->offset == 0)
+	{
+		// the listing is likely followed by getattr of each photo, retrieve their attributes in advance
+		attributes_prefetch_album(params->fs->attributes, db, album);
+	}
+
+	// the photos are listed in a stable order, so that the listing resumes at the offset directly
+	// instead of replaying the album from the beginning for each chunk
+	album_for_each_photo_sorted(album, (unsigned int) params->offset, readdir_album_for_each_photo, params);
 }
 
 static int fs_readdir(const char* path, void* buf, fuse_fill_dir_t filler,
 		off_t offset, struct fuse_file_info* fi)
 {
-	ASSERT_RET(fs_instance != NULL, -ENOENT);
+	filesystem_h fs = current_fs();
+	ASSERT_RET(fs != NULL, -ENOENT);
 	ASSERT_RET(path != NULL, -ENOENT);
 
 	fuse_readdir_params_t params = {
+		.fs = fs,
 		.buf = buf,
-		.filler = filler
+		.filler = filler,
+		.offset = offset
 	};
 
-	if (path_parser_execute(fs_instance->parser, path, (path_parser_cb_t) {
-		.on_root = readdir_root,
-		.on_device = readdir_device,
-		.on_album = readdir_album,
-		.on_root_user_data = &params,
-		.on_device_user_data = &params,
-		.on_album_user_data = &params
-	}))
+	filesystem_enter_catalog(fs);
+
+	path_node_t node;
+	if (!path_parser_resolve(fs->parser, path, &node))
 	{
-		return 0;
+		filesystem_leave_catalog(fs);
+		return -ENOENT;
+	}
+
+	int result = 0;
+
+	switch (node.type)
+	{
+	case PATH_NODE_ROOT:
+		readdir_root(&params);
+		break;
+	case PATH_NODE_DEVICE:
+		readdir_device(node.device, &params);
+		break;
+	case PATH_NODE_ALBUM:
+		readdir_album(node.device, node.album, &params);
+		break;
+	case PATH_NODE_PHOTO:
+		result = -ENOTDIR;
+		break;
 	}
 
-	return -ENOENT;
+	filesystem_leave_catalog(fs);
+	return result;
 }
 
-static void open_photo(const db_h device_db, const album_h album, const photo_h photo, void* user_data)
+static int fs_open(const char* path, struct fuse_file_info* fi)
 {
-	struct fuse_file_info* fi = (struct fuse_file_info*) user_data;
+	if ((fi->flags & O_ACCMODE) != O_RDONLY)
+	{
+		return -EACCES;
+	}
 
-	int fd = open(photo_get_location(photo), fi->flags);
+	filesystem_h fs = current_fs();
+	ASSERT_RET(fs != NULL, -ENOENT);
 
-	if (fd != -1)
+	filesystem_enter_catalog(fs);
+
+	path_node_t node;
+	if (!path_parser_resolve(fs->parser, path, &node))
 	{
-		fi->fh = fd;
+		filesystem_leave_catalog(fs);
+		return -ENOENT;
 	}
-}
 
-static int fs_open(const char* path, struct fuse_file_info* fi)
-{
-	fi->fh = -1;
+	if (node.type != PATH_NODE_PHOTO)
+	{
+		filesystem_leave_catalog(fs);
+		return -EISDIR;
+	}
 
-	path_parser_execute(fs_instance->parser, path, (path_parser_cb_t) {
-		.on_photo = open_photo,
-		.on_photo_user_data = fi
-	});
+	photo_file_h file = photo_file_open(node.photo, &fs->files);
+	int error = errno;
 
-	if (fi->fh != -1)
+	if (file != NULL && fs->prefetcher != NULL)
 	{
-		return 0;
+		prefetcher_notify_open(fs->prefetcher, node.album, node.photo);
 	}
 
-	return -ENOENT;
+	filesystem_leave_catalog(fs);
+
+	if (file == NULL)
+	{
+		return -error;
+	}
+
+	fi->fh = (uintptr_t) file;
+
+	// photos never change in place, so in the immutable mode the kernel can keep serving
+	// them from the page cache instead of dropping it on every open (until their attributes
+	// show a modification, see filesystem_run_engine())
+	fi->keep_cache = fs->options.immutable;
+	fi->direct_io = 0;
+
+	return 0;
 }
 
-static int fs_read(const char* path, char* buf, size_t size, off_t offset,
+static int fs_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset,
 		struct fuse_file_info* fi)
 {
-	int result = pread(fi->fh, buf, size, offset);
+	photo_file_h file = (photo_file_h) (uintptr_t) fi->fh;
+
+	struct fuse_bufvec* src = (struct fuse_bufvec*) malloc(sizeof(struct fuse_bufvec));
+	if (src == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	*src = FUSE_BUFVEC_INIT(size);
+
+	// the photo is spliced into the device, unless the kernel doesn't support it. libfuse reads it
+	// only after this function returns, so unlike the low level engine, the read isn't scheduled.
+	int fd = photo_file_get_direct_fd(file, size, offset);
+	if (fd != -1)
+	{
+		src->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+		src->buf[0].fd = fd;
+		src->buf[0].pos = offset;
+
+		*bufp = src;
+		return 0;
+	}
+
+	// fuse frees the buffer once it's sent
+	src->buf[0].mem = malloc(size);
+	ssize_t result = (src->buf[0].mem != NULL) ? photo_file_read(file, src->buf[0].mem, size, offset) : -1;
+
 	if (result == -1)
 	{
-		return -errno;
+		int error = (src->buf[0].mem != NULL) ? errno : ENOMEM;
+		free(src->buf[0].mem);
+		free(src);
+		return -error;
 	}
 
-	return result;
+	src->buf[0].size = result;
+
+	*bufp = src;
+	return 0;
+}
+
+static void* fs_init(struct fuse_conn_info* conn)
+{
+	session_loop_configure(conn);
+
+	// the value returned here replaces the private data passed to fuse_setup()
+	return current_fs();
 }
 
 static int fs_release(const char* path, struct fuse_file_info* fi)
 {
-	close(fi->fh);
+	photo_file_close((photo_file_h) (uintptr_t) fi->fh);
 	return 0;
 }
 
 static struct fuse_operations fs_impl =
 {
+	.init		= fs_init,
 	.getattr	= fs_getattr,
 	.readdir	= fs_readdir,
 	.open		= fs_open,
-	.read		= fs_read,
+	.read_buf	= fs_read_buf,
 	.release	= fs_release
 };
 
-filesystem_h filesystem_create(void)
+static catalog_t* catalog_create(unsigned int version)
 {
+	catalog_t* catalog = (catalog_t*) calloc(1, sizeof(catalog_t));
+	ASSERT_RET(catalog != NULL, NULL);
+
+	catalog->devices = g_hash_table_new_full(g_str_hash, g_str_equal, free, (GDestroyNotify) db_unref);
+	catalog->version = version;
+
+	return catalog;
+}
+
+static void catalog_free(catalog_t* catalog)
+{
+	if (catalog)
+	{
+		g_hash_table_unref(catalog->devices);
+		free(catalog);
+	}
+}
+
+filesystem_h filesystem_create(const options_t* options)
+{
+	ASSERT_RET(options != NULL, NULL);
+
 	filesystem_h handle = (filesystem_h) calloc(1, sizeof(struct filesystem_s));
 	ASSERT_RET(handle != NULL, NULL);
 
-	handle->devices = g_hash_table_new_full(g_str_hash, g_str_equal, free, (GDestroyNotify) db_unref);
-	handle->parser = path_parser_create(handle);
+	// blocked before any of the modules starts its threads, which inherit the mask, so that the signal
+	// is only ever received by the refresher (see filesystem_refresher())
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, REFRESH_SIGNAL);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	handle->options = *options;
+	g_mutex_init(&handle->channel_lock);
+	handle->catalog = catalog_create(0);
+	handle->epoch = epoch_create();
+	g_mutex_init(&handle->catalog_lock);
+	handle->parser = path_parser_create(handle, options->cache_size);
+	handle->scheduler = io_scheduler_create(options->io_slots);
+	handle->attributes = attributes_create(options->attr_ttl, options->attr_threads, handle->scheduler);
+
+	handle->files.fds = fd_pool_create(options->max_open_files, options->fd_idle_timeout, handle->scheduler);
+	handle->files.readahead = (size_t) options->readahead * 1024 * 1024;
+	handle->files.scheduler = handle->scheduler;
+
+	if (handle->catalog == NULL || handle->epoch == NULL || handle->parser == NULL || handle->scheduler == NULL || handle->attributes == NULL || handle->files.fds == NULL)
+	{
+		filesystem_free(handle);
+		return NULL;
+	}
+
+	if (options->block_cache_size > 0)
+	{
+		char* directory = options->block_cache_dir != NULL ? g_strdup(options->block_cache_dir) :
+				g_build_filename(g_get_user_cache_dir(), "ipa", "blocks", NULL);
+
+		handle->files.cache = block_cache_create(directory, (uint64_t) options->block_cache_size * 1024 * 1024);
+
+		// the filesystem works without the cache as well, only slower
+		if (handle->files.cache == NULL)
+		{
+			LOG_WARN("Unable to open the block cache in %s, photos will not be cached", directory);
+		}
+
+		g_free(directory);
+	}
+
+	// the photos are prefetched into the block cache, so there is no prefetching without it
+	if (handle->files.cache != NULL && options->prefetch_depth > 0)
+	{
+		handle->prefetcher = prefetcher_create(&handle->files, options->prefetch_depth,
+				(uint64_t) options->prefetch_budget * 1024 * 1024);
+	}
 
 	return handle;
 }
 
-void filesystem_run(filesystem_h handle, const char* location)
+/**
+ * The thread refreshing the catalog every options_t::refresh_interval seconds, and whenever the process
+ * receives REFRESH_SIGNAL. Refreshing a catalog which hasn't changed only checks the states of the
+ * photo databases, so it's cheap enough to be done often.
+ */
+static void* filesystem_refresher(void* user_data)
+{
+	filesystem_h handle = (filesystem_h) user_data;
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, REFRESH_SIGNAL);
+
+	struct timespec interval = {
+		.tv_sec = handle->options.refresh_interval
+	};
+
+	while (true)
+	{
+		int result = (interval.tv_sec > 0) ? sigtimedwait(&signals, NULL, &interval) : sigwaitinfo(&signals, NULL);
+
+		if (g_atomic_int_get(&handle->refresher_stop))
+		{
+			break;
+		}
+
+		// EAGAIN means that the interval has passed
+		if (result == -1 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (result == REFRESH_SIGNAL)
+		{
+			LOG_INFO("Refreshing the catalog on request");
+		}
+
+		filesystem_refresh(handle);
+	}
+
+	return NULL;
+}
+
+static void filesystem_run_engine(filesystem_h handle)
+{
+	if (handle->options.engine == ENGINE_INODE)
+	{
+		filesystem_lowlevel_run(handle, &handle->options);
+		return;
+	}
+
+	// the kernel can't be told to forget what it has cached from this engine (see filesystem_invalidate_entry()),
+	// so it must not cache anything for longer than until the next refresh of the catalogs
+	unsigned int timeout = handle->options.kernel_timeout;
+	if (handle->options.refresh_interval > 0 && timeout > handle->options.refresh_interval)
+	{
+		LOG_INFO("Limiting the kernel cache time to the refresh interval (%u seconds)", handle->options.refresh_interval);
+		timeout = handle->options.refresh_interval;
+	}
+
+	// use_ino makes fuse report the inodes assigned by ipa (see inode.h) instead of its own ones, and
+	// auto_inval_data makes the kernel drop the contents it keeps (see fs_open()) once a photo is modified
+	char* mount_options = NULL;
+	if (asprintf(&mount_options, "use_ino,entry_timeout=%u,attr_timeout=%u%s", timeout, timeout,
+			handle->options.immutable ? ",auto_inval_data" : "") == -1)
+	{
+		LOG_ERROR("Unable to allocate the mount options");
+		return;
+	}
+
+	const char* params[] = { "ipa", "-f", "-o", mount_options, handle->options.mount_location };
+
+	char* mountpoint = NULL;
+	int multithreaded = 0;
+	struct fuse* fuse = fuse_setup(sizeof(params) / sizeof(params[0]), (char **) params, &fs_impl,
+			sizeof(fs_impl), &mountpoint, &multithreaded, handle);
+
+	free(mount_options);
+
+	if (fuse == NULL)
+	{
+		LOG_ERROR("Unable to mount the filesystem at %s", handle->options.mount_location);
+		return;
+	}
+
+	session_loop_run(fuse_get_session(fuse), handle->options.worker_threads);
+	fuse_teardown(fuse, mountpoint);
+}
+
+void filesystem_run(filesystem_h handle)
 {
 	ASSERT_RET(handle != NULL);
-	ASSERT_RET(location != NULL);
+	ASSERT_RET(handle->options.mount_location != NULL);
+
+	g_atomic_int_set(&handle->refresher_stop, 0);
+	bool refreshing = (pthread_create(&handle->refresher, NULL, filesystem_refresher, handle) == 0);
+
+	if (!refreshing)
+	{
+		LOG_WARN("Unable to start refreshing the catalog, new photos will appear only after a remount");
+	}
 
-	fs_instance = handle;
+	filesystem_run_engine(handle);
 
-	const char* params[] = { "ipa", "-f", location };
-	fuse_main(sizeof(params) / sizeof(params[0]), (char **) params, &fs_impl, NULL);
+	if (refreshing)
+	{
+		g_atomic_int_set(&handle->refresher_stop, 1);
+		pthread_kill(handle->refresher, REFRESH_SIGNAL);
+		pthread_join(handle->refresher, NULL);
+	}
 }
 
 bool filesystem_add_database(filesystem_h handle, db_h database)
@@ -235,10 +548,30 @@ bool filesystem_add_database(filesystem_h handle, db_h database)
 	ASSERT_RET(database != NULL, false);
 	ASSERT_RET(db_get_device_name(database) != NULL, false);
 
+	g_mutex_lock(&handle->catalog_lock);
+
+	// the devices are added to a copy of the catalog, which then replaces the current one
+	catalog_t* current = handle->catalog;
+	catalog_t* catalog = catalog_create(current->version + 1);
+	if (catalog == NULL)
+	{
+		g_mutex_unlock(&handle->catalog_lock);
+		return false;
+	}
+
+	GHashTableIter it;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&it, current->devices);
+	while (g_hash_table_iter_next(&it, &key, &value))
+	{
+		g_hash_table_insert(catalog->devices, strdup((const char*) key), db_ref((db_h) value));
+	}
+
 	char* device_name = strdup(db_get_device_name(database));
 
 	// guarantee unique name of the device
-	if (g_hash_table_contains(handle->devices, device_name))
+	if (g_hash_table_contains(catalog->devices, device_name))
 	{
 		// attempt subsequent names until a free one is found
 		uint32_t suffix = 1;
@@ -251,8 +584,8 @@ bool filesystem_add_database(filesystem_h handle, db_h database)
 				device_name = NULL;
 			}
 
-			asprintf(&device_name, "%s (%d)", ++suffix);
-			if (!g_hash_table_contains(handle->devices, device_name))
+			asprintf(&device_name, "%s (%d)", db_get_device_name(database), ++suffix);
+			if (!g_hash_table_contains(catalog->devices, device_name))
 			{
 				// a unique name has been found
 				break;
@@ -260,32 +593,313 @@ bool filesystem_add_database(filesystem_h handle, db_h database)
 		}
 	}
 
-	g_hash_table_insert(handle->devices, device_name, database);
+	// the inodes of the devices are derived from a short hash of their uids, which might collide
+	g_hash_table_iter_init(&it, catalog->devices);
+	while (g_hash_table_iter_next(&it, NULL, &value))
+	{
+		if (db_get_inode((db_h) value) == db_get_inode(database))
+		{
+			LOG_WARN("Devices %s and %s share the same inode numbers, some of their files might be confused",
+					db_get_device_name((db_h) value), device_name);
+		}
+	}
+
+	g_hash_table_insert(catalog->devices, device_name, database);
+
+	g_atomic_pointer_set(&handle->catalog, catalog);
+	epoch_retire(handle->epoch, current, (epoch_destroy_cb) catalog_free);
+
+	g_mutex_unlock(&handle->catalog_lock);
+	return true;
+}
+
+// tells the kernel to forget the entries affected by a change of the catalog of a device
+static bool filesystem_invalidate_change(const db_h db, db_change_e change, uint64_t parent_inode, uint64_t inode,
+		const char* name, void* user_data)
+{
+	filesystem_h handle = (filesystem_h) user_data;
+
+	switch (change)
+	{
+	case DB_CHANGE_ALBUM_ADDED:
+	case DB_CHANGE_ALBUM_REMOVED:
+		// the entry (or the cached miss of its name) as well as the listing of the device
+		filesystem_invalidate_entry(handle, parent_inode, name);
+		filesystem_invalidate_inode(handle, parent_inode);
+		break;
+	case DB_CHANGE_PHOTO_ADDED:
+		// the listing of the album is dropped along with the album itself (see DB_CHANGE_ALBUM_MODIFIED)
+		filesystem_invalidate_entry(handle, parent_inode, name);
+		break;
+	case DB_CHANGE_PHOTO_REMOVED:
+		filesystem_invalidate_entry(handle, parent_inode, name);
+		fd_pool_evict(handle->files.fds, inode);
+		break;
+	case DB_CHANGE_ALBUM_MODIFIED:
+		filesystem_invalidate_inode(handle, inode);
+		break;
+	case DB_CHANGE_PHOTO_MODIFIED:
+		// the pooled descriptor may still refer to the file which has been replaced
+		filesystem_invalidate_inode(handle, inode);
+		fd_pool_evict(handle->files.fds, inode);
+		break;
+	}
+
 	return true;
 }
 
+bool filesystem_refresh(filesystem_h handle)
+{
+	ASSERT_RET(handle != NULL, false);
+
+	g_mutex_lock(&handle->catalog_lock);
+
+	catalog_t* current = handle->catalog;
+	catalog_t* catalog = catalog_create(current->version + 1);
+	if (catalog == NULL)
+	{
+		g_mutex_unlock(&handle->catalog_lock);
+		return false;
+	}
+
+	GHashTableIter it;
+	gpointer key, value;
+	bool changed = false;
+
+	g_hash_table_iter_init(&it, current->devices);
+	while (g_hash_table_iter_next(&it, &key, &value))
+	{
+		db_h refreshed = db_refresh((db_h) value);
+
+		// a device which couldn't be refreshed keeps its previous catalog
+		if (refreshed == NULL)
+		{
+			refreshed = db_ref((db_h) value);
+		}
+
+		// the idle albums are evicted along with the refresh, so that the kernel is told to forget their photos
+		db_h evicted = db_evict_albums(refreshed, handle->options.album_idle_timeout);
+		if (evicted != NULL)
+		{
+			db_unref(refreshed);
+			refreshed = evicted;
+		}
+
+		changed = changed || (refreshed != (db_h) value);
+		g_hash_table_insert(catalog->devices, strdup((const char*) key), refreshed);
+	}
+
+	if (!changed)
+	{
+		catalog_free(catalog);
+		g_mutex_unlock(&handle->catalog_lock);
+		return false;
+	}
+
+	g_atomic_pointer_set(&handle->catalog, catalog);
+
+	// the engine replaces whatever it has derived from the previous catalog before the kernel looks again
+	if (handle->catalog_listener != NULL)
+	{
+		handle->catalog_listener(handle, handle->catalog_listener_data);
+	}
+
+	g_hash_table_iter_init(&it, catalog->devices);
+	while (g_hash_table_iter_next(&it, &key, &value))
+	{
+		db_for_each_change((db_h) g_hash_table_lookup(current->devices, key), (db_h) value,
+				filesystem_invalidate_change, handle);
+	}
+
+	epoch_retire(handle->epoch, current, (epoch_destroy_cb) catalog_free);
+
+	LOG_INFO("Refreshed the catalog (version %u)", catalog->version);
+
+	g_mutex_unlock(&handle->catalog_lock);
+	return true;
+}
+
+void filesystem_set_catalog_listener(filesystem_h handle, filesystem_catalog_cb callback, void* user_data)
+{
+	ASSERT_RET(handle != NULL);
+
+	g_mutex_lock(&handle->catalog_lock);
+	handle->catalog_listener = callback;
+	handle->catalog_listener_data = user_data;
+
+	// invoked right away as well, so that no replacement can slip in before the listener is in place
+	if (callback != NULL)
+	{
+		callback(handle, user_data);
+	}
+
+	g_mutex_unlock(&handle->catalog_lock);
+}
+
+void filesystem_retire(filesystem_h handle, void* data, epoch_destroy_cb destroy)
+{
+	ASSERT_RET(handle != NULL);
+	ASSERT_RET(destroy != NULL);
+
+	epoch_retire(handle->epoch, data, destroy);
+}
+
+void filesystem_enter_catalog(filesystem_h handle)
+{
+	ASSERT_RET(handle != NULL);
+	epoch_enter(handle->epoch);
+}
+
+void filesystem_leave_catalog(filesystem_h handle)
+{
+	ASSERT_RET(handle != NULL);
+	epoch_leave(handle->epoch);
+}
+
+unsigned int filesystem_get_catalog_version(filesystem_h handle)
+{
+	ASSERT_RET(handle != NULL, 0);
+	return current_catalog(handle)->version;
+}
+
+db_h filesystem_find_database(filesystem_h handle, const char* fs_name)
+{
+	ASSERT_RET(handle != NULL, NULL);
+	ASSERT_RET(fs_name != NULL, NULL);
+
+	return (db_h) g_hash_table_lookup(current_catalog(handle)->devices, fs_name);
+}
+
 db_h filesystem_get_database_by_fs_name(filesystem_h handle, const char* fs_name)
 {
 	ASSERT_RET(handle != NULL, NULL);
 	ASSERT_RET(fs_name != NULL, NULL);
 
-	db_h db = (db_h) g_hash_table_lookup(handle->devices, fs_name);
+	filesystem_enter_catalog(handle);
 
-	if (db == NULL)
+	db_h db = filesystem_find_database(handle, fs_name);
+	if (db != NULL)
 	{
-		return NULL;
+		db_ref(db);
+	}
+
+	filesystem_leave_catalog(handle);
+	return db;
+}
+
+attributes_h filesystem_get_attributes(const filesystem_h handle)
+{
+	ASSERT_RET(handle != NULL, NULL);
+	return handle->attributes;
+}
+
+const photo_file_context_t* filesystem_get_file_context(const filesystem_h handle)
+{
+	ASSERT_RET(handle != NULL, NULL);
+	return &handle->files;
+}
+
+prefetcher_h filesystem_get_prefetcher(const filesystem_h handle)
+{
+	ASSERT_RET(handle != NULL, NULL);
+	return handle->prefetcher;
+}
+
+bool filesystem_for_each_device(const filesystem_h handle, filesystem_for_each_device_cb callback, void* user_data)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(callback != NULL, false);
+
+	GHashTableIter it;
+	gpointer key, value;
+
+	filesystem_enter_catalog(handle);
+
+	g_hash_table_iter_init(&it, current_catalog(handle)->devices);
+	while (g_hash_table_iter_next(&it, &key, &value))
+	{
+		if (!callback(handle, (const char*) key, (db_h) value, user_data))
+		{
+			break;
+		}
 	}
 
-	return db_ref(db);
+	filesystem_leave_catalog(handle);
+	return true;
+}
+
+void filesystem_set_channel(filesystem_h handle, struct fuse_chan* channel)
+{
+	ASSERT_RET(handle != NULL);
+
+	g_mutex_lock(&handle->channel_lock);
+	handle->channel = channel;
+	g_mutex_unlock(&handle->channel_lock);
+}
+
+bool filesystem_invalidate_entry(filesystem_h handle, uint64_t parent_inode, const char* name)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(name != NULL, false);
+
+	bool result = false;
+
+	g_mutex_lock(&handle->channel_lock);
+	if (handle->channel != NULL)
+	{
+		int error = fuse_lowlevel_notify_inval_entry(handle->channel, parent_inode, name, strlen(name));
+
+		// ENOENT means that the kernel doesn't know about the entry, so there is nothing to forget
+		result = (error == 0 || error == -ENOENT);
+		if (!result)
+		{
+			LOG_WARN("Unable to invalidate entry %s of inode %" PRIu64 ": %s", name, parent_inode, strerror(-error));
+		}
+	}
+	g_mutex_unlock(&handle->channel_lock);
+
+	return result;
+}
+
+bool filesystem_invalidate_inode(filesystem_h handle, uint64_t inode)
+{
+	ASSERT_RET(handle != NULL, false);
+
+	bool result = false;
+
+	g_mutex_lock(&handle->channel_lock);
+	if (handle->channel != NULL)
+	{
+		// the offset 0 and length 0 drop all the cached pages along with the attributes
+		int error = fuse_lowlevel_notify_inval_inode(handle->channel, inode, 0, 0);
+
+		result = (error == 0 || error == -ENOENT);
+		if (!result)
+		{
+			LOG_WARN("Unable to invalidate inode %" PRIu64 ": %s", inode, strerror(-error));
+		}
+	}
+	g_mutex_unlock(&handle->channel_lock);
+
+	return result;
 }
 
 void filesystem_free(filesystem_h handle)
 {
 	if (handle)
 	{
-		g_hash_table_unref(handle->devices);
 		path_parser_free(handle->parser);
+		catalog_free(handle->catalog);
+		epoch_free(handle->epoch);
+		g_mutex_clear(&handle->catalog_lock);
+		attributes_free(handle->attributes);
+		// the prefetcher reads the photos, so it has to be stopped first
+		prefetcher_free(handle->prefetcher);
+		block_cache_free(handle->files.cache);
+		fd_pool_free(handle->files.fds);
+		// everything above performs its I/O through the scheduler
+		io_scheduler_free(handle->scheduler);
+		g_mutex_clear(&handle->channel_lock);
 		free(handle);
-		fs_instance = NULL;
 	}
 }
@@ -1,8 +1,16 @@
 #pragma once
 
 #include "db.h"
+#include "options.h"
+#include "attributes.h"
+#include "photo_file.h"
+#include "prefetcher.h"
+#include "epoch.h"
 
 #include <stdbool.h>
+#include <stdint.h>
+
+struct fuse_chan;
 
 /**
  * A handle representing an instance of a filesystem
@@ -11,21 +19,23 @@ typedef struct filesystem_s* filesystem_h;
 
 /**
  * Create a new instance of the filesystem
+ * @param options the options of the filesystem (the mount location, number of worker threads etc.),
+ * which are copied into the created instance
  * @return a handle to the newly created instance or NULL on error
+ * @note SIGUSR1, on which the catalog is refreshed, is blocked in the calling thread (and hence in all the
+ * threads it starts afterwards), so this function should be called before any other thread is started
  */
-filesystem_h filesystem_create(void);
+filesystem_h filesystem_create(const options_t* options);
 
 /**
  * Run the created filesystem. This function blocks until otherwise interrupted (e.g. ^+C)
  * @param handle a valid handle of a previously created filesystem
- * @param location The location where the filesystem should be mounted
- * @note in current implementation this function must be called at most once
- * at a time. In other words, only a single filesystem might be simultaneously
- * running. This simplifies the communication with the fuse library, and is possible
- * since right now only a single filesystem is expected to be running at any
- * given moment in time.
+ * @note the filesystem is served by options_t::worker_threads threads, so the requests
+ * (getattr, readdir, read etc.) may be processed concurrently. All the databases must
+ * be added with filesystem_add_database() before this function is called. While the
+ * filesystem is running, its catalog is refreshed in the background (see filesystem_refresh()).
  */
-void filesystem_run(filesystem_h handle, const char* location);
+void filesystem_run(filesystem_h handle);
 
 /**
  * Add a database of a device to the filesystem
@@ -34,6 +44,9 @@ void filesystem_run(filesystem_h handle, const char* location);
  * @return true if the database was successfully added or false on error
  * @warning this function takes ownership of database parameter, if you need yourself, you should create
  * a separate reference using db_ref() and unreference it when you no longer need it.
+ * @note the database is added to a copy of the catalog, which then replaces the current one, so that
+ * the requests being served are not disturbed. This function waits until none of them uses the previous
+ * catalog anymore, therefore it must not be called within filesystem_enter_catalog().
  */
 bool filesystem_add_database(filesystem_h handle, db_h database);
 
@@ -52,6 +65,158 @@ bool filesystem_add_database(filesystem_h handle, db_h database);
  */
 db_h filesystem_get_database_by_fs_name(filesystem_h handle, const char* fs_name);
 
+/**
+ * Begin reading the catalog of the filesystem, i.e. its devices with their albums and photos. Until
+ * filesystem_leave_catalog() is called, the snapshot of the catalog which is current at this moment
+ * (and everything borrowed from it) remains valid, even if it's replaced by a newer one in the meantime.
+ *
+ * Entering the catalog is cheap (no locks or shared counters are touched), so it should be preferred
+ * over taking references to the databases, albums and photos merely to look them up.
+ * @param handle a valid handle of a previously created filesystem
+ * @note the calls may be nested, but each of them must be paired with filesystem_leave_catalog()
+ * called from the same thread
+ */
+void filesystem_enter_catalog(filesystem_h handle);
+
+/**
+ * Finish reading the catalog of the filesystem, begun with filesystem_enter_catalog()
+ * @param handle a valid handle of a previously created filesystem
+ */
+void filesystem_leave_catalog(filesystem_h handle);
+
+/**
+ * Find a database of an existing device by its filesystem name (see filesystem_get_database_by_fs_name()),
+ * without taking a reference to it
+ * @param handle a valid handle of a previously created filesystem
+ * @param fs_name the filesystem name of a device retrieved from FUSE
+ * @return a handle of a device database or NULL if no device with such filesystem name exists
+ * @note this function must be called within filesystem_enter_catalog(), and the returned database
+ * may be used only until filesystem_leave_catalog() is called, unless it's explicitly referenced
+ */
+db_h filesystem_find_database(filesystem_h handle, const char* fs_name);
+
+/**
+ * Get the version of the current catalog of the filesystem, which changes whenever it's replaced
+ * @param handle a valid handle of a previously created filesystem
+ * @return the version of the current catalog
+ */
+unsigned int filesystem_get_catalog_version(filesystem_h handle);
+
+/**
+ * Refresh the catalogs of all the devices (see db_refresh()), evict the photos of their idle albums (see
+ * db_evict_albums() and options_t::album_idle_timeout) and, if any of them has changed, replace the
+ * catalog of the filesystem and notify the kernel about the entries which are no longer valid
+ * @param handle a valid handle of a previously created filesystem
+ * @return true if the catalog has been replaced, false if none of the devices has changed or on error
+ * @note while the filesystem is running, the catalog is refreshed periodically (see options_t::refresh_interval)
+ * and whenever the process receives SIGUSR1, so this function rarely needs to be called directly. Like
+ * filesystem_add_database(), it must not be called within filesystem_enter_catalog().
+ */
+bool filesystem_refresh(filesystem_h handle);
+
+/**
+ * A callback invoked whenever the catalog of the filesystem is replaced by filesystem_refresh()
+ * @param handle a handle of the filesystem whose catalog has been replaced
+ * @param user_data user data passed to filesystem_set_catalog_listener()
+ * @note the callback is invoked after the new catalog has been published, but before the previous one is
+ * freed and before the kernel is notified about the changes, so that the engine serving the filesystem can
+ * replace whatever it has derived from the previous catalog (see filesystem_retire())
+ */
+typedef void (*filesystem_catalog_cb)(const filesystem_h handle, void* user_data);
+
+/**
+ * Set (or clear) the callback invoked whenever the catalog of the filesystem is replaced
+ * @param handle a valid handle of a previously created filesystem
+ * @param callback the callback which should be invoked or NULL
+ * @param user_data the user data which should be passed to the callback
+ * @note the callback is also invoked right away (for the current catalog), before this function returns
+ */
+void filesystem_set_catalog_listener(filesystem_h handle, filesystem_catalog_cb callback, void* user_data);
+
+/**
+ * Free data borrowing from a previous catalog of the filesystem, once none of the requests which have
+ * entered the catalog (see filesystem_enter_catalog()) may be accessing it anymore
+ * @param handle a valid handle of a previously created filesystem
+ * @param data the data which should be freed, already unreachable to the requests entering the catalog from now on
+ * @param destroy the function which frees the data
+ * @note this function blocks until the data is freed, and it must not be called within filesystem_enter_catalog()
+ */
+void filesystem_retire(filesystem_h handle, void* data, epoch_destroy_cb destroy);
+
+/**
+ * Get the attributes module providing the attributes of all nodes of the filesystem
+ * @param handle a valid handle of a previously created filesystem
+ * @return the attributes module of the filesystem or NULL on invalid argument
+ */
+attributes_h filesystem_get_attributes(const filesystem_h handle);
+
+/**
+ * Get the facilities (descriptor pool, block cache etc.) through which the photos should be opened
+ * @param handle a valid handle of a previously created filesystem
+ * @return the context which should be passed to photo_file_open() or NULL on invalid argument
+ */
+const photo_file_context_t* filesystem_get_file_context(const filesystem_h handle);
+
+/**
+ * Get the prefetcher of the photos which are likely to be opened next
+ * @param handle a valid handle of a previously created filesystem
+ * @return the prefetcher of the filesystem or NULL if photos are not prefetched
+ */
+prefetcher_h filesystem_get_prefetcher(const filesystem_h handle);
+
+/**
+ * A callback invoked by filesystem_for_each_device() for each device of a filesystem
+ * @param handle a handle of the filesystem to which the device belongs
+ * @param fs_name the filesystem name of the device (see filesystem_get_database_by_fs_name())
+ * @param device_db the database of the device
+ * @param user_data user data passed to filesystem_for_each_device()
+ * @return true if you want to continue invoking this callback for subsequent devices, or false if
+ * you don't care about the remaining devices and filesystem_for_each_device() should be immediately terminated.
+ */
+typedef bool (*filesystem_for_each_device_cb)(const filesystem_h handle, const char* fs_name, const db_h device_db, void* user_data);
+
+/**
+ * This function synchronously calls the passed callback for each device of the filesystem
+ * @param handle a valid handle of a previously created filesystem
+ * @param callback the callback which should be invoked for each device
+ * @param user_data the user data which should be passed to the callback
+ * @return true on success, false if the provided arguments were incorrect
+ */
+bool filesystem_for_each_device(const filesystem_h handle, filesystem_for_each_device_cb callback, void* user_data);
+
+/**
+ * Attach (or detach) the channel of a running low level FUSE session, through which the kernel
+ * is notified about the entries invalidated with filesystem_invalidate_entry() and
+ * filesystem_invalidate_inode().
+ * @param handle a valid handle of a previously created filesystem
+ * @param channel the channel of the session serving the filesystem or NULL once it stops
+ */
+void filesystem_set_channel(filesystem_h handle, struct fuse_chan* channel);
+
+/**
+ * Make the kernel forget a cached directory entry, e.g. when a photo or an album has been removed
+ * or renamed after the catalog of a device has been reloaded.
+ * @param handle a valid handle of a previously created filesystem
+ * @param parent_inode the inode of the directory containing the entry
+ * @param name the name of the entry within that directory
+ * @return true if the kernel has been notified (or the entry wasn't cached), false otherwise
+ * @note the kernel can only be notified when the filesystem is served by the inode engine, the
+ * entries cached by the path engine expire after options_t::kernel_timeout seconds (at most
+ * options_t::refresh_interval seconds, when the catalogs are refreshed periodically)
+ * @warning this function must not be called from within a FUSE request handler
+ */
+bool filesystem_invalidate_entry(filesystem_h handle, uint64_t parent_inode, const char* name);
+
+/**
+ * Make the kernel forget the cached attributes and contents of a node, e.g. when a photo has
+ * been modified after the catalog of a device has been reloaded.
+ * @param handle a valid handle of a previously created filesystem
+ * @param inode the inode of the node
+ * @return true if the kernel has been notified (or the node wasn't cached), false otherwise
+ * @note see the notes of filesystem_invalidate_entry()
+ */
+bool filesystem_invalidate_inode(filesystem_h handle, uint64_t inode);
+
 /**
  * Free the previously created instance of a filesystem
  * @param handle a handle of a filesystem which should be freed
@@ -0,0 +1,1199 @@
+#include "filesystem_lowlevel.h"
+
+#include "session_loop.h"
+#include "attributes.h"
+#include "inode.h"
+#include "photo_file.h"
+#include "async_io.h"
+#include "logger.h"
+#include "utils.h"
+
+#define FUSE_USE_VERSION 29
+
+#include <fuse_lowlevel.h>
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+/**
+ * A type of a node of the filesystem
+ */
+typedef enum
+{
+	NODE_ROOT = 1,  //!< the root directory
+	NODE_DEVICE,    //!< a directory of a device
+	NODE_ALBUM,     //!< a directory of an album
+	NODE_PHOTO      //!< a photo
+} node_type_e;
+
+/**
+ * A single node of the filesystem, addressed by its inode. The node does not hold references to
+ * the entities it points to, they are borrowed from the catalog from which the node has been indexed,
+ * so the node may only be used within filesystem_enter_catalog() (see node_copy() otherwise).
+ */
+typedef struct node_s
+{
+	node_type_e type;
+	uint64_t inode;         /// the inode of this node (also the key in node_table_s::nodes)
+	uint64_t parent;        /// the inode of the directory containing this node
+	db_h device;
+	album_h album;
+	photo_h photo;
+	struct dir_buffer_s* listing;   /// the entries of an album, built on its first opendir, guarded by lowlevel_s::listing_lock
+	unsigned int listing_version;   /// the version of the album (see album_get_version()) from which listing has been built
+} node_t;
+
+/**
+ * The nodes of a catalog. The photos of the lazily loaded albums (see album_create_lazy()) aren't known
+ * until the albums are loaded, so their nodes are added on demand, whenever they're looked up.
+ */
+typedef struct node_table_s
+{
+	GHashTable* nodes;      /// the nodes indexed along with the catalog <inode, node> [uint64_t*, node_t*]
+	GRWLock photos_lock;    /// guards photos
+	GHashTable* photos;     /// the nodes of the photos of the lazily loaded albums <inode, node> [uint64_t*, node_t*]
+} node_table_t;
+
+/**
+ * The state of the low level engine, passed to FUSE as user data of the session
+ */
+typedef struct lowlevel_s
+{
+	filesystem_h fs;
+	node_table_t* nodes;    /// all the nodes of the filesystem, replaced along with the catalog
+	double timeout;         /// the time (in seconds) for which the kernel may cache the entries and their attributes
+	bool keep_cache;        /// whether the kernel may keep the contents of the photos cached across opens
+	async_io_h io;          /// the asynchronous I/O engine, or NULL if the I/O is synchronous
+	GMutex listing_lock;    /// guards the listings of the albums (see node_s::listing)
+} lowlevel_t;
+
+/**
+ * A buffer of directory entries, prepared on opendir and sliced by subsequent readdir requests.
+ * The buffers of albums are shared by all the opens of the album, for as long as it's not modified.
+ */
+typedef struct dir_buffer_s
+{
+	char* data;
+	size_t size;
+	size_t capacity;
+	bool failed;            /// whether an entry couldn't be added, in which case the buffer is incomplete
+	gint ref_count;         /// reference counter, held by the node and by each open of the directory
+} dir_buffer_t;
+
+static node_t* node_add(GHashTable* nodes, node_type_e type, uint64_t inode, uint64_t parent,
+		db_h device, album_h album, photo_h photo)
+{
+	node_t* node = (node_t*) calloc(1, sizeof(node_t));
+	ASSERT_RET(node != NULL, NULL);
+
+	node->type = type;
+	node->inode = inode;
+	node->parent = parent;
+	node->device = device;
+	node->album = album;
+	node->photo = photo;
+
+#ifdef ENABLE_DEBUG_ENVIRONMENT
+	if (g_hash_table_contains(nodes, &node->inode))
+	{
+		LOG_WARN("Inode %" PRIu64 " has already been assigned, overwriting the previous node!", inode);
+	}
+#endif
+
+	g_hash_table_insert(nodes, &node->inode, node);
+	return node;
+}
+
+// gets the nodes of the current catalog, must be called within filesystem_enter_catalog()
+static node_table_t* node_table_current(lowlevel_t* ll)
+{
+	return (node_table_t*) g_atomic_pointer_get(&ll->nodes);
+}
+
+// finds a node within a table of the current (or a recently replaced) catalog
+static node_t* node_get(node_table_t* table, uint64_t inode)
+{
+	node_t* node = (node_t*) g_hash_table_lookup(table->nodes, &inode);
+
+	if (node == NULL)
+	{
+		g_rw_lock_reader_lock(&table->photos_lock);
+		node = (node_t*) g_hash_table_lookup(table->photos, &inode);
+		g_rw_lock_reader_unlock(&table->photos_lock);
+	}
+
+	return node;
+}
+
+/**
+ * Add the node of a photo of a lazily loaded album, which couldn't be indexed along with the catalog
+ * @param table the table in which the album has been found, from whose catalog the photo comes as well
+ */
+static node_t* node_add_photo(node_table_t* table, const node_t* album, photo_h photo)
+{
+	uint64_t inode = photo_get_inode(photo);
+
+	g_rw_lock_writer_lock(&table->photos_lock);
+
+	// the photo might have been looked up by another request in the meantime
+	node_t* node = (node_t*) g_hash_table_lookup(table->photos, &inode);
+	if (node == NULL)
+	{
+		node = node_add(table->photos, NODE_PHOTO, inode, album->inode, album->device, album->album, photo);
+	}
+
+	g_rw_lock_writer_unlock(&table->photos_lock);
+	return node;
+}
+
+/**
+ * Copy a node for a request which is replied after leaving the catalog, referencing the entities
+ * it points to, as the node itself might be freed in the meantime
+ */
+static void node_copy(node_t* copy, const node_t* node)
+{
+	*copy = *node;
+	copy->listing = NULL;
+
+	if (copy->device != NULL)
+	{
+		db_ref(copy->device);
+	}
+
+	if (copy->album != NULL)
+	{
+		album_ref(copy->album);
+	}
+
+	if (copy->photo != NULL)
+	{
+		photo_ref(copy->photo);
+	}
+}
+
+// releases the references taken by node_copy()
+static void node_clear(node_t* copy)
+{
+	if (copy->photo != NULL)
+	{
+		photo_unref(copy->photo);
+	}
+
+	if (copy->album != NULL)
+	{
+		album_unref(copy->album);
+	}
+
+	if (copy->device != NULL)
+	{
+		db_unref(copy->device);
+	}
+}
+
+// returns 0 on success, or the error the request should be replied with
+static int node_fill_stat(lowlevel_t* ll, const node_t* node, struct stat* stbuf)
+{
+	attributes_h attributes = filesystem_get_attributes(ll->fs);
+	memset(stbuf, 0, sizeof(struct stat));
+
+	switch (node->type)
+	{
+	case NODE_ROOT:
+		attributes_fill_root(attributes, stbuf);
+		break;
+	case NODE_DEVICE:
+		attributes_fill_device(attributes, node->device, stbuf);
+		break;
+	case NODE_ALBUM:
+		attributes_fill_album(attributes, node->device, node->album, stbuf);
+		break;
+	case NODE_PHOTO:
+		if (!attributes_fill_photo(attributes, node->device, node->album, node->photo, stbuf))
+		{
+			return (errno == ENOENT) ? ENOENT : EIO;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+// building the lookup table of all nodes
+
+typedef struct
+{
+	lowlevel_t* ll;
+	GHashTable* nodes;      /// the table being built
+	GHashTable* previous;   /// the nodes indexed along with the previous catalog, or NULL
+	db_h device;
+} node_index_params_t;
+
+static bool node_index_photo(const album_h album, const photo_h photo, void* user_data)
+{
+	node_index_params_t* params = (node_index_params_t*) user_data;
+
+	// a photo belonging to multiple albums is a single node, reached from the first album indexed
+	uint64_t inode = photo_get_inode(photo);
+	if (g_hash_table_contains(params->nodes, &inode))
+	{
+		return true;
+	}
+
+	node_add(params->nodes, NODE_PHOTO, photo_get_inode(photo), album_get_inode(album), params->device, album, photo);
+	return true;
+}
+
+static bool node_index_album(const db_h device_db, const album_h album, void* user_data)
+{
+	node_index_params_t* params = (node_index_params_t*) user_data;
+	node_t* node = node_add(params->nodes, NODE_ALBUM, album_get_inode(album), db_get_inode(device_db), device_db, album, NULL);
+
+	// the albums which haven't changed are shared by the catalogs, and so are their listings
+	node_t* previous = (params->previous != NULL) ?
+			(node_t*) g_hash_table_lookup(params->previous, &node->inode) : NULL;
+
+	if (node != NULL && previous != NULL && previous->album == album)
+	{
+		g_mutex_lock(&params->ll->listing_lock);
+		if (previous->listing != NULL)
+		{
+			g_atomic_int_inc(&previous->listing->ref_count);
+			node->listing = previous->listing;
+			node->listing_version = previous->listing_version;
+		}
+		g_mutex_unlock(&params->ll->listing_lock);
+	}
+
+	// the photos of a lazily loaded album are added once they're looked up (see node_add_photo())
+	if (album_is_loaded(album))
+	{
+		album_for_each_photo(album, node_index_photo, params);
+	}
+
+	return true;
+}
+
+static bool node_index_device(const filesystem_h fs, const char* fs_name, const db_h device_db, void* user_data)
+{
+	node_index_params_t params = *(node_index_params_t*) user_data;
+	params.device = device_db;
+
+	node_add(params.nodes, NODE_DEVICE, db_get_inode(device_db), INODE_ROOT, device_db, NULL, NULL);
+	db_for_each_album(device_db, node_index_album, &params);
+	return true;
+}
+
+/**
+ * Find the node with the given name within the parent directory
+ * @param table the table in which the parent has been found
+ * @note this function must be called within filesystem_enter_catalog()
+ */
+static node_t* node_lookup_child(lowlevel_t* ll, node_table_t* table, const node_t* parent, const char* name)
+{
+	uint64_t inode = 0;
+
+	switch (parent->type)
+	{
+	case NODE_ROOT:
+	{
+		db_h db = filesystem_find_database(ll->fs, name);
+		if (db != NULL)
+		{
+			inode = db_get_inode(db);
+		}
+		break;
+	}
+	case NODE_DEVICE:
+	{
+		album_h album = db_find_album(parent->device, name);
+		if (album != NULL)
+		{
+			inode = album_get_inode(album);
+		}
+		break;
+	}
+	case NODE_ALBUM:
+	{
+		photo_h photo = album_find_photo(parent->album, name);
+		if (photo != NULL)
+		{
+			node_t* node = node_get(table, photo_get_inode(photo));
+			return (node != NULL) ? node : node_add_photo(table, parent, photo);
+		}
+		break;
+	}
+	case NODE_PHOTO:
+		break;
+	}
+
+	return inode != 0 ? node_get(table, inode) : NULL;
+}
+
+// directory buffers
+
+// returns false if the entry couldn't be added, after which the buffer is marked as failed
+static bool dir_buffer_add(fuse_req_t req, dir_buffer_t* buffer, const char* name, const struct stat* stbuf)
+{
+	size_t entry_size = fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+
+	if (buffer->size + entry_size > buffer->capacity)
+	{
+		size_t capacity = MAX(buffer->capacity * 2, buffer->size + entry_size);
+
+		char* data = (char*) realloc(buffer->data, capacity);
+		if (data == NULL)
+		{
+			buffer->failed = true;
+			return false;
+		}
+
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+
+	// the offset of an entry is the position of the entry following it
+	fuse_add_direntry(req, buffer->data + buffer->size, entry_size, name, stbuf, buffer->size + entry_size);
+	buffer->size += entry_size;
+
+	return true;
+}
+
+typedef struct
+{
+	fuse_req_t req;
+	dir_buffer_t* buffer;
+	attributes_h attributes;
+	db_h device;
+} dir_buffer_params_t;
+
+static bool dir_buffer_add_directory(fuse_req_t req, dir_buffer_t* buffer, const char* name, uint64_t inode)
+{
+	struct stat stbuf = {
+		.st_ino = inode,
+		.st_mode = S_IFDIR
+	};
+
+	return dir_buffer_add(req, buffer, name, &stbuf);
+}
+
+static bool dir_buffer_add_device(const filesystem_h fs, const char* fs_name, const db_h device_db, void* user_data)
+{
+	dir_buffer_params_t* params = (dir_buffer_params_t*) user_data;
+	return dir_buffer_add_directory(params->req, params->buffer, fs_name, db_get_inode(device_db));
+}
+
+static bool dir_buffer_add_album(const db_h device_db, const album_h album, void* user_data)
+{
+	dir_buffer_params_t* params = (dir_buffer_params_t*) user_data;
+	return dir_buffer_add_directory(params->req, params->buffer, album_get_name(album), album_get_inode(album));
+}
+
+static bool dir_buffer_add_photo(const album_h album, const photo_h photo, void* user_data)
+{
+	dir_buffer_params_t* params = (dir_buffer_params_t*) user_data;
+
+	struct stat stbuf = { 0 };
+	attributes_fill_photo_cached(params->attributes, params->device, album, photo, &stbuf);
+
+	return dir_buffer_add(params->req, params->buffer, photo_get_file_name(photo), &stbuf);
+}
+
+static void dir_buffer_unref(dir_buffer_t* buffer)
+{
+	if (buffer && g_atomic_int_dec_and_test(&buffer->ref_count))
+	{
+		free(buffer->data);
+		free(buffer);
+	}
+}
+
+static dir_buffer_t* dir_buffer_build(lowlevel_t* ll, fuse_req_t req, const node_t* node)
+{
+	dir_buffer_t* buffer = (dir_buffer_t*) calloc(1, sizeof(dir_buffer_t));
+	ASSERT_RET(buffer != NULL, NULL);
+
+	buffer->ref_count = 1;
+
+	dir_buffer_add_directory(req, buffer, ".", node->inode);
+	dir_buffer_add_directory(req, buffer, "..", node->parent);
+
+	dir_buffer_params_t params = {
+		.req = req,
+		.buffer = buffer,
+		.attributes = filesystem_get_attributes(ll->fs),
+		.device = node->device
+	};
+
+	switch (node->type)
+	{
+	case NODE_ROOT:
+		filesystem_for_each_device(ll->fs, dir_buffer_add_device, &params);
+		break;
+	case NODE_DEVICE:
+		db_for_each_album(node->device, dir_buffer_add_album, &params);
+		break;
+	case NODE_ALBUM:
+		// sorted, so that the listing doesn't depend on the order of the photo database
+		album_for_each_photo_sorted(node->album, 0, dir_buffer_add_photo, &params);
+		break;
+	case NODE_PHOTO:
+		break;
+	}
+
+	// the listing is replied with ENOMEM rather than truncated
+	if (buffer->failed)
+	{
+		dir_buffer_unref(buffer);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/**
+ * Get the entries of an album, built only once for each version of the album, as the listing of
+ * a large album is much more expensive than slicing a prepared buffer by subsequent readdir requests
+ * @return a new reference to the buffer, or NULL on error
+ */
+static dir_buffer_t* node_get_listing(lowlevel_t* ll, fuse_req_t req, node_t* node)
+{
+	g_mutex_lock(&ll->listing_lock);
+
+	if (node->listing == NULL || node->listing_version != album_get_version(node->album))
+	{
+		dir_buffer_unref(node->listing);
+		node->listing = dir_buffer_build(ll, req, node);
+
+		// only after the listing, which loads the photos of a lazily loaded album (changing its version)
+		node->listing_version = album_get_version(node->album);
+	}
+
+	dir_buffer_t* buffer = node->listing;
+	if (buffer != NULL)
+	{
+		g_atomic_int_inc(&buffer->ref_count);
+	}
+
+	g_mutex_unlock(&ll->listing_lock);
+	return buffer;
+}
+
+static void node_free(node_t* node)
+{
+	if (node)
+	{
+		dir_buffer_unref(node->listing);
+		free(node);
+	}
+}
+
+static void node_table_free(node_table_t* table)
+{
+	if (table)
+	{
+		g_hash_table_unref(table->photos);
+		g_hash_table_unref(table->nodes);
+		g_rw_lock_clear(&table->photos_lock);
+		free(table);
+	}
+}
+
+/**
+ * Index the nodes of the current catalog, whenever it's replaced (see filesystem_set_catalog_listener()).
+ * The requests keep finding their nodes in the previous table until the new one is published, after
+ * which the previous table is freed once none of them is using it anymore.
+ */
+static void node_index(const filesystem_h fs, void* user_data)
+{
+	lowlevel_t* ll = (lowlevel_t*) user_data;
+	node_table_t* previous = (node_table_t*) g_atomic_pointer_get(&ll->nodes);
+
+	node_table_t* table = (node_table_t*) calloc(1, sizeof(node_table_t));
+	ASSERT_RET(table != NULL);
+
+	table->nodes = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, (GDestroyNotify) node_free);
+	table->photos = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, (GDestroyNotify) node_free);
+	g_rw_lock_init(&table->photos_lock);
+
+	node_index_params_t params = {
+		.ll = ll,
+		.nodes = table->nodes,
+		.previous = (previous != NULL) ? previous->nodes : NULL
+	};
+
+	node_add(params.nodes, NODE_ROOT, INODE_ROOT, INODE_ROOT, NULL, NULL, NULL);
+	filesystem_for_each_device(fs, node_index_device, &params);
+
+	LOG_DEBUG("Indexed %u filesystem nodes", g_hash_table_size(params.nodes));
+
+	g_atomic_pointer_set(&ll->nodes, table);
+
+	if (previous != NULL)
+	{
+		filesystem_retire(fs, previous, (epoch_destroy_cb) node_table_free);
+	}
+}
+
+// low level FUSE operations
+
+// the generation of a node, which tells the photos apart if the primary key of an asset is ever reused
+static uint32_t node_generation(const node_t* node)
+{
+	if (node->type != NODE_PHOTO)
+	{
+		return 0;
+	}
+
+	// the creation date comes from the photo database, so it's the same whenever the asset is seen
+	struct stat stbuf;
+	int64_t created = photo_get_stat(node->photo, &stbuf) ? (int64_t) stbuf.st_ctime : 0;
+
+	return inode_generation_for_photo(node->inode, created);
+}
+
+static void reply_entry(lowlevel_t* ll, fuse_req_t req, const node_t* node, const struct stat* stbuf)
+{
+	struct fuse_entry_param entry = {
+		.ino = node->inode,
+		.generation = node_generation(node),
+		.attr = *stbuf,
+		.attr_timeout = ll->timeout,
+		.entry_timeout = ll->timeout
+	};
+
+	fuse_reply_entry(req, &entry);
+}
+
+/**
+ * A lookup or getattr request waiting for the attributes of a photo to be retrieved asynchronously
+ */
+typedef struct stat_request_s
+{
+	fuse_req_t req;
+	lowlevel_t* ll;
+	node_t node;                /// a copy of the node, see node_copy()
+	bool entry;                 /// whether the request should be replied with an entry (lookup) or attributes (getattr)
+	struct stat attributes;     /// filled by the asynchronous I/O engine
+} stat_request_t;
+
+static void on_photo_stat(int result, void* user_data)
+{
+	stat_request_t* request = (stat_request_t*) user_data;
+	io_scheduler_end(filesystem_get_file_context(request->ll->fs)->scheduler, IO_CLASS_METADATA,
+			inode_get_device(request->node.inode));
+
+	if (result < 0)
+	{
+		fuse_reply_err(request->req, -result);
+	}
+	else
+	{
+		attributes_store_photo(filesystem_get_attributes(request->ll->fs), request->node.photo, &request->attributes);
+
+		if (request->entry)
+		{
+			reply_entry(request->ll, request->req, &request->node, &request->attributes);
+		}
+		else
+		{
+			fuse_reply_attr(request->req, &request->attributes, request->ll->timeout);
+		}
+	}
+
+	node_clear(&request->node);
+	free(request);
+}
+
+static void on_stat_granted(void* user_data)
+{
+	stat_request_t* request = (stat_request_t*) user_data;
+	const char* location = photo_get_location(request->node.photo);
+
+	if (!async_io_stat(request->ll->io, location, &request->attributes, on_photo_stat, request))
+	{
+		// the slot has already been granted, so the attributes are retrieved right away
+		on_photo_stat((lstat(location, &request->attributes) == 0) ? 0 : -errno, request);
+	}
+}
+
+// returns true if the reply has been deferred until the attributes of the photo are retrieved
+static bool node_stat_async(lowlevel_t* ll, fuse_req_t req, const node_t* node, bool entry)
+{
+	if (ll->io == NULL || node->type != NODE_PHOTO)
+	{
+		return false;
+	}
+
+	struct stat stbuf;
+	if (attributes_fill_photo_cached(filesystem_get_attributes(ll->fs), node->device, node->album, node->photo, &stbuf))
+	{
+		return false;
+	}
+
+	stat_request_t* request = (stat_request_t*) calloc(1, sizeof(stat_request_t));
+	if (request == NULL)
+	{
+		return false;
+	}
+
+	request->req = req;
+	request->ll = ll;
+	request->entry = entry;
+	node_copy(&request->node, node);
+
+	// the slot is taken until the operation completes, the same as for the synchronous I/O, but
+	// the worker thread doesn't wait for it
+	io_scheduler_begin_async(filesystem_get_file_context(ll->fs)->scheduler, IO_CLASS_METADATA,
+			inode_get_device(node->inode), on_stat_granted, request);
+
+	return true;
+}
+
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
+{
+	lowlevel_t* ll = (lowlevel_t*) fuse_req_userdata(req);
+
+	filesystem_enter_catalog(ll->fs);
+
+	node_table_t* table = node_table_current(ll);
+	node_t* parent_node = node_get(table, parent);
+	node_t* node = (parent_node != NULL) ? node_lookup_child(ll, table, parent_node, name) : NULL;
+
+	if (parent_node == NULL)
+	{
+		fuse_reply_err(req, ENOENT);
+	}
+	else if (node == NULL)
+	{
+		// an entry with no inode lets the kernel cache the miss, so that the names probed over and
+		// over by file managers (e.g. .DS_Store) aren't looked up again until the entry expires
+		struct fuse_entry_param entry = {
+			.ino = 0,
+			.entry_timeout = ll->timeout
+		};
+
+		fuse_reply_entry(req, &entry);
+	}
+	else if (!node_stat_async(ll, req, node, true))
+	{
+		struct stat stbuf;
+		int error = node_fill_stat(ll, node, &stbuf);
+
+		if (error != 0)
+		{
+			fuse_reply_err(req, error);
+		}
+		else
+		{
+			reply_entry(ll, req, node, &stbuf);
+		}
+	}
+
+	filesystem_leave_catalog(ll->fs);
+}
+
+static void ll_init(void* userdata, struct fuse_conn_info* conn)
+{
+	session_loop_configure(conn);
+}
+
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	// the nodes are replaced as a whole along with the catalog, so there is nothing to forget
+	fuse_reply_none(req);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	lowlevel_t* ll = (lowlevel_t*) fuse_req_userdata(req);
+
+	filesystem_enter_catalog(ll->fs);
+
+	node_t* node = node_get(node_table_current(ll), ino);
+	if (node == NULL)
+	{
+		fuse_reply_err(req, ENOENT);
+	}
+	else if (!node_stat_async(ll, req, node, false))
+	{
+		struct stat stbuf;
+		int error = node_fill_stat(ll, node, &stbuf);
+
+		if (error != 0)
+		{
+			fuse_reply_err(req, error);
+		}
+		else
+		{
+			fuse_reply_attr(req, &stbuf, ll->timeout);
+		}
+	}
+
+	filesystem_leave_catalog(ll->fs);
+}
+
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	lowlevel_t* ll = (lowlevel_t*) fuse_req_userdata(req);
+
+	filesystem_enter_catalog(ll->fs);
+
+	node_t* node = node_get(node_table_current(ll), ino);
+	dir_buffer_t* buffer = NULL;
+	int error = 0;
+
+	if (node == NULL)
+	{
+		error = ENOENT;
+	}
+	else if (node->type == NODE_PHOTO)
+	{
+		error = ENOTDIR;
+	}
+	else if (node->type == NODE_ALBUM)
+	{
+		// the listing is likely followed by lookups of each photo, retrieve their attributes in advance
+		attributes_prefetch_album(filesystem_get_attributes(ll->fs), node->device, node->album);
+		buffer = node_get_listing(ll, req, node);
+	}
+	else
+	{
+		buffer = dir_buffer_build(ll, req, node);
+	}
+
+	// the buffer holds copies of the entries, so it doesn't depend on the catalog
+	filesystem_leave_catalog(ll->fs);
+
+	if (error == 0 && buffer == NULL)
+	{
+		error = ENOMEM;
+	}
+
+	if (error != 0)
+	{
+		fuse_reply_err(req, error);
+		return;
+	}
+
+	fi->fh = (uint64_t) (uintptr_t) buffer;
+
+	if (fuse_reply_open(req, fi) != 0)
+	{
+		// the request has been interrupted, releasedir won't be called
+		dir_buffer_unref(buffer);
+	}
+}
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info* fi)
+{
+	dir_buffer_t* buffer = (dir_buffer_t*) (uintptr_t) fi->fh;
+
+	if (off < 0 || (size_t) off >= buffer->size)
+	{
+		fuse_reply_buf(req, NULL, 0);
+		return;
+	}
+
+	fuse_reply_buf(req, buffer->data + off, MIN(buffer->size - off, size));
+}
+
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	dir_buffer_unref((dir_buffer_t*) (uintptr_t) fi->fh);
+	fuse_reply_err(req, 0);
+}
+
+static void reply_open(lowlevel_t* ll, fuse_req_t req, const node_t* node, struct fuse_file_info* fi)
+{
+	photo_file_h file = photo_file_open(node->photo, filesystem_get_file_context(ll->fs));
+	if (file == NULL)
+	{
+		fuse_reply_err(req, errno);
+		return;
+	}
+
+	fi->fh = (uintptr_t) file;
+	fi->keep_cache = ll->keep_cache;
+	fi->direct_io = 0;
+
+	prefetcher_h prefetcher = filesystem_get_prefetcher(ll->fs);
+	if (prefetcher != NULL)
+	{
+		prefetcher_notify_open(prefetcher, node->album, node->photo);
+	}
+
+	if (fuse_reply_open(req, fi) != 0)
+	{
+		// the request has been interrupted, release won't be called
+		photo_file_close(file);
+	}
+}
+
+/**
+ * An open request waiting for the file backing a photo to be opened asynchronously
+ */
+typedef struct open_request_s
+{
+	fuse_req_t req;
+	lowlevel_t* ll;
+	node_t node;                /// a copy of the node, see node_copy()
+	struct fuse_file_info fi;   /// a copy of the file info, which doesn't outlive ll_open()
+} open_request_t;
+
+static void on_photo_open(int result, void* user_data)
+{
+	open_request_t* request = (open_request_t*) user_data;
+	io_scheduler_end(filesystem_get_file_context(request->ll->fs)->scheduler, IO_CLASS_METADATA,
+			inode_get_device(request->node.inode));
+
+	if (result < 0)
+	{
+		fuse_reply_err(request->req, -result);
+	}
+	else
+	{
+		// once the descriptor is in the pool, photo_file_open() acquires it without blocking
+		fd_pool_h fds = filesystem_get_file_context(request->ll->fs)->fds;
+		uint64_t inode = photo_get_inode(request->node.photo);
+
+		int fd = fd_pool_adopt(fds, inode, result);
+		if (fd == -1)
+		{
+			fuse_reply_err(request->req, errno);
+		}
+		else
+		{
+			reply_open(request->ll, request->req, &request->node, &request->fi);
+			fd_pool_release(fds, inode, fd);
+		}
+	}
+
+	node_clear(&request->node);
+	free(request);
+}
+
+static void on_open_granted(void* user_data)
+{
+	open_request_t* request = (open_request_t*) user_data;
+	const char* location = photo_get_location(request->node.photo);
+
+	if (!async_io_open(request->ll->io, location, on_photo_open, request))
+	{
+		// the slot has already been granted, so the file is opened right away
+		int fd = open(location, O_RDONLY);
+		on_photo_open((fd != -1) ? fd : -errno, request);
+	}
+}
+
+// returns true if the request has been replied (possibly deferred until the file backing the photo is opened)
+static bool node_open_async(lowlevel_t* ll, fuse_req_t req, const node_t* node, struct fuse_file_info* fi)
+{
+	if (ll->io == NULL)
+	{
+		return false;
+	}
+
+	// the backing file is not needed to open a photo served from the block cache (see photo_file_open())
+	const photo_file_context_t* context = filesystem_get_file_context(ll->fs);
+	struct stat stbuf;
+
+	if (context->cache != NULL && photo_get_stat(node->photo, &stbuf))
+	{
+		return false;
+	}
+
+	int fd = fd_pool_acquire_open(context->fds, photo_get_inode(node->photo));
+	if (fd != -1)
+	{
+		// already open, just make sure it isn't closed in the meantime
+		reply_open(ll, req, node, fi);
+		fd_pool_release(context->fds, photo_get_inode(node->photo), fd);
+		return true;
+	}
+
+	open_request_t* request = (open_request_t*) calloc(1, sizeof(open_request_t));
+	if (request == NULL)
+	{
+		return false;
+	}
+
+	request->req = req;
+	request->ll = ll;
+	request->fi = *fi;
+	node_copy(&request->node, node);
+
+	io_scheduler_begin_async(context->scheduler, IO_CLASS_METADATA, inode_get_device(node->inode),
+			on_open_granted, request);
+
+	return true;
+}
+
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	lowlevel_t* ll = (lowlevel_t*) fuse_req_userdata(req);
+
+	filesystem_enter_catalog(ll->fs);
+
+	node_t* node = node_get(node_table_current(ll), ino);
+	if (node == NULL)
+	{
+		fuse_reply_err(req, ENOENT);
+	}
+	else if (node->type != NODE_PHOTO)
+	{
+		fuse_reply_err(req, EISDIR);
+	}
+	else if ((fi->flags & O_ACCMODE) != O_RDONLY)
+	{
+		fuse_reply_err(req, EACCES);
+	}
+	else if (!node_open_async(ll, req, node, fi))
+	{
+		reply_open(ll, req, node, fi);
+	}
+
+	filesystem_leave_catalog(ll->fs);
+}
+
+/**
+ * A read request waiting for the data to be read asynchronously
+ */
+typedef struct read_request_s
+{
+	fuse_req_t req;
+	lowlevel_t* ll;
+	io_scheduler_h scheduler;   /// the scheduler whose slot is taken until the data is read
+	uint64_t device;            /// the device whose slot is taken
+	int fd;                     /// the descriptor of the file backing the photo
+	size_t size;
+	off_t offset;
+	char data[];                /// filled by the asynchronous I/O engine
+} read_request_t;
+
+static void on_photo_read(int result, void* user_data)
+{
+	read_request_t* request = (read_request_t*) user_data;
+	io_scheduler_end(request->scheduler, IO_CLASS_INTERACTIVE, request->device);
+
+	if (result < 0)
+	{
+		fuse_reply_err(request->req, -result);
+	}
+	else
+	{
+		fuse_reply_buf(request->req, request->data, result);
+	}
+
+	free(request);
+}
+
+static void on_read_granted(void* user_data)
+{
+	read_request_t* request = (read_request_t*) user_data;
+
+	if (async_io_read(request->ll->io, request->fd, request->data, request->size, request->offset, on_photo_read, request))
+	{
+		return;
+	}
+
+	// the slot has already been granted, so the data is read right away
+	size_t done = 0;
+	while (done < request->size)
+	{
+		ssize_t result = pread(request->fd, request->data + done, request->size - done, request->offset + done);
+		if (result == -1 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (result <= 0)
+		{
+			// report the error only if nothing could be read
+			if (result == -1 && done == 0)
+			{
+				on_photo_read(-errno, request);
+				return;
+			}
+
+			break;
+		}
+
+		done += result;
+	}
+
+	on_photo_read(done, request);
+}
+
+// the size from which the reads of the photos are spliced rather than performed asynchronously
+#define SPLICE_MIN_SIZE (64 * 1024)
+
+// returns true if the reply has been deferred until the data is read
+static bool read_async(lowlevel_t* ll, fuse_req_t req, fuse_ino_t ino, int fd, size_t size, off_t off)
+{
+	if (ll->io == NULL)
+	{
+		return false;
+	}
+
+	read_request_t* request = (read_request_t*) malloc(sizeof(read_request_t) + size);
+	if (request == NULL)
+	{
+		return false;
+	}
+
+	request->req = req;
+	request->ll = ll;
+	request->scheduler = filesystem_get_file_context(ll->fs)->scheduler;
+	request->device = inode_get_device(ino);
+	request->fd = fd;
+	request->size = size;
+	request->offset = off;
+
+	io_scheduler_begin_async(request->scheduler, IO_CLASS_INTERACTIVE, request->device, on_read_granted, request);
+	return true;
+}
+
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info* fi)
+{
+	lowlevel_t* ll = (lowlevel_t*) fuse_req_userdata(req);
+	photo_file_h file = (photo_file_h) (uintptr_t) fi->fh;
+
+	// the large reads, e.g. the sequential ones issued by the kernel readahead, save the most by being
+	// spliced, while the small ones rather gain from not holding up the worker thread
+	int fd = photo_file_get_direct_fd(file, size, off);
+	if (fd != -1 && size < SPLICE_MIN_SIZE && read_async(ll, req, ino, fd, size, off))
+	{
+		// with the asynchronous I/O the data is copied through a buffer, but the worker thread
+		// doesn't wait for the device and many reads can be in flight at the same time
+		return;
+	}
+
+	if (fd != -1)
+	{
+		// the data is spliced from the photo into the device, unless the kernel doesn't support it,
+		// in which case libfuse falls back to reading it into a buffer
+		struct fuse_bufvec buf = FUSE_BUFVEC_INIT(size);
+		buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+		buf.buf[0].fd = fd;
+		buf.buf[0].pos = off;
+
+		// the device is read while the reply is being sent
+		io_scheduler_h scheduler = filesystem_get_file_context(ll->fs)->scheduler;
+		io_scheduler_begin(scheduler, IO_CLASS_INTERACTIVE, inode_get_device(ino));
+		fuse_reply_data(req, &buf, FUSE_BUF_SPLICE_MOVE);
+		io_scheduler_end(scheduler, IO_CLASS_INTERACTIVE, inode_get_device(ino));
+		return;
+	}
+
+	char* buffer = malloc(size);
+	if (buffer == NULL)
+	{
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	ssize_t result = photo_file_read(file, buffer, size, off);
+	if (result == -1)
+	{
+		fuse_reply_err(req, errno);
+	}
+	else
+	{
+		fuse_reply_buf(req, buffer, result);
+	}
+
+	free(buffer);
+}
+
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	photo_file_close((photo_file_h) (uintptr_t) fi->fh);
+	fuse_reply_err(req, 0);
+}
+
+static struct fuse_lowlevel_ops ll_impl =
+{
+	.init       = ll_init,
+	.lookup     = ll_lookup,
+	.forget     = ll_forget,
+	.getattr    = ll_getattr,
+	.opendir    = ll_opendir,
+	.readdir    = ll_readdir,
+	.releasedir = ll_releasedir,
+	.open       = ll_open,
+	.read       = ll_read,
+	.release    = ll_release
+};
+
+bool filesystem_lowlevel_run(filesystem_h fs, const options_t* options)
+{
+	ASSERT_RET(fs != NULL, false);
+	ASSERT_RET(options != NULL, false);
+	ASSERT_RET(options->mount_location != NULL, false);
+
+	lowlevel_t ll = {
+		.fs = fs,
+		.nodes = NULL,
+		.timeout = options->kernel_timeout,
+		.keep_cache = options->immutable,
+		.io = options->async_io_depth > 0 ? async_io_create(options->async_io_depth) : NULL
+	};
+
+	g_mutex_init(&ll.listing_lock);
+
+	// indexes the nodes right away, and again whenever the catalog is refreshed
+	filesystem_set_catalog_listener(fs, node_index, &ll);
+
+	bool success = false;
+	char* argv[] = { "ipa" };
+	struct fuse_args args = FUSE_ARGS_INIT(1, argv);
+
+	struct fuse_chan* ch = fuse_mount(options->mount_location, &args);
+	if (ch == NULL)
+	{
+		LOG_ERROR("Unable to mount the filesystem at %s", options->mount_location);
+	}
+	else
+	{
+		struct fuse_session* se = fuse_lowlevel_new(&args, &ll_impl, sizeof(ll_impl), &ll);
+
+		if (se == NULL)
+		{
+			LOG_ERROR("Unable to create a FUSE session");
+		}
+		else
+		{
+			if (fuse_set_signal_handlers(se) == 0)
+			{
+				fuse_session_add_chan(se, ch);
+				filesystem_set_channel(fs, ch);
+
+				success = session_loop_run(se, options->worker_threads);
+
+				// the pending asynchronous operations reply through the session, so it has to outlive them
+				async_io_free(ll.io);
+				ll.io = NULL;
+
+				filesystem_set_channel(fs, NULL);
+				fuse_remove_signal_handlers(se);
+				fuse_session_remove_chan(ch);
+			}
+
+			fuse_session_destroy(se);
+		}
+
+		fuse_unmount(options->mount_location, ch);
+	}
+
+	fuse_opt_free_args(&args);
+	async_io_free(ll.io);
+
+	// no request is served anymore, so the nodes can be freed right away
+	filesystem_set_catalog_listener(fs, NULL, NULL);
+	node_table_free(ll.nodes);
+	g_mutex_clear(&ll.listing_lock);
+
+	return success;
+}
@@ -0,0 +1,23 @@
+/*
+ * This module serves the filesystem using the low level FUSE API. Instead of passing a full
+ * path with every request (which has to be parsed by path_parser.h), the kernel addresses
+ * every node by the inode assigned to it when the catalog of the device was loaded (see
+ * inode.h). This engine maps the inodes directly to the corresponding devices, albums and
+ * photos, and lets the kernel cache the directory entries it has already looked up.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "filesystem.h"
+#include "options.h"
+
+/**
+ * Run the filesystem using the low level FUSE API. This function blocks until otherwise
+ * interrupted (e.g. ^+C) or until the filesystem is unmounted.
+ * @param fs a valid handle of a filesystem, with all of its databases already added
+ * @param options the options with which the filesystem should be run
+ * @return true if the filesystem was mounted and served successfully, false on error
+ */
+bool filesystem_lowlevel_run(filesystem_h fs, const options_t* options);
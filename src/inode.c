@@ -0,0 +1,86 @@
+#include "inode.h"
+#include "logger.h"
+
+#include <inttypes.h>
+
+#define INODE_TAG_SHIFT     48
+#define INODE_KIND_SHIFT    46
+
+#define INODE_KIND_DEVICE   UINT64_C(1)
+#define INODE_KIND_ALBUM    UINT64_C(2)
+#define INODE_KIND_PHOTO    UINT64_C(3)
+
+#define INODE_PK_MASK       ((UINT64_C(1) << INODE_KIND_SHIFT) - 1)
+
+// the 64-bit FNV-1a hash, used since it's stable between the runs (and versions of the libraries)
+static uint64_t fnv1a(const char* text)
+{
+	uint64_t hash = UINT64_C(14695981039346656037);
+
+	for (const unsigned char* c = (const unsigned char*) text; *c != 0; c++)
+	{
+		hash ^= *c;
+		hash *= UINT64_C(1099511628211);
+	}
+
+	return hash;
+}
+
+static uint64_t inode_checked_pk(int64_t pk, uint64_t mask)
+{
+	if (pk < 0 || (uint64_t) pk > mask)
+	{
+		LOG_WARN("Primary key %" PRId64 " exceeds the range of inode numbers, the inodes might not be unique", pk);
+	}
+
+	return (uint64_t) pk & mask;
+}
+
+uint64_t inode_for_device(const char* device_uid)
+{
+	uint64_t hash = fnv1a(device_uid);
+	uint64_t tag = (hash ^ (hash >> 16) ^ (hash >> 32) ^ (hash >> 48)) & 0xFFFF;
+
+	// a zero tag would produce inodes colliding with the root of the filesystem
+	if (tag == 0)
+	{
+		tag = 1;
+	}
+
+	return (tag << INODE_TAG_SHIFT) | (INODE_KIND_DEVICE << INODE_KIND_SHIFT);
+}
+
+uint64_t inode_for_album(uint64_t device_inode, int64_t album_pk)
+{
+	uint64_t tag = device_inode >> INODE_TAG_SHIFT;
+	return (tag << INODE_TAG_SHIFT) | (INODE_KIND_ALBUM << INODE_KIND_SHIFT) | inode_checked_pk(album_pk, INODE_PK_MASK);
+}
+
+uint64_t inode_for_photo(uint64_t device_inode, int64_t asset_pk)
+{
+	uint64_t tag = device_inode >> INODE_TAG_SHIFT;
+	return (tag << INODE_TAG_SHIFT) | (INODE_KIND_PHOTO << INODE_KIND_SHIFT) | inode_checked_pk(asset_pk, INODE_PK_MASK);
+}
+
+uint32_t inode_generation_for_photo(uint64_t inode, int64_t created)
+{
+	// the primary key is mixed in as well, so that the assets created at the same time differ
+	uint64_t hash = ((uint64_t) created ^ (uint64_t) inode_get_pk(inode)) * 0x9E3779B97F4A7C15ULL;
+	return (uint32_t) (hash >> 32);
+}
+
+uint64_t inode_get_device(uint64_t inode)
+{
+	uint64_t tag = inode >> INODE_TAG_SHIFT;
+	if (tag == 0)
+	{
+		return INODE_ROOT;
+	}
+
+	return (tag << INODE_TAG_SHIFT) | (INODE_KIND_DEVICE << INODE_KIND_SHIFT);
+}
+
+int64_t inode_get_pk(uint64_t inode)
+{
+	return (int64_t) (inode & INODE_PK_MASK);
+}
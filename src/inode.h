@@ -0,0 +1,73 @@
+/*
+ * This module assigns inode numbers to the nodes of the filesystem (devices, albums and photos).
+ * The inodes are derived from the identity of the device and the primary keys (Z_PK) of albums
+ * and assets stored in the photo database of that device, so they stay the same across remounts
+ * and can be relied upon by the applications caching the attributes of files (e.g. rsync, or
+ * NFS and Samba servers re-exporting the filesystem).
+ *
+ * An inode consists of the following bit fields (from the most significant bit):
+ *  - 16 bits: a tag of the device, i.e. a hash of its uid (never zero)
+ *  - 2 bits:  the kind of the node (device, album or photo)
+ *  - 46 bits: for albums the primary key of the album, for photos the primary key of the asset,
+ *             for devices zero
+ *
+ * The inode of a photo doesn't depend on the album, so a photo which belongs to multiple albums
+ * is a single file with multiple hard links, which content is cached by the kernel only once.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * The inode of the root directory of the filesystem (the one listing all devices). It's the
+ * same inode FUSE uses for the root of the mount.
+ */
+#define INODE_ROOT 1
+
+/**
+ * Get the inode of a device
+ * @param device_uid the uid of the device
+ * @return the inode of the device
+ */
+uint64_t inode_for_device(const char* device_uid);
+
+/**
+ * Get the inode of an album
+ * @param device_inode the inode of the device to which the album belongs (see inode_for_device())
+ * @param album_pk the primary key of the album within the photo database
+ * @return the inode of the album
+ */
+uint64_t inode_for_album(uint64_t device_inode, int64_t album_pk);
+
+/**
+ * Get the inode of a photo
+ * @param device_inode the inode of the device to which the photo belongs (see inode_for_device())
+ * @param asset_pk the primary key of the asset of the photo within the photo database
+ * @return the inode of the photo
+ */
+uint64_t inode_for_photo(uint64_t device_inode, int64_t asset_pk);
+
+/**
+ * Get the generation number of a photo. Together with the inode it identifies the photo even if
+ * the primary key of a deleted asset is ever reused by the photo database for another one. It
+ * depends only on the asset, so it doesn't change across remounts (even at another location).
+ * @param inode the inode of the photo (see inode_for_photo())
+ * @param created the creation date of the asset, or 0 if it's unknown
+ * @return the generation number of the photo
+ */
+uint32_t inode_generation_for_photo(uint64_t inode, int64_t created);
+
+/**
+ * Get the inode of the device to which a node belongs
+ * @param inode the inode of a device, an album or a photo
+ * @return the inode of the device or INODE_ROOT for the root of the filesystem
+ */
+uint64_t inode_get_device(uint64_t inode);
+
+/**
+ * Get the primary key from which the inode of an album or a photo has been derived
+ * @param inode the inode of an album or a photo
+ * @return the primary key of the album or the asset of the photo
+ */
+int64_t inode_get_pk(uint64_t inode);
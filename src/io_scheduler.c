@@ -0,0 +1,267 @@
+#include "io_scheduler.h"
+#include "logger.h"
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * An operation waiting for its turn, allocated on the stack of the waiting thread, or on the heap
+ * if it has been queued with io_scheduler_begin_async()
+ */
+typedef struct io_waiter_s
+{
+	GCond granted_cond;         /// signalled when the operation may be performed, unless it has a callback
+	bool granted;
+	io_scheduler_grant_cb callback; /// invoked when the operation may be performed, NULL for the waiting threads
+	void* user_data;
+	GList link;                 /// the link of this waiter in io_device_s::waiters
+} io_waiter_t;
+
+/**
+ * A device on which the operations are performed, each of them has its own slots
+ */
+typedef struct io_device_s
+{
+	uint64_t device;            /// the inode of the device (also the key in io_scheduler_s::devices)
+	unsigned int running;       /// the number of operations being performed on the device
+	unsigned int class_running[IO_CLASS_COUNT]; /// the number of operations of each class being performed
+	GQueue waiters[IO_CLASS_COUNT]; /// the waiting operations of each class, in the order of arrival [io_waiter_t*]
+} io_device_t;
+
+/**
+ * A structure behind io_scheduler_h handle
+ */
+struct io_scheduler_s
+{
+	GMutex lock;                /// guards all of the fields below
+	unsigned int slots;         /// the maximum number of operations performed on a device at the same time
+	unsigned int limits[IO_CLASS_COUNT]; /// the maximum number of operations of each class performed on a device
+	GHashTable* devices;        /// all the devices seen so far <device, state> [uint64_t*, io_device_t*]
+};
+
+// must be called with the lock held, returns NULL if the device couldn't be tracked
+static io_device_t* get_device(io_scheduler_h handle, uint64_t device)
+{
+	io_device_t* state = (io_device_t*) g_hash_table_lookup(handle->devices, &device);
+	if (state != NULL)
+	{
+		return state;
+	}
+
+	state = (io_device_t*) calloc(1, sizeof(io_device_t));
+	ASSERT_RET(state != NULL, NULL);
+
+	state->device = device;
+	for (io_class_e io_class = IO_CLASS_METADATA; io_class < IO_CLASS_COUNT; io_class++)
+	{
+		g_queue_init(&state->waiters[io_class]);
+	}
+
+	g_hash_table_insert(handle->devices, &state->device, state);
+	return state;
+}
+
+// must be called with the lock held
+static bool can_run(io_scheduler_h handle, const io_device_t* state, io_class_e io_class)
+{
+	return state->running < handle->slots && state->class_running[io_class] < handle->limits[io_class];
+}
+
+// must be called with the lock held
+static void grant(io_device_t* state, io_class_e io_class)
+{
+	state->running++;
+	state->class_running[io_class]++;
+}
+
+// must be called with the lock held, takes a slot if the operation may be performed right away
+static bool try_grant(io_scheduler_h handle, io_device_t* state, io_class_e io_class)
+{
+	// go ahead only if no one more urgent (or of the same class) is already waiting for the device
+	for (io_class_e other = IO_CLASS_METADATA; other <= io_class; other++)
+	{
+		if (state->waiters[other].head != NULL)
+		{
+			return false;
+		}
+	}
+
+	if (!can_run(handle, state, io_class))
+	{
+		return false;
+	}
+
+	grant(state, io_class);
+	return true;
+}
+
+// must be called with the lock held, hands the free slots of a device over to its waiting operations, the ones
+// queued with io_scheduler_begin_async() are moved to granted, as their callbacks are invoked without the lock
+static void dispatch(io_scheduler_h handle, io_device_t* state, GQueue* granted)
+{
+	for (io_class_e io_class = IO_CLASS_METADATA; io_class < IO_CLASS_COUNT; io_class++)
+	{
+		GQueue* waiters = &state->waiters[io_class];
+
+		while (waiters->head != NULL && can_run(handle, state, io_class))
+		{
+			io_waiter_t* waiter = (io_waiter_t*) waiters->head->data;
+			g_queue_unlink(waiters, &waiter->link);
+
+			grant(state, io_class);
+
+			if (waiter->callback != NULL)
+			{
+				g_queue_push_tail_link(granted, &waiter->link);
+			}
+			else
+			{
+				waiter->granted = true;
+				g_cond_signal(&waiter->granted_cond);
+			}
+		}
+
+		if (waiters->head != NULL)
+		{
+			// the operations of the less urgent classes must wait as well
+			break;
+		}
+	}
+}
+
+io_scheduler_h io_scheduler_create(unsigned int slots)
+{
+	ASSERT_RET(slots > 0, NULL);
+
+	io_scheduler_h handle = (io_scheduler_h) calloc(1, sizeof(struct io_scheduler_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	g_mutex_init(&handle->lock);
+	handle->slots = slots;
+	handle->devices = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free);
+
+	for (io_class_e io_class = IO_CLASS_METADATA; io_class < IO_CLASS_COUNT; io_class++)
+	{
+		handle->limits[io_class] = slots;
+	}
+
+	// the last slot of each device is always left for the metadata and the reads requested by users
+	handle->limits[IO_CLASS_BULK] = MAX(1, slots - 1);
+
+	return handle;
+}
+
+void io_scheduler_begin(io_scheduler_h handle, io_class_e io_class, uint64_t device)
+{
+	if (handle == NULL)
+	{
+		return;
+	}
+
+	ASSERT_RET(io_class < IO_CLASS_COUNT);
+
+	g_mutex_lock(&handle->lock);
+
+	// rather than failing the operation when the device can't be tracked, let it through
+	io_device_t* state = get_device(handle, device);
+	if (state == NULL || try_grant(handle, state, io_class))
+	{
+		g_mutex_unlock(&handle->lock);
+		return;
+	}
+
+	io_waiter_t waiter = { .granted = false };
+	g_cond_init(&waiter.granted_cond);
+	waiter.link.data = &waiter;
+
+	g_queue_push_tail_link(&state->waiters[io_class], &waiter.link);
+
+	while (!waiter.granted)
+	{
+		g_cond_wait(&waiter.granted_cond, &handle->lock);
+	}
+
+	g_mutex_unlock(&handle->lock);
+	g_cond_clear(&waiter.granted_cond);
+}
+
+void io_scheduler_begin_async(io_scheduler_h handle, io_class_e io_class, uint64_t device,
+		io_scheduler_grant_cb callback, void* user_data)
+{
+	ASSERT_RET(callback != NULL);
+
+	if (handle == NULL)
+	{
+		callback(user_data);
+		return;
+	}
+
+	ASSERT_RET(io_class < IO_CLASS_COUNT);
+
+	g_mutex_lock(&handle->lock);
+
+	io_device_t* state = get_device(handle, device);
+	io_waiter_t* waiter = (state != NULL && !try_grant(handle, state, io_class)) ?
+			(io_waiter_t*) calloc(1, sizeof(io_waiter_t)) : NULL;
+
+	if (waiter != NULL)
+	{
+		waiter->callback = callback;
+		waiter->user_data = user_data;
+		waiter->link.data = waiter;
+
+		g_queue_push_tail_link(&state->waiters[io_class], &waiter->link);
+	}
+
+	g_mutex_unlock(&handle->lock);
+
+	// granted right away, or let through if the operation couldn't be queued
+	if (waiter == NULL)
+	{
+		callback(user_data);
+	}
+}
+
+void io_scheduler_end(io_scheduler_h handle, io_class_e io_class, uint64_t device)
+{
+	if (handle == NULL)
+	{
+		return;
+	}
+
+	ASSERT_RET(io_class < IO_CLASS_COUNT);
+
+	GQueue granted = G_QUEUE_INIT;
+
+	g_mutex_lock(&handle->lock);
+
+	// the device is unknown only if the operation has been let through (see io_scheduler_begin())
+	io_device_t* state = (io_device_t*) g_hash_table_lookup(handle->devices, &device);
+	if (state != NULL && state->class_running[io_class] > 0)
+	{
+		state->running--;
+		state->class_running[io_class]--;
+		dispatch(handle, state, &granted);
+	}
+
+	g_mutex_unlock(&handle->lock);
+
+	GList* link;
+	while ((link = g_queue_pop_head_link(&granted)) != NULL)
+	{
+		io_waiter_t* waiter = (io_waiter_t*) link->data;
+		waiter->callback(waiter->user_data);
+		free(waiter);
+	}
+}
+
+void io_scheduler_free(io_scheduler_h handle)
+{
+	if (handle)
+	{
+		g_hash_table_unref(handle->devices);
+		g_mutex_clear(&handle->lock);
+		free(handle);
+	}
+}
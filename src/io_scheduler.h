@@ -0,0 +1,84 @@
+/*
+ * All the I/O on the devices goes through a single, slow USB link per device, so a bulk export
+ * of an album can easily keep it busy for minutes. This module limits the number of operations
+ * performed on each device at the same time, and decides which of the operations waiting for a
+ * device goes next: metadata operations (stat, open) come before the reads requested by users,
+ * which in turn come before the bulk reads (readahead, prefetching). Every device has slots of its
+ * own, so that an export from one device doesn't delay browsing another. Bulk reads never take the
+ * last free slot of a device, which is always left for the more urgent operations.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * The classes of the operations, from the most urgent one
+ */
+typedef enum
+{
+	IO_CLASS_METADATA = 0,  //!< retrieving the attributes of files and opening them
+	IO_CLASS_INTERACTIVE,   //!< reads requested by users
+	IO_CLASS_BULK,          //!< reads ahead of what has been requested, i.e. readahead and prefetching
+	IO_CLASS_COUNT
+} io_class_e;
+
+/**
+ * A handle of an I/O scheduler
+ */
+typedef struct io_scheduler_s* io_scheduler_h;
+
+/**
+ * A callback invoked when an operation queued with io_scheduler_begin_async() may be performed
+ * @param user_data the data passed to io_scheduler_begin_async()
+ */
+typedef void (*io_scheduler_grant_cb)(void* user_data);
+
+/**
+ * Create a new I/O scheduler
+ * @param slots the maximum number of operations performed on each device at the same time
+ * @return a handle of the scheduler or NULL on error
+ */
+io_scheduler_h io_scheduler_create(unsigned int slots);
+
+/**
+ * Wait until an operation may be performed on a device. Each call must be followed by
+ * io_scheduler_end() once the operation is finished.
+ * @param handle a handle of an I/O scheduler, or NULL in which case the operation is performed immediately
+ * @param io_class the class of the operation
+ * @param device the inode of the device on which the operation is performed (see inode_get_device())
+ * @note this function is thread-safe
+ */
+void io_scheduler_begin(io_scheduler_h handle, io_class_e io_class, uint64_t device);
+
+/**
+ * Queue an operation to be performed on a device, without waiting for its turn. The operation is
+ * scheduled the same as the ones passed to io_scheduler_begin(), and must be followed by
+ * io_scheduler_end() once it's finished as well.
+ * @param handle a handle of an I/O scheduler, or NULL in which case the operation is performed immediately
+ * @param io_class the class of the operation
+ * @param device the inode of the device on which the operation is performed (see inode_get_device())
+ * @param callback invoked when the operation may be performed, either from within this function, or
+ * from within io_scheduler_end() called when another operation finishes
+ * @param user_data the data passed to the callback
+ * @note the callback should not block, as it may be invoked by a thread finishing an unrelated operation
+ * @note this function is thread-safe
+ */
+void io_scheduler_begin_async(io_scheduler_h handle, io_class_e io_class, uint64_t device,
+		io_scheduler_grant_cb callback, void* user_data);
+
+/**
+ * Notify the scheduler that an operation started with io_scheduler_begin() (or io_scheduler_begin_async()) has finished
+ * @param handle the handle passed to io_scheduler_begin()
+ * @param io_class the class passed to io_scheduler_begin()
+ * @param device the device passed to io_scheduler_begin()
+ * @note this function is thread-safe
+ */
+void io_scheduler_end(io_scheduler_h handle, io_class_e io_class, uint64_t device);
+
+/**
+ * Free the I/O scheduler
+ * @param handle a handle of an I/O scheduler which should be freed
+ * @warning there must be no operations in progress when the scheduler is freed
+ */
+void io_scheduler_free(io_scheduler_h handle);
@@ -2,16 +2,32 @@
 #include "logger.h"
 #include "device.h"
 #include "db.h"
+#include "options.h"
+
+#include <glib.h>
+#include <stdlib.h>
 
 int main(int argc, char* argv[])
 {
-	if (argc != 2)
+	options_t options;
+	if (!options_parse(argc, argv, &options))
 	{
-		LOG_ERROR("Usage: %s <mount location>", argv[0]);
-		return 1;
+		return EXIT_FAILURE;
 	}
 
-	filesystem_h fs = filesystem_create();
+	filesystem_h fs = filesystem_create(&options);
+	if (fs == NULL)
+	{
+		LOG_ERROR("Unable to initialize the filesystem");
+		return EXIT_FAILURE;
+	}
+
+	char* catalog_cache_dir = NULL;
+	if (options.catalog_cache)
+	{
+		catalog_cache_dir = options.catalog_cache_dir != NULL ? g_strdup(options.catalog_cache_dir) :
+				g_build_filename(g_get_user_cache_dir(), "ipa", "catalogs", NULL);
+	}
 
 	device_h* devices = NULL;
 	size_t devices_count = 0;
@@ -24,7 +40,8 @@ int main(int argc, char* argv[])
 
 			char* db_location = device_get_photo_db_location(devices[i]);
 			char* root_path = device_get_root_path(devices[i]);
-			db_h db = db_create(db_location, device_get_name(devices[i]), root_path);
+			db_h db = db_create(db_location, device_get_uid(devices[i]), device_get_name(devices[i]), root_path,
+					options.db_snapshot, options.lazy_albums, catalog_cache_dir);
 
 			if (db != NULL)
 			{
@@ -39,7 +56,9 @@ int main(int argc, char* argv[])
 		free(devices);
 	}
 
-	filesystem_run(fs, argv[1]);
+	g_free(catalog_cache_dir);
+
+	filesystem_run(fs);
 
 	filesystem_free(fs);
 }
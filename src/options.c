@@ -0,0 +1,354 @@
+#include "options.h"
+#include "logger.h"
+#include "utils.h"
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+// the upper limit of the worker threads, anything above that is most likely a typo
+#define MAX_WORKER_THREADS 256
+
+// the upper limit of the readahead window (in MiB), which is allocated for every photo read sequentially
+#define MAX_READAHEAD 256
+
+// the upper limit of the photos prefetched after each opened one
+#define MAX_PREFETCH_DEPTH 64
+
+// the upper limit of the asynchronous I/O operations submitted at once, as accepted by io_uring
+#define MAX_ASYNC_IO_DEPTH 4096
+
+// the upper limit of the operations performed on the devices at the same time
+#define MAX_IO_SLOTS 64
+
+// the default number of parsed paths kept in the lookup cache
+#define DEFAULT_CACHE_SIZE 10000
+
+// the default time (in seconds) for which the attributes retrieved from devices are cached
+#define DEFAULT_ATTR_TTL 60
+
+// the default number of threads retrieving the attributes of listed photos in advance
+#define DEFAULT_ATTR_THREADS 8
+
+// the time (in seconds) for which the kernel may cache the entries and their attributes
+#define DEFAULT_KERNEL_TIMEOUT 1
+
+// the default kernel cache time in the immutable mode, where the entries are explicitly invalidated
+#define DEFAULT_IMMUTABLE_TIMEOUT 86400
+
+// the default capacity (in MiB) of the cache of the contents of photos
+#define DEFAULT_BLOCK_CACHE_SIZE 1024
+
+// the default maximum size (in MiB) of the window read ahead when a photo is read sequentially
+#define DEFAULT_READAHEAD 8
+
+// the default number of photos prefetched after each opened one
+#define DEFAULT_PREFETCH_DEPTH 3
+
+// the default maximum size (in MiB) of the photos prefetched after each opened one
+#define DEFAULT_PREFETCH_BUDGET 64
+
+// the default number of files on the devices kept open
+#define DEFAULT_MAX_OPEN_FILES 64
+
+// the default time (in seconds) for which the files on the devices are kept open after their last use
+#define DEFAULT_FD_IDLE_TIMEOUT 30
+
+// the default number of asynchronous I/O operations which may be submitted at once
+#define DEFAULT_ASYNC_IO_DEPTH 128
+
+// the default number of operations performed on each device at the same time, more of them only
+// compete for the same USB link
+#define DEFAULT_IO_SLOTS 4
+
+// the default time (in seconds) between the refreshes of the catalogs, which are cheap unless a database has changed
+#define DEFAULT_REFRESH_INTERVAL 60
+
+// the default time (in seconds) after which the photos of an idle lazily loaded album are dropped, 0 if they never are
+#define DEFAULT_ALBUM_IDLE_TIMEOUT 0
+
+// identifiers of the options which have no short equivalent
+enum
+{
+	OPTION_ATTR_TTL = 256,
+	OPTION_ATTR_THREADS,
+	OPTION_IMMUTABLE,
+	OPTION_BLOCK_CACHE_DIR,
+	OPTION_BLOCK_CACHE_SIZE,
+	OPTION_READAHEAD,
+	OPTION_PREFETCH_DEPTH,
+	OPTION_PREFETCH_BUDGET,
+	OPTION_MAX_OPEN_FILES,
+	OPTION_FD_IDLE_TIMEOUT,
+	OPTION_ASYNC_IO,
+	OPTION_IO_SLOTS,
+	OPTION_DB_SNAPSHOT,
+	OPTION_CATALOG_CACHE_DIR,
+	OPTION_NO_CATALOG_CACHE,
+	OPTION_REFRESH_INTERVAL,
+	OPTION_LAZY_ALBUMS,
+	OPTION_ALBUM_IDLE_TIMEOUT
+};
+
+static void print_usage(const char* program)
+{
+	LOG_ERROR("Usage: %s [options] <mount location>\n"
+			"Options:\n"
+			"  -t, --threads=N               number of threads serving filesystem requests (default: number of CPUs)\n"
+			"  -c, --cache-size=N            number of parsed paths kept in the lookup cache (default: %d)\n"
+			"  -e, --engine=NAME             engine serving the filesystem: 'path' (default) or 'inode'\n"
+			"  --attr-ttl=SECONDS            time for which the attributes retrieved from devices are cached (default: %d)\n"
+			"  --attr-threads=N              number of threads retrieving the attributes of listed photos (default: %d)\n"
+			"  --immutable[=SECONDS]         let the kernel cache photos, entries and attributes (for %d seconds by default,\n"
+			"                                at most the refresh interval with the path engine)\n"
+			"  --block-cache-dir=DIR         directory of the cache of the contents of photos (default: ~/.cache/ipa/blocks)\n"
+			"  --block-cache-size=MIB        capacity of the cache of the contents of photos, 0 disables it, which lets the\n"
+			"                                photos be spliced into the kernel (default: %d)\n"
+			"  --readahead=MIB               maximum window read ahead of photos read sequentially, 0 disables it, which\n"
+			"                                lets the sequential reads be spliced as well (default: %d)\n"
+			"  --prefetch-depth=N            number of photos prefetched after each opened one, 0 disables it (default: %d)\n"
+			"  --prefetch-budget=MIB         maximum size of the photos prefetched after each opened one (default: %d)\n"
+			"  --max-open-files=N            number of files on the devices above which the unused ones are closed (default: %d)\n"
+			"  --fd-idle-timeout=SECONDS     time after which an unused file on a device is closed (default: %d)\n"
+			"  --async-io=N                  asynchronous I/O operations of the inode engine in flight, 0 for synchronous I/O (default: %d)\n"
+			"  --io-slots=N                  number of operations performed on each device at the same time (default: %d)\n"
+			"  --db-snapshot                 copy the photo databases and query them locally instead of on the devices\n"
+			"  --catalog-cache-dir=DIR       directory of the cache of the catalogs (default: ~/.cache/ipa/catalogs)\n"
+			"  --no-catalog-cache            extract the catalogs from the photo databases on every mount\n"
+			"  --refresh-interval=SECONDS    time between the refreshes of the catalogs, 0 refreshes only on SIGUSR1 (default: %d)\n"
+			"  --lazy-albums                 query the photos of each album only when it is first listed or looked up into\n"
+			"  --album-idle-timeout=SECONDS  time after which the photos of an unused lazy album are dropped, 0 never (default: %d)",
+			program, DEFAULT_CACHE_SIZE, DEFAULT_ATTR_TTL, DEFAULT_ATTR_THREADS, DEFAULT_IMMUTABLE_TIMEOUT,
+			DEFAULT_BLOCK_CACHE_SIZE, DEFAULT_READAHEAD, DEFAULT_PREFETCH_DEPTH, DEFAULT_PREFETCH_BUDGET,
+			DEFAULT_MAX_OPEN_FILES, DEFAULT_FD_IDLE_TIMEOUT, DEFAULT_ASYNC_IO_DEPTH, DEFAULT_IO_SLOTS,
+			DEFAULT_REFRESH_INTERVAL, DEFAULT_ALBUM_IDLE_TIMEOUT);
+}
+
+static bool parse_uint(const char* text, unsigned int min, unsigned int max, unsigned int* result)
+{
+	char* end = NULL;
+	unsigned long value = strtoul(text, &end, 10);
+
+	if (end == text || *end != 0 || value < min || value > max)
+	{
+		return false;
+	}
+
+	*result = (unsigned int) value;
+	return true;
+}
+
+bool options_parse(int argc, char* argv[], options_t* options)
+{
+	ASSERT_RET(options != NULL, false);
+
+	static const struct option long_options[] =
+	{
+		{ "threads", required_argument, NULL, 't' },
+		{ "cache-size", required_argument, NULL, 'c' },
+		{ "engine", required_argument, NULL, 'e' },
+		{ "attr-ttl", required_argument, NULL, OPTION_ATTR_TTL },
+		{ "attr-threads", required_argument, NULL, OPTION_ATTR_THREADS },
+		{ "immutable", optional_argument, NULL, OPTION_IMMUTABLE },
+		{ "block-cache-dir", required_argument, NULL, OPTION_BLOCK_CACHE_DIR },
+		{ "block-cache-size", required_argument, NULL, OPTION_BLOCK_CACHE_SIZE },
+		{ "readahead", required_argument, NULL, OPTION_READAHEAD },
+		{ "prefetch-depth", required_argument, NULL, OPTION_PREFETCH_DEPTH },
+		{ "prefetch-budget", required_argument, NULL, OPTION_PREFETCH_BUDGET },
+		{ "max-open-files", required_argument, NULL, OPTION_MAX_OPEN_FILES },
+		{ "fd-idle-timeout", required_argument, NULL, OPTION_FD_IDLE_TIMEOUT },
+		{ "async-io", required_argument, NULL, OPTION_ASYNC_IO },
+		{ "io-slots", required_argument, NULL, OPTION_IO_SLOTS },
+		{ "db-snapshot", no_argument, NULL, OPTION_DB_SNAPSHOT },
+		{ "catalog-cache-dir", required_argument, NULL, OPTION_CATALOG_CACHE_DIR },
+		{ "no-catalog-cache", no_argument, NULL, OPTION_NO_CATALOG_CACHE },
+		{ "refresh-interval", required_argument, NULL, OPTION_REFRESH_INTERVAL },
+		{ "lazy-albums", no_argument, NULL, OPTION_LAZY_ALBUMS },
+		{ "album-idle-timeout", required_argument, NULL, OPTION_ALBUM_IDLE_TIMEOUT },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	options->mount_location = NULL;
+	options->worker_threads = MAX(1, g_get_num_processors());
+	options->cache_size = DEFAULT_CACHE_SIZE;
+	options->engine = ENGINE_PATH;
+	options->attr_ttl = DEFAULT_ATTR_TTL;
+	options->attr_threads = DEFAULT_ATTR_THREADS;
+	options->immutable = false;
+	options->kernel_timeout = DEFAULT_KERNEL_TIMEOUT;
+	options->block_cache_dir = NULL;
+	options->block_cache_size = DEFAULT_BLOCK_CACHE_SIZE;
+	options->readahead = DEFAULT_READAHEAD;
+	options->prefetch_depth = DEFAULT_PREFETCH_DEPTH;
+	options->prefetch_budget = DEFAULT_PREFETCH_BUDGET;
+	options->max_open_files = DEFAULT_MAX_OPEN_FILES;
+	options->fd_idle_timeout = DEFAULT_FD_IDLE_TIMEOUT;
+	options->async_io_depth = DEFAULT_ASYNC_IO_DEPTH;
+	options->io_slots = DEFAULT_IO_SLOTS;
+	options->db_snapshot = false;
+	options->catalog_cache = true;
+	options->catalog_cache_dir = NULL;
+	options->refresh_interval = DEFAULT_REFRESH_INTERVAL;
+	options->lazy_albums = false;
+	options->album_idle_timeout = DEFAULT_ALBUM_IDLE_TIMEOUT;
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "t:c:e:", long_options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			if (!parse_uint(optarg, 1, MAX_WORKER_THREADS, &options->worker_threads))
+			{
+				LOG_ERROR("Invalid number of threads: %s (expected 1-%d)", optarg, MAX_WORKER_THREADS);
+				return false;
+			}
+			break;
+		case 'c':
+			if (!parse_uint(optarg, 1, UINT_MAX, &options->cache_size))
+			{
+				LOG_ERROR("Invalid cache size: %s", optarg);
+				return false;
+			}
+			break;
+		case 'e':
+			if (STREQ(optarg, "path"))
+			{
+				options->engine = ENGINE_PATH;
+			}
+			else if (STREQ(optarg, "inode"))
+			{
+				options->engine = ENGINE_INODE;
+			}
+			else
+			{
+				LOG_ERROR("Unknown engine: %s", optarg);
+				return false;
+			}
+			break;
+		case OPTION_ATTR_TTL:
+			if (!parse_uint(optarg, 0, UINT_MAX, &options->attr_ttl))
+			{
+				LOG_ERROR("Invalid attribute cache time: %s", optarg);
+				return false;
+			}
+			break;
+		case OPTION_ATTR_THREADS:
+			if (!parse_uint(optarg, 1, MAX_WORKER_THREADS, &options->attr_threads))
+			{
+				LOG_ERROR("Invalid number of attribute threads: %s (expected 1-%d)", optarg, MAX_WORKER_THREADS);
+				return false;
+			}
+			break;
+		case OPTION_IMMUTABLE:
+			options->immutable = true;
+			options->kernel_timeout = DEFAULT_IMMUTABLE_TIMEOUT;
+
+			if (optarg != NULL && !parse_uint(optarg, 1, UINT_MAX, &options->kernel_timeout))
+			{
+				LOG_ERROR("Invalid kernel cache time: %s", optarg);
+				return false;
+			}
+			break;
+		case OPTION_BLOCK_CACHE_DIR:
+			options->block_cache_dir = optarg;
+			break;
+		case OPTION_BLOCK_CACHE_SIZE:
+			if (!parse_uint(optarg, 0, UINT_MAX, &options->block_cache_size))
+			{
+				LOG_ERROR("Invalid block cache size: %s", optarg);
+				return false;
+			}
+			break;
+		case OPTION_READAHEAD:
+			if (!parse_uint(optarg, 0, MAX_READAHEAD, &options->readahead))
+			{
+				LOG_ERROR("Invalid readahead size: %s (expected 0-%d)", optarg, MAX_READAHEAD);
+				return false;
+			}
+			break;
+		case OPTION_PREFETCH_DEPTH:
+			if (!parse_uint(optarg, 0, MAX_PREFETCH_DEPTH, &options->prefetch_depth))
+			{
+				LOG_ERROR("Invalid prefetch depth: %s (expected 0-%d)", optarg, MAX_PREFETCH_DEPTH);
+				return false;
+			}
+			break;
+		case OPTION_PREFETCH_BUDGET:
+			if (!parse_uint(optarg, 1, UINT_MAX, &options->prefetch_budget))
+			{
+				LOG_ERROR("Invalid prefetch budget: %s", optarg);
+				return false;
+			}
+			break;
+		case OPTION_MAX_OPEN_FILES:
+			if (!parse_uint(optarg, 1, UINT_MAX, &options->max_open_files))
+			{
+				LOG_ERROR("Invalid number of open files: %s", optarg);
+				return false;
+			}
+			break;
+		case OPTION_FD_IDLE_TIMEOUT:
+			if (!parse_uint(optarg, 0, UINT_MAX, &options->fd_idle_timeout))
+			{
+				LOG_ERROR("Invalid idle timeout: %s", optarg);
+				return false;
+			}
+			break;
+		case OPTION_ASYNC_IO:
+			if (!parse_uint(optarg, 0, MAX_ASYNC_IO_DEPTH, &options->async_io_depth))
+			{
+				LOG_ERROR("Invalid number of asynchronous operations: %s (expected 0-%d)", optarg, MAX_ASYNC_IO_DEPTH);
+				return false;
+			}
+			break;
+		case OPTION_IO_SLOTS:
+			if (!parse_uint(optarg, 1, MAX_IO_SLOTS, &options->io_slots))
+			{
+				LOG_ERROR("Invalid number of I/O slots: %s (expected 1-%d)", optarg, MAX_IO_SLOTS);
+				return false;
+			}
+			break;
+		case OPTION_DB_SNAPSHOT:
+			options->db_snapshot = true;
+			break;
+		case OPTION_CATALOG_CACHE_DIR:
+			options->catalog_cache_dir = optarg;
+			break;
+		case OPTION_NO_CATALOG_CACHE:
+			options->catalog_cache = false;
+			break;
+		case OPTION_REFRESH_INTERVAL:
+			if (!parse_uint(optarg, 0, UINT_MAX, &options->refresh_interval))
+			{
+				LOG_ERROR("Invalid refresh interval: %s", optarg);
+				return false;
+			}
+			break;
+		case OPTION_LAZY_ALBUMS:
+			options->lazy_albums = true;
+			break;
+		case OPTION_ALBUM_IDLE_TIMEOUT:
+			if (!parse_uint(optarg, 0, UINT_MAX, &options->album_idle_timeout))
+			{
+				LOG_ERROR("Invalid album idle timeout: %s", optarg);
+				return false;
+			}
+			break;
+		default:
+			print_usage(argv[0]);
+			return false;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		print_usage(argv[0]);
+		return false;
+	}
+
+	options->mount_location = argv[optind];
+	return true;
+}
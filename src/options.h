@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * The engines which can be used to serve the filesystem
+ */
+typedef enum
+{
+	ENGINE_PATH = 0,    //!< the high level FUSE API, resolving every request by its path
+	ENGINE_INODE        //!< the low level FUSE API, resolving every request by the inode of a node
+} engine_e;
+
+/**
+ * Runtime configuration of ipa, assembled from the command line arguments
+ */
+typedef struct options_s
+{
+	const char* mount_location;     /// the location where the filesystem should be mounted
+	unsigned int worker_threads;    /// the number of threads serving FUSE requests concurrently
+	unsigned int cache_size;        /// the maximum number of parsed paths kept in the lookup cache
+	engine_e engine;                /// the engine serving the filesystem
+	unsigned int attr_ttl;          /// the time (in seconds) for which the attributes retrieved from devices are cached
+	unsigned int attr_threads;      /// the number of threads retrieving the attributes of listed photos in advance
+	bool immutable;                 /// whether the contents of the photos may be cached by the kernel across opens
+	unsigned int kernel_timeout;    /// the time (in seconds) for which the kernel may cache the entries and their attributes
+	const char* block_cache_dir;    /// the directory of the block cache or NULL for the default one
+	unsigned int block_cache_size;  /// the capacity (in MiB) of the block cache, 0 if it's disabled
+	unsigned int readahead;         /// the maximum size (in MiB) of the readahead window of opened photos, 0 if it's disabled
+	unsigned int prefetch_depth;    /// the number of photos prefetched after each opened one, 0 if it's disabled
+	unsigned int prefetch_budget;   /// the maximum size (in MiB) of the photos prefetched after each opened one
+	unsigned int max_open_files;    /// the number of files on the devices above which the unused ones are closed
+	unsigned int fd_idle_timeout;   /// the time (in seconds) after which an unused file on a device is closed
+	unsigned int async_io_depth;    /// the maximum number of asynchronous I/O operations submitted at once, 0 if the I/O is synchronous
+	unsigned int io_slots;          /// the maximum number of operations performed on each device at the same time
+	bool db_snapshot;               /// whether the photo databases are copied and queried locally instead of on the devices
+	bool catalog_cache;             /// whether the catalogs extracted from the photo databases are cached across the mounts
+	const char* catalog_cache_dir;  /// the directory of the catalog cache or NULL for the default one
+	unsigned int refresh_interval;  /// the time (in seconds) between the refreshes of the catalogs, 0 if they're refreshed only on SIGUSR1
+	bool lazy_albums;               /// whether the photos of each album are queried only when the album is first listed or looked up into
+	unsigned int album_idle_timeout; /// the time (in seconds) after which the photos of an unused lazy album are dropped (on a refresh), 0 if they never are
+} options_t;
+
+/**
+ * Fill the options structure with the values passed on the command line. Options which
+ * have not been explicitly provided are set to their defaults.
+ * @param argc the number of command line arguments, as passed to main()
+ * @param argv the command line arguments, as passed to main()
+ * @param[out] options the structure which should be filled with the parsed options
+ * @return true if the arguments were successfully parsed, false otherwise (in which case
+ * a usage message has already been presented to the user)
+ * @note the strings referenced from options point directly into argv
+ */
+bool options_parse(int argc, char* argv[], options_t* options);
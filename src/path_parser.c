@@ -3,325 +3,415 @@
 #include "logger.h"
 #include "utils.h"
 
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <glib.h>
 
 // uncomment this if you want to be notified if the path could not be parsed into an element existing in db
 //#define WARN_ABOUT_FAILED_TRANSLATION
 
-/**
- * A structure behind path_parser_h handle
- */
-struct path_parser_s
-{
-	filesystem_h fs;
-	GHashTable* cache;
-};
+// the number of independently locked parts of the lookup cache (must be a power of two)
+#define CACHE_SHARD_COUNT 16
 
-// the maximum number of entities (devices, albums, photos) stored within the lookup cache at any single point in time
-#define MAX_CACHE_SIZE 10000
+// the longest path kept in the lookup cache, the slots are preallocated so the longer ones are always parsed
+#define CACHE_PATH_MAX 256
 
-// elements of path parser cache, enabling for fast lookup of paths instead of manually parsing them everything.
+// the maximum number of components of a path, i.e. "/device/album/photo"
+#define MAX_COMPONENTS 3
 
 /**
- * A type of an element stored in cache
+ * A single slot of the lookup cache, holding either a resolved path or a path which doesn't exist
  */
-typedef enum
+typedef struct pp_cache_slot_s
 {
-	PPCE_DEVICE = 1,//!< it's a device
-	PPCE_ALBUM,     //!< it's an album
-	PPCE_PHOTO      //!< it's a photo
-} pp_cache_elem_type_e;
+	path_node_t node;       /// the node to which the path resolves, borrowed from the catalog
+	bool missing;           /// whether the path doesn't exist (in which case node is empty)
+	unsigned int version;   /// the version of the catalog in which the path has been resolved
+	guint hash;             /// the hash of the path
+	int next;               /// the next slot in the same bucket (or in the list of free slots), -1 if none
+	GList link;             /// the link of this slot within pp_cache_shard_s::recency, valid only if it's used
+	size_t length;          /// the length of the path
+	char path[CACHE_PATH_MAX];
+} pp_cache_slot_t;
 
 /**
- * A single entry stored within a cache, either a device, an album or a photo
+ * A part of the lookup cache. Paths are distributed between the shards by their hash, so that
+ * concurrent FUSE requests for different paths rarely compete for the same lock. All the slots
+ * of a shard are allocated upfront and chained into buckets by the hashes of their paths.
  */
-typedef struct pp_cache_elem_s
+typedef struct pp_cache_shard_s
 {
-	pp_cache_elem_type_e type;
-	db_h device;
-	album_h album;
-	photo_h photo;
-}* pp_cache_elem_h;
+	GMutex lock;            /// guards all accesses to the slots of this shard
+	pp_cache_slot_t* slots; /// all the slots of this shard
+	int* buckets;           /// the first slot of each bucket, -1 if the bucket is empty
+	guint bucket_mask;      /// the number of buckets minus one (the number is a power of two)
+	int free;               /// the first slot which isn't used, -1 if all of them are
+	GQueue recency;         /// the used slots of this shard, from the most to the least recently used
+} pp_cache_shard_t;
 
-static pp_cache_elem_h ppce_create_from_device(const db_h device)
+/**
+ * A structure behind path_parser_h handle
+ */
+struct path_parser_s
 {
-	pp_cache_elem_h handle = (pp_cache_elem_h) calloc(1, sizeof(struct pp_cache_elem_s));
-	ASSERT_RET(handle != NULL, NULL);
-
-	handle->type = PPCE_DEVICE;
-	handle->device = db_ref(device);
-
-	return handle;
-}
+	filesystem_h fs;
+	size_t shard_capacity;  /// the number of slots of a single shard
+	pp_cache_shard_t shards[CACHE_SHARD_COUNT];
+};
 
-static pp_cache_elem_h ppce_create_from_album(const db_h device, const album_h album)
+/**
+ * A component of a path, pointing into the path itself
+ */
+typedef struct path_slice_s
 {
-	pp_cache_elem_h handle = (pp_cache_elem_h) calloc(1, sizeof(struct pp_cache_elem_s));
-	ASSERT_RET(handle != NULL, NULL);
+	const char* start;
+	size_t length;
+} path_slice_t;
 
-	handle->type = PPCE_ALBUM;
-	handle->device = db_ref(device);
-	handle->album = album_ref(album);
+// the lookup cache, enabling for fast lookup of paths instead of manually parsing them everything
 
-	return handle;
+static pp_cache_shard_t* pp_cache_get_shard(path_parser_h handle, guint hash)
+{
+	return &handle->shards[hash & (CACHE_SHARD_COUNT - 1)];
 }
 
-static pp_cache_elem_h ppce_create_from_photo(const db_h device, const album_h album, const photo_h photo)
+static int* pp_cache_get_bucket(pp_cache_shard_t* shard, guint hash)
 {
-	pp_cache_elem_h handle = (pp_cache_elem_h) calloc(1, sizeof(struct pp_cache_elem_s));
-	ASSERT_RET(handle != NULL, NULL);
-
-	handle->type = PPCE_PHOTO;
-	handle->device = db_ref(device);
-	handle->album = album_ref(album);
-	handle->photo = photo_ref(photo);
-
-	return handle;
+	// the lowest bits select the shard already
+	return &shard->buckets[(hash / CACHE_SHARD_COUNT) & shard->bucket_mask];
 }
 
-static void ppce_free(pp_cache_elem_h handle)
+// must be called with the lock of the shard held
+static int pp_cache_find(pp_cache_shard_t* shard, const char* path, size_t length, guint hash)
 {
-	if (handle)
+	for (int index = *pp_cache_get_bucket(shard, hash); index != -1; index = shard->slots[index].next)
 	{
-		if (handle->device)
-		{
-			db_unref(handle->device);
-		}
+		pp_cache_slot_t* slot = &shard->slots[index];
 
-		if (handle->album)
+		if (slot->hash == hash && slot->length == length && memcmp(slot->path, path, length) == 0)
 		{
-			album_unref(handle->album);
+			return index;
 		}
-
-		if (handle->photo)
-		{
-			photo_unref(handle->photo);
-		}
-
-		free(handle);
 	}
-}
 
-static pp_cache_elem_h pp_cache_lookup(path_parser_h handle, const char* path)
-{
-	return g_hash_table_lookup(handle->cache, path);
+	return -1;
 }
 
-static void pp_cache_insert(path_parser_h handle, const char* path, pp_cache_elem_h elem)
+// must be called with the lock of the shard held, returns the slot to the list of free ones
+static void pp_cache_release(pp_cache_shard_t* shard, int index)
 {
-	ASSERT_RET(handle);
-	ASSERT_RET(path);
-	ASSERT_RET(elem);
+	pp_cache_slot_t* slot = &shard->slots[index];
 
-	if (g_hash_table_size(handle->cache) >= MAX_CACHE_SIZE)
+	for (int* link = pp_cache_get_bucket(shard, slot->hash); *link != -1; link = &shard->slots[*link].next)
 	{
-		/*
-		 * Remove one element at random from the cache. This might not be
-		 * the most sophisticated cache invalidation method, but is relatively
-		 * simple to implement and does not introduce lots of overhead, assuming
-		 * that iterating over MAX_CACHE_SIZE elements is still faster that
-		 * parsing the path from scratch. Well, in any case this seems to be
-		 * working just fine for now, if some performance issues occur, it might
-		 * be possible to consider a rework of this approach.
-		 */
-		size_t target = rand() % g_hash_table_size(handle->cache);
-		size_t pos = 0;
-
-		GHashTableIter it;
-		gpointer key;
-
-		g_hash_table_iter_init(&it, handle->cache);
-		while (g_hash_table_iter_next(&it, &key, NULL))
+		if (*link == index)
 		{
-			if (target == pos++)
-			{
-				g_hash_table_remove(handle->cache, key);
-				break;
-			}
+			*link = slot->next;
+			break;
 		}
 	}
 
-	g_hash_table_insert(handle->cache, strdup(path), elem);
-}
+	g_queue_unlink(&shard->recency, &slot->link);
+	memset(&slot->node, 0, sizeof(path_node_t));
 
-// the actual part of path parser, which retrieves the information either from cache, or the path itself
+	slot->next = shard->free;
+	shard->free = index;
+}
 
-path_parser_h path_parser_create(filesystem_h fs)
+/**
+ * Look up the path in cache and copy the found node into result. The cached entities are only
+ * borrowed, they stay valid as long as the catalog is entered (see filesystem_enter_catalog()).
+ * @param version the version of the catalog within which the path is resolved
+ * @param[out] missing set if the path has been cached as one which doesn't exist
+ * @return true if the path has been found in the cache
+ */
+static bool pp_cache_lookup(path_parser_h handle, const char* path, size_t length, guint hash,
+		unsigned int version, path_node_t* result, bool* missing)
 {
-	path_parser_h handle = (path_parser_h) calloc(1, sizeof(struct path_parser_s));
-	ASSERT_RET(handle != NULL, NULL);
+	pp_cache_shard_t* shard = pp_cache_get_shard(handle, hash);
 
-	handle->fs = fs;
-	handle->cache = g_hash_table_new_full(g_str_hash, g_str_equal, free, (GDestroyNotify) ppce_free);
+	g_mutex_lock(&shard->lock);
 
-	srand(time(NULL));
+	int index = pp_cache_find(shard, path, length, hash);
+	if (index != -1 && shard->slots[index].version != version)
+	{
+		// the path has been resolved in a previous catalog, whose entities might be gone already
+		pp_cache_release(shard, index);
+		index = -1;
+	}
 
-	return handle;
+	if (index != -1)
+	{
+		pp_cache_slot_t* slot = &shard->slots[index];
+
+		// mark as the most recently used
+		g_queue_unlink(&shard->recency, &slot->link);
+		g_queue_push_head_link(&shard->recency, &slot->link);
+
+		*result = slot->node;
+		*missing = slot->missing;
+	}
+
+	g_mutex_unlock(&shard->lock);
+
+	return index != -1;
 }
 
-static bool process_photo(path_parser_h handle, const char* original_path, char* relative_path, db_h db, album_h album, path_parser_cb_t callbacks)
+/**
+ * Store the path in cache, evicting the least recently used one if there is no free slot
+ * @param node the node to which the path resolves, or NULL if the path doesn't exist
+ * @param version the version of the catalog within which the path has been resolved
+ */
+static void pp_cache_insert(path_parser_h handle, const char* path, size_t length, guint hash,
+		const path_node_t* node, unsigned int version)
 {
-	photo_h photo = album_get_photo_by_file_name(album, relative_path);
-	if (photo == NULL)
+	if (length > CACHE_PATH_MAX)
 	{
-		#ifdef WARN_ABOUT_FAILED_TRANSLATION
-		LOG_WARN("Unable to retrieve photo with name '%s' from album '%s'", relative_path, album_get_name(album));
-		#endif
+		return;
+	}
 
-		return false;
+	pp_cache_shard_t* shard = pp_cache_get_shard(handle, hash);
+
+	g_mutex_lock(&shard->lock);
+
+	if (pp_cache_find(shard, path, length, hash) != -1)
+	{
+		// another thread has already cached the same path in the meantime
+		g_mutex_unlock(&shard->lock);
+		return;
 	}
 
-	if (callbacks.on_photo)
+	if (shard->free == -1)
 	{
-		callbacks.on_photo(db, album, photo, callbacks.on_photo_user_data);
+		// evict the least recently used path
+		pp_cache_slot_t* lru = (pp_cache_slot_t*) shard->recency.tail->data;
+		pp_cache_release(shard, (int) (lru - shard->slots));
 	}
 
-	pp_cache_insert(handle, original_path, ppce_create_from_photo(db, album, photo));
+	int index = shard->free;
+	pp_cache_slot_t* slot = &shard->slots[index];
+	shard->free = slot->next;
 
-	photo_unref(photo);
-	return true;
+	if (node != NULL)
+	{
+		slot->node = *node;
+	}
+
+	slot->missing = (node == NULL);
+	slot->version = version;
+	slot->hash = hash;
+	slot->length = length;
+	memcpy(slot->path, path, length);
+
+	int* bucket = pp_cache_get_bucket(shard, hash);
+	slot->next = *bucket;
+	*bucket = index;
+
+	g_queue_push_head_link(&shard->recency, &slot->link);
+
+	g_mutex_unlock(&shard->lock);
 }
 
-static bool process_album(path_parser_h handle, const char* original_path, char* processing_path, db_h db, path_parser_cb_t callbacks)
+// the actual part of path parser, which retrieves the information either from cache, or the path itself
+
+path_parser_h path_parser_create(filesystem_h fs, size_t cache_capacity)
 {
-	char* album = processing_path;
-	char* next = strchr(processing_path, '/');
+	path_parser_h handle = (path_parser_h) calloc(1, sizeof(struct path_parser_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->fs = fs;
+	handle->shard_capacity = MAX(1, cache_capacity / CACHE_SHARD_COUNT);
 
-	if (next != NULL)
+	// twice as many buckets as slots keeps the chains short
+	guint bucket_count = 1;
+	while (bucket_count < handle->shard_capacity * 2)
 	{
-		*next = 0;
-		next++;
+		bucket_count *= 2;
 	}
 
-	album_h am = db_get_album_by_name(db, album);
-	if (am == NULL)
+	for (size_t i = 0; i < CACHE_SHARD_COUNT; i++)
 	{
-		#ifdef WARN_ABOUT_FAILED_TRANSLATION
-		LOG_WARN("Unable to retrieve album with name '%s'", album);
-		#endif
+		pp_cache_shard_t* shard = &handle->shards[i];
 
-		return false;
-	}
+		g_mutex_init(&shard->lock);
+		g_queue_init(&shard->recency);
+		shard->slots = (pp_cache_slot_t*) calloc(handle->shard_capacity, sizeof(pp_cache_slot_t));
+		shard->buckets = (int*) malloc(bucket_count * sizeof(int));
+		shard->bucket_mask = bucket_count - 1;
 
-	bool success = true;
-	if (next == NULL)
-	{
-		// this is the last component in the path, invoke callback
-		if (callbacks.on_album)
+		if (shard->slots == NULL || shard->buckets == NULL)
 		{
-			callbacks.on_album(db, am, callbacks.on_album_user_data);
+			LOG_ERROR("Unable to allocate the lookup cache");
+			path_parser_free(handle);
+			return NULL;
 		}
 
-		pp_cache_insert(handle, original_path, ppce_create_from_album(db, am));
+		for (guint bucket = 0; bucket < bucket_count; bucket++)
+		{
+			shard->buckets[bucket] = -1;
+		}
+
+		// all the slots are free, chained in order
+		for (size_t slot = 0; slot < handle->shard_capacity; slot++)
+		{
+			shard->slots[slot].next = (slot + 1 < handle->shard_capacity) ? (int) slot + 1 : -1;
+			shard->slots[slot].link.data = &shard->slots[slot];
+		}
+
+		shard->free = 0;
 	}
-	else
+
+	return handle;
+}
+
+/**
+ * Copy a component of a path into a buffer of NAME_MAX + 1 bytes, so that it can be looked up
+ * @return false if the component is empty or longer than any name, so it can't exist
+ */
+static bool slice_to_name(const path_slice_t* slice, char* name)
+{
+	if (slice->length == 0 || slice->length > NAME_MAX)
 	{
-		// more components on the way, proceed with parsing
-		success = process_photo(handle, original_path, next, db, am, callbacks);
+		return false;
 	}
 
-	album_unref(am);
-	return success;
+	memcpy(name, slice->start, slice->length);
+	name[slice->length] = 0;
+	return true;
 }
 
-static bool process_device(path_parser_h handle, const char* original_path, char* relative_path, filesystem_h fs, path_parser_cb_t callbacks)
+static bool resolve_components(path_parser_h handle, const path_slice_t* components, size_t count, path_node_t* node)
 {
-	char* device = relative_path;
-	char* next = strchr(relative_path, '/');
+	char name[NAME_MAX + 1];
+
+	if (!slice_to_name(&components[0], name) ||
+			(node->device = filesystem_find_database(handle->fs, name)) == NULL)
+	{
+		#ifdef WARN_ABOUT_FAILED_TRANSLATION
+		LOG_WARN("Unable to retrieve device with name '%.*s'", (int) components[0].length, components[0].start);
+		#endif
+
+		return false;
+	}
 
-	if (next != NULL)
+	node->type = PATH_NODE_DEVICE;
+	if (count == 1)
 	{
-		*next = 0;
-		next++;
+		return true;
 	}
 
-	db_h db = filesystem_get_database_by_fs_name(fs, device);
-	if (db == NULL)
+	if (!slice_to_name(&components[1], name) ||
+			(node->album = db_find_album(node->device, name)) == NULL)
 	{
 		#ifdef WARN_ABOUT_FAILED_TRANSLATION
-		LOG_WARN("Unable to retrieve device with name '%s'", device);
+		LOG_WARN("Unable to retrieve album with name '%.*s'", (int) components[1].length, components[1].start);
 		#endif
 
 		return false;
 	}
 
-	bool success = true;
-	if (next == NULL)
+	node->type = PATH_NODE_ALBUM;
+	if (count == 2)
 	{
-		// this is the last component in the path, invoke callback
-		if (callbacks.on_device)
-		{
-			callbacks.on_device(db, callbacks.on_device_user_data);
-		}
-
-		pp_cache_insert(handle, original_path, ppce_create_from_device(db));
+		return true;
 	}
-	else
+
+	if (!slice_to_name(&components[2], name) ||
+			(node->photo = album_find_photo(node->album, name)) == NULL)
 	{
-		// more components on the way, proceed with parsing
-		success = process_album(handle, original_path, next, db, callbacks);
+		#ifdef WARN_ABOUT_FAILED_TRANSLATION
+		LOG_WARN("Unable to retrieve photo with name '%.*s' from album '%s'", (int) components[2].length,
+				components[2].start, album_get_name(node->album));
+		#endif
+
+		return false;
 	}
 
-	db_unref(db);
-	return success;
+	node->type = PATH_NODE_PHOTO;
+	return true;
 }
 
-bool path_parser_execute(path_parser_h handle, const char* path, path_parser_cb_t callbacks)
+bool path_parser_resolve(path_parser_h handle, const char* path, path_node_t* node)
 {
-	ASSERT_RET(fs != NULL, false);
+	ASSERT_RET(handle != NULL, false);
 	ASSERT_RET(path != NULL, false);
-	ASSERT_RET(path[0] != '/', false);
+	ASSERT_RET(node != NULL, false);
+	ASSERT_RET(path[0] == '/', false);
+
+	memset(node, 0, sizeof(path_node_t));
 
 	if (path[1] == 0)
 	{
-		if (callbacks.on_root)
-		{
-			callbacks.on_root(callbacks.on_root_user_data);
-		}
+		node->type = PATH_NODE_ROOT;
 		return true;
 	}
 
-	pp_cache_elem_h ce = pp_cache_lookup(handle, path);
-	if (ce != NULL)
+	// a single pass both hashes the path (in the same way as g_str_hash() does) and splits it into components
+	path_slice_t components[MAX_COMPONENTS];
+	size_t count = 0;
+	size_t length = 0;
+	bool too_deep = false;
+	guint hash = 5381;
+
+	for (const char* c = path; *c != 0; c++, length++)
 	{
-		switch (ce->type)
+		hash = (hash << 5) + hash + (unsigned char) *c;
+
+		if (*c != '/')
 		{
-		case PPCE_DEVICE:
-			if (callbacks.on_device)
-			{
-				callbacks.on_device(ce->device, callbacks.on_device_user_data);
-			}
-			break;
-		case PPCE_ALBUM:
-			if (callbacks.on_album)
-			{
-				callbacks.on_album(ce->device, ce->album, callbacks.on_album_user_data);
-			}
-			break;
-		case PPCE_PHOTO:
-			if (callbacks.on_photo)
-			{
-				callbacks.on_photo(ce->device, ce->album, ce->photo, callbacks.on_photo_user_data);
-			}
+			components[count - 1].length++;
+		}
+		else if (count < MAX_COMPONENTS)
+		{
+			components[count++] = (path_slice_t) { .start = c + 1, .length = 0 };
+		}
+		else
+		{
+			too_deep = true;
 			break;
 		}
-		return true;
 	}
 
-	char* p = strdup(path + 1);
-	bool success = process_device(handle, path, p, handle->fs, callbacks);
-	free(p);
-	return success;
+	// the version is read before parsing, so that a path resolved while the catalog is being replaced
+	// is never cached as a part of the new one
+	unsigned int version = filesystem_get_catalog_version(handle->fs);
+
+	bool missing = false;
+	if (!too_deep && pp_cache_lookup(handle, path, length, hash, version, node, &missing))
+	{
+		return !missing;
+	}
+
+	if (too_deep || !resolve_components(handle, components, count, node))
+	{
+		memset(node, 0, sizeof(path_node_t));
+
+		if (!too_deep)
+		{
+			pp_cache_insert(handle, path, length, hash, NULL, version);
+		}
+
+		return false;
+	}
+
+	pp_cache_insert(handle, path, length, hash, node, version);
+	return true;
 }
 
 void path_parser_free(path_parser_h handle)
 {
 	if (handle)
 	{
-		g_hash_table_unref(handle->cache);
+		for (size_t i = 0; i < CACHE_SHARD_COUNT; i++)
+		{
+			pp_cache_shard_t* shard = &handle->shards[i];
+
+			free(shard->slots);
+			free(shard->buckets);
+			g_mutex_clear(&shard->lock);
+		}
+
 		free(handle);
 	}
 }
@@ -1,17 +1,26 @@
 /*
- * This module is responsible for parsing the path retrieved from fuse and performing
- * the specified events depending on the type of path. Currently, the fuse path is
- * in the following format "/[device[/album[/photo]]]", where each bracket contains
- * optional data (for instance since the filesystem user performs ls within the devices
- * directory). As such, the path parser traverses the obtained path and based on the
- * data from the program database (from filesystem.h) it retrieves the parameters of
- * the deepest element within the path and retrieves a respective callback (depending
- * whether it is a root element, device, album or photo).
+ * This module is responsible for resolving the paths retrieved from fuse into the nodes of
+ * the filesystem. Currently, the fuse path is in the following format "/[device[/album[/photo]]]",
+ * where each bracket contains optional data (for instance since the filesystem user performs ls
+ * within the devices directory). As such, the path parser traverses the obtained path and based
+ * on the data from the program database (from filesystem.h) it retrieves the deepest element
+ * within the path, i.e. the root element, a device, an album or a photo.
+ *
+ * The resolved paths are kept in a lookup cache made of preallocated slots, and the paths are
+ * parsed in place, as slices of the original string, so that resolving a path never allocates.
+ *
+ * The paths which don't exist are cached as well, since file managers and Samba clients keep
+ * probing for the same names (e.g. .DS_Store, desktop.ini).
+ *
+ * The nodes borrow the entities of the catalog instead of referencing them, so the paths must be
+ * resolved and their nodes used within filesystem_enter_catalog(). The cached paths are tagged with
+ * the version of the catalog they have been resolved in, and they are dropped once it's replaced.
  */
 
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "db.h"
 #include "album.h"
@@ -19,50 +28,27 @@
 #include "filesystem.h"
 
 /**
- * Callback invoked whenever the deepest path element passed to path parser is root ('/')
- * @param user_data the user data passed to path_parser_execute()
+ * A type of a node of the filesystem to which a path resolves
  */
-typedef void (*on_root_cb)(void* user_data);
-
-/**
- * Callback invoked whenever the deepest path element passed to path parser is a device name
- * @param device_db the database of the device corresponding to the device from the path
- * @param user_data the user data passed to path_parser_execute()
- */
-typedef void (*on_device_cb)(const db_h device_db, void* user_data);
-
-/**
- * Callback invoked whenever the deepest path element passed to path parser is an album name
- * @param device_db the database of the device to which the album belongs
- * @param album the album identified by the name retrieved from the path
- * @param user_data the user data passed to path_parser_execute()
- */
-typedef void (*on_album_cb)(const db_h device_db, const album_h album, void* user_data);
-
-/**
- * Callback invoked whenever the deepest path element passed to path parser is a photo
- * @param device_db the database of the device to which the album belongs
- * @param album the album to which the retrieved photo belongs
- * @param photo the photo identified by the name retrieved from the path
- * @param user_data the user data passed to path_parser_execute()
- */
-typedef void (*on_photo_cb)(const db_h device_db, const album_h album, const photo_h photo, void* user_data);
+typedef enum
+{
+	PATH_NODE_ROOT = 1, //!< the root directory
+	PATH_NODE_DEVICE,   //!< a directory of a device
+	PATH_NODE_ALBUM,    //!< a directory of an album
+	PATH_NODE_PHOTO     //!< a photo
+} path_node_type_e;
 
 /**
- * Structure holding callbacks passed to path_parser_execute()
+ * A node of the filesystem to which a path resolves. The node borrows the entities it points to
+ * from the catalog, so it's valid only until filesystem_leave_catalog() is called.
  */
-typedef struct path_parser_cb_s
+typedef struct path_node_s
 {
-	on_root_cb on_root;
-	on_device_cb on_device;
-	on_album_cb on_album;
-	on_photo_cb on_photo;
-
-	void* on_root_user_data;
-	void* on_device_user_data;
-	void* on_album_user_data;
-	void* on_photo_user_data;
-} path_parser_cb_t;
+	path_node_type_e type;
+	db_h device;            /// the device of the node, NULL for the root directory
+	album_h album;          /// the album of the node, NULL for the root directory and devices
+	photo_h photo;          /// the photo, NULL for directories
+} path_node_t;
 
 /**
  * A handle of a path parser
@@ -71,23 +57,31 @@ typedef struct path_parser_s* path_parser_h;
 
 /**
  * Creates a new instance of path parser assigned to a certain filesystem.
+ * @param fs the filesystem whose paths should be parsed
+ * @param cache_capacity the maximum number of parsed paths kept in the lookup cache, after which
+ * the least recently used ones are evicted
  * @return a new instance of path parser or NULL on error
  * @note the passed filesystem pointer must be valid at least until path_parser_free() is called
  * on the handle returned by this function.
  */
-path_parser_h path_parser_create(filesystem_h fs);
+path_parser_h path_parser_create(filesystem_h fs, size_t cache_capacity);
 
 /**
- * Parses the path retrieved from FUSE and invokes the corresponding callbacks based on what the
- * deepest element of the path contains.
+ * Resolves the path retrieved from FUSE into the node of the filesystem it refers to. The path is
+ * looked up in the lookup cache first, and only parsed if it's not cached. Neither of them
+ * allocates any memory, so that the resolution stays cheap even for the paths which miss the cache.
+ * @param handle a valid handle to a path parser
  * @param path the path retrieved from FUSE, currently in format '/[device[/album[/photo]]]', where
  * all within the square brackets might be optional
- * @param fs a valid handle of a filesystem
- * @param callbacks callbacks which should be invoked while parsing
- * @return true if a root elemet/device/album/photo has been found within the path or false if the
- * path refers to an object which has not been found in the passed filesystem element.
+ * @param[out] node the node which should be filled
+ * @return true if the path has been resolved, false if it refers to an object which doesn't exist
+ * (in which case the node is left empty)
+ * @note this function must be called within filesystem_enter_catalog(), and the node may be used
+ * only until filesystem_leave_catalog() is called
+ * @note this function is thread-safe, i.e. multiple FUSE workers may resolve their paths using the
+ * same path parser simultaneously
  */
-bool path_parser_execute(path_parser_h handle, const char* path, path_parser_cb_t callbacks);
+bool path_parser_resolve(path_parser_h handle, const char* path, path_node_t* node);
 
 /**
  * Frees all memory assigned with an instance of path parser
@@ -12,11 +12,15 @@ typedef struct photo_s
 {
 	char* file_name;			/// the file name of the photo (no path included)
 	char* location;				/// the location of the photo, relative to the root directory for the corresponding device
+	uint64_t inode;				/// the inode number assigned to the photo
+	struct stat attributes;		/// the attributes of the backing file (valid only if attributes_known is set)
+	gint attributes_known;		/// whether the attributes field has already been filled
+	gint album_count;			/// the number of albums to which the photo belongs
 
 	gint ref_count;				/// reference counter for photo_h
 } photo_t;
 
-photo_h photo_create(const char* file_name, const char* location)
+photo_h photo_create(const char* file_name, const char* location, uint64_t inode)
 {
 	ASSERT_RET(file_name != NULL, NULL);
 	ASSERT_RET(location != NULL, NULL);
@@ -27,6 +31,7 @@ photo_h photo_create(const char* file_name, const char* location)
 	handle->ref_count = 1;
 	handle->file_name = strdup(file_name);
 	handle->location = strdup(location);
+	handle->inode = inode;
 
 	return handle;
 }
@@ -43,6 +48,71 @@ const char* photo_get_location(const photo_h handle)
 	return handle->location;
 }
 
+uint64_t photo_get_inode(const photo_h handle)
+{
+	ASSERT_RET(handle != NULL, 0);
+	return handle->inode;
+}
+
+/**
+ * Serializes writers of the photo attributes. The readers don't need it, since the attributes
+ * are written only once, before attributes_known is (atomically) set.
+ */
+static GMutex attributes_lock;
+
+bool photo_set_stat(photo_h handle, const struct stat* stbuf)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(stbuf != NULL, false);
+
+	bool updated = false;
+
+	g_mutex_lock(&attributes_lock);
+	if (!handle->attributes_known)
+	{
+		handle->attributes = *stbuf;
+		g_atomic_int_set(&handle->attributes_known, 1);
+		updated = true;
+	}
+	g_mutex_unlock(&attributes_lock);
+
+	return updated;
+}
+
+bool photo_get_stat(const photo_h handle, struct stat* stbuf)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(stbuf != NULL, false);
+
+	if (!g_atomic_int_get(&handle->attributes_known))
+	{
+		return false;
+	}
+
+	*stbuf = handle->attributes;
+	return true;
+}
+
+void photo_add_album(photo_h handle)
+{
+	ASSERT_RET(handle != NULL);
+	g_atomic_int_inc(&handle->album_count);
+}
+
+bool photo_remove_album(photo_h handle)
+{
+	ASSERT_RET(handle != NULL, false);
+	ASSERT_RET(g_atomic_int_get(&handle->album_count) > 0, false);
+
+	return g_atomic_int_dec_and_test(&handle->album_count);
+}
+
+unsigned int photo_get_album_count(const photo_h handle)
+{
+	ASSERT_RET(handle != NULL, 0);
+	return (unsigned int) g_atomic_int_get(&handle->album_count);
+}
+
 photo_h photo_ref(photo_h handle)
 {
 	ASSERT_RET(handle, NULL);
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
 /**
  * A handle to a structure representing a single photo
  */
@@ -10,9 +14,10 @@ typedef struct photo_s* photo_h;
  * @param file_name the file name of a photo, without a path
  * @param location the path where the photo is located, relative to
  * the root directory of its device.
+ * @param inode the inode number assigned to the photo (see inode.h)
  * @return a new instance of a photo structure or NULL on error
  */
-photo_h photo_create(const char* file_name, const char* location);
+photo_h photo_create(const char* file_name, const char* location, uint64_t inode);
 
 /**
  * Get the file name of the passed photo
@@ -29,6 +34,55 @@ const char* photo_get_file_name(const photo_h handle);
  */
 const char* photo_get_location(const photo_h handle);
 
+/**
+ * Get the inode number assigned to the passed photo
+ * @param handle a valid handle to a photo structure
+ * @return the inode number of the photo or 0 on error
+ */
+uint64_t photo_get_inode(const photo_h handle);
+
+/**
+ * Set the attributes of the file backing the passed photo, when they are known from the photo
+ * database. Since photos never change once they are written, the attributes don't need to be
+ * retrieved from the device afterwards.
+ * @param handle a valid handle to a photo structure
+ * @param stbuf the attributes of the backing file
+ * @return true if the attributes have been set, false if they were already known (in which case
+ * the previous ones are kept) or on error
+ * @note this function is thread-safe
+ */
+bool photo_set_stat(photo_h handle, const struct stat* stbuf);
+
+/**
+ * Get the attributes of the file backing the passed photo, if they have been set with photo_set_stat()
+ * @param handle a valid handle to a photo structure
+ * @param[out] stbuf the structure which should be filled with the attributes
+ * @return true if the attributes were known and have been retrieved, false otherwise
+ * @note this function is thread-safe
+ */
+bool photo_get_stat(const photo_h handle, struct stat* stbuf);
+
+/**
+ * Record that the photo has been added to another album. A photo (asset) may belong to multiple
+ * albums, in which case all of them share the same photo handle and the same inode.
+ * @param handle a valid handle to a photo structure
+ */
+void photo_add_album(photo_h handle);
+
+/**
+ * Record that the photo has been removed from one of its albums, e.g. when the catalog is refreshed
+ * @param handle a valid handle to a photo structure
+ * @return true if the photo no longer belongs to any album
+ */
+bool photo_remove_album(photo_h handle);
+
+/**
+ * Get the number of albums to which the photo belongs, reported as its number of hard links
+ * @param handle a valid handle to a photo structure
+ * @return the number of albums recorded with photo_add_album()
+ */
+unsigned int photo_get_album_count(const photo_h handle);
+
 /**
  * Increase the reference counter of the passed photo handle
  * @param handle a valid handle to a photo structure
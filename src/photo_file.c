@@ -0,0 +1,388 @@
+#include "photo_file.h"
+#include "inode.h"
+#include "logger.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+// the size of the readahead window after the first sequential read, doubled by subsequent ones
+#define INITIAL_READAHEAD (256 * 1024)
+
+/**
+ * A structure behind photo_file_h handle
+ */
+struct photo_file_s
+{
+	photo_h photo;
+	fd_pool_h fds;              /// the pool from which the descriptor of the backing file is acquired
+	block_cache_h cache;        /// the cache of the blocks of the photo or NULL if it's read directly
+	block_cache_key_t key;      /// the identity of the photo within the cache (without the block index)
+	io_scheduler_h scheduler;   /// the scheduler through which the device is read, may be NULL
+	uint64_t device;            /// the inode of the device of the photo, as known to the scheduler
+	bool background;            /// whether all the reads are bulk
+
+	GMutex lock;                /// guards all of the fields below, as the kernel may read concurrently (but not the reads themselves)
+	int fd;                     /// the descriptor of the file backing the photo, -1 until it's needed, then never changes
+	size_t max_readahead;       /// the maximum size of the readahead window, 0 if it's disabled
+	size_t readahead;           /// the current size of the readahead window, 0 if the access is not sequential
+	off_t next_offset;          /// the offset at which the next sequential read would begin
+	char* window;               /// the data read ahead
+	off_t window_offset;        /// the offset of the data read ahead within the photo
+	size_t window_length;       /// the length of the data read ahead
+	bool window_eof;            /// whether the data read ahead reaches the end of the photo
+};
+
+// acquires the descriptor on its first use, after which it may be read without the lock
+static bool acquire_fd(photo_file_h handle)
+{
+	g_mutex_lock(&handle->lock);
+
+	if (handle->fd == -1)
+	{
+		handle->fd = fd_pool_acquire(handle->fds, photo_get_inode(handle->photo), photo_get_location(handle->photo));
+	}
+
+	bool acquired = (handle->fd != -1);
+
+	g_mutex_unlock(&handle->lock);
+	return acquired;
+}
+
+photo_file_h photo_file_open(const photo_h photo, const photo_file_context_t* context)
+{
+	ASSERT_RET(photo != NULL, NULL);
+	ASSERT_RET(context != NULL, NULL);
+	ASSERT_RET(context->fds != NULL, NULL);
+
+	photo_file_h handle = (photo_file_h) calloc(1, sizeof(struct photo_file_s));
+	if (handle == NULL)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	handle->photo = photo_ref(photo);
+	handle->fds = context->fds;
+	handle->fd = -1;
+	handle->max_readahead = context->readahead;
+	handle->scheduler = context->scheduler;
+	handle->device = inode_get_device(photo_get_inode(photo));
+	handle->background = context->background;
+	g_mutex_init(&handle->lock);
+
+	// the catalog is the authoritative source of the size and modification time, the backing
+	// file is only consulted for the photos the catalog knows nothing about
+	struct stat st;
+	bool known = (context->cache != NULL && photo_get_stat(photo, &st));
+
+	if (!known && !acquire_fd(handle))
+	{
+		int error = errno;
+		photo_file_close(handle);
+		errno = error;
+		return NULL;
+	}
+
+	if (!known && context->cache != NULL)
+	{
+		io_scheduler_begin(handle->scheduler, IO_CLASS_METADATA, handle->device);
+		known = (fstat(handle->fd, &st) == 0);
+		io_scheduler_end(handle->scheduler, IO_CLASS_METADATA, handle->device);
+	}
+
+	if (context->cache != NULL && known)
+	{
+		handle->cache = context->cache;
+		handle->key.inode = photo_get_inode(photo);
+		handle->key.size = st.st_size;
+		handle->key.mtime = st.st_mtime;
+	}
+
+	return handle;
+}
+
+// must be called with the lock held, returns whether the read continues the previous one
+static bool account_read(photo_file_h handle, size_t size, off_t offset)
+{
+	bool sequential = (offset == handle->next_offset);
+
+	if (!sequential)
+	{
+		handle->readahead = 0;
+	}
+	else if (handle->max_readahead > 0)
+	{
+		handle->readahead = MIN(MAX(handle->readahead * 2, INITIAL_READAHEAD), handle->max_readahead);
+	}
+
+	handle->next_offset = offset + size;
+	return sequential;
+}
+
+int photo_file_get_direct_fd(photo_file_h handle, size_t size, off_t offset)
+{
+	ASSERT_RET(handle != NULL, -1);
+
+	if (handle->cache != NULL)
+	{
+		return -1;
+	}
+
+	int fd = -1;
+
+	g_mutex_lock(&handle->lock);
+
+	// a sequential read will be served from the readahead window
+	if (offset != handle->next_offset || handle->max_readahead == 0)
+	{
+		account_read(handle, size, offset);
+		fd = handle->fd;
+	}
+
+	g_mutex_unlock(&handle->lock);
+	return fd;
+}
+
+// reads as much of a range as possible, retrying the short reads
+static ssize_t read_fully(int fd, char* buffer, size_t size, off_t offset)
+{
+	size_t done = 0;
+
+	while (done < size)
+	{
+		ssize_t result = pread(fd, buffer + done, size - done, offset + done);
+		if (result == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return -1;
+		}
+
+		if (result == 0)
+		{
+			break;
+		}
+
+		done += result;
+	}
+
+	return done;
+}
+
+// reads a range from the device once the scheduler lets it through
+static ssize_t read_device(photo_file_h handle, char* buffer, size_t size, off_t offset, io_class_e io_class)
+{
+	io_scheduler_begin(handle->scheduler, io_class, handle->device);
+	ssize_t result = read_fully(handle->fd, buffer, size, offset);
+	int error = errno;
+	io_scheduler_end(handle->scheduler, io_class, handle->device);
+
+	errno = error;
+	return result;
+}
+
+// reads the whole block from the device, stores it in the cache and copies out the requested range
+static ssize_t fill_block(photo_file_h handle, const block_cache_key_t* key, char* buffer, size_t offset, size_t size, io_class_e io_class)
+{
+	if (!acquire_fd(handle))
+	{
+		return -1;
+	}
+
+	char* block = (char*) malloc(BLOCK_CACHE_BLOCK_SIZE);
+	if (block == NULL)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	ssize_t length = read_device(handle, block, BLOCK_CACHE_BLOCK_SIZE, (off_t) key->block * BLOCK_CACHE_BLOCK_SIZE, io_class);
+	if (length == -1)
+	{
+		int error = errno;
+		free(block);
+		errno = error;
+		return -1;
+	}
+
+	if (length > 0)
+	{
+		block_cache_write(handle->cache, key, block, length);
+	}
+
+	ssize_t result = 0;
+	if ((size_t) length > offset)
+	{
+		result = MIN((size_t) length - offset, size);
+		memcpy(buffer, block + offset, result);
+	}
+
+	free(block);
+	return result;
+}
+
+static ssize_t read_backend(photo_file_h handle, void* buffer, size_t size, off_t offset, io_class_e io_class)
+{
+	if (handle->background)
+	{
+		io_class = IO_CLASS_BULK;
+	}
+
+	if (handle->cache == NULL)
+	{
+		return read_device(handle, (char*) buffer, size, offset, io_class);
+	}
+
+	size_t done = 0;
+
+	while (done < size)
+	{
+		off_t position = offset + done;
+
+		block_cache_key_t key = handle->key;
+		key.block = position / BLOCK_CACHE_BLOCK_SIZE;
+
+		size_t block_offset = position % BLOCK_CACHE_BLOCK_SIZE;
+		size_t chunk = MIN(size - done, BLOCK_CACHE_BLOCK_SIZE - block_offset);
+
+		ssize_t result = block_cache_read(handle->cache, &key, (char*) buffer + done, block_offset, chunk);
+		if (result == -1)
+		{
+			result = fill_block(handle, &key, (char*) buffer + done, block_offset, chunk, io_class);
+		}
+
+		if (result == -1)
+		{
+			// report the error only if nothing could be read
+			return done > 0 ? (ssize_t) done : -1;
+		}
+
+		done += result;
+
+		if ((size_t) result < chunk)
+		{
+			// the end of the photo
+			break;
+		}
+	}
+
+	return done;
+}
+
+// must be called with the lock held, returns the number of bytes copied or -1 if the window doesn't cover the range
+static ssize_t read_window(photo_file_h handle, void* buffer, size_t size, off_t offset)
+{
+	if (handle->window_length == 0 || offset < handle->window_offset ||
+			offset >= handle->window_offset + (off_t) handle->window_length)
+	{
+		return -1;
+	}
+
+	size_t available = handle->window_offset + handle->window_length - offset;
+	if (available < size && !handle->window_eof)
+	{
+		return -1;
+	}
+
+	size_t length = MIN(available, size);
+	memcpy(buffer, handle->window + (offset - handle->window_offset), length);
+
+	return length;
+}
+
+ssize_t photo_file_read(photo_file_h handle, void* buffer, size_t size, off_t offset)
+{
+	ASSERT_RET(handle != NULL, -1);
+	ASSERT_RET(buffer != NULL, -1);
+
+	size_t readahead = 0;
+
+	// the lock only covers the state of the window, the device is read without it, so that the
+	// other reads of the photo aren't held up by a slow one
+	g_mutex_lock(&handle->lock);
+
+	ssize_t result = read_window(handle, buffer, size, offset);
+
+	if (result != -1)
+	{
+		handle->next_offset = offset + result;
+	}
+	else if (account_read(handle, size, offset) && handle->readahead > size)
+	{
+		readahead = handle->readahead;
+	}
+
+	g_mutex_unlock(&handle->lock);
+
+	if (readahead > 0)
+	{
+		// the reading is sequential, so fetch a whole window ahead; only the requested range is
+		// waited for by the caller, the speculative tail goes behind the other interactive reads
+		char* window = (char*) malloc(readahead);
+		ssize_t length = (window != NULL) ? read_backend(handle, window, size, offset, IO_CLASS_INTERACTIVE) : -1;
+		bool eof = (length != -1 && (size_t) length < size);
+
+		if (length != -1 && !eof)
+		{
+			ssize_t tail = read_backend(handle, window + length, readahead - length, offset + length, IO_CLASS_BULK);
+			if (tail != -1)
+			{
+				length += tail;
+				eof = ((size_t) length < readahead);
+			}
+		}
+
+		if (length != -1)
+		{
+			g_mutex_lock(&handle->lock);
+
+			free(handle->window);
+			handle->window = window;
+			handle->window_offset = offset;
+			handle->window_length = length;
+			handle->window_eof = eof;
+			window = NULL;
+
+			result = read_window(handle, buffer, size, offset);
+			if (result == -1)
+			{
+				// nothing could be read beyond the end of the photo
+				result = 0;
+			}
+
+			g_mutex_unlock(&handle->lock);
+		}
+
+		free(window);
+	}
+
+	if (result == -1)
+	{
+		result = read_backend(handle, buffer, size, offset, IO_CLASS_INTERACTIVE);
+	}
+
+	return result;
+}
+
+void photo_file_close(photo_file_h handle)
+{
+	if (handle)
+	{
+		if (handle->fd != -1)
+		{
+			fd_pool_release(handle->fds, photo_get_inode(handle->photo), handle->fd);
+		}
+
+		photo_unref(handle->photo);
+		g_mutex_clear(&handle->lock);
+		free(handle->window);
+		free(handle);
+	}
+}
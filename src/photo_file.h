@@ -0,0 +1,82 @@
+/*
+ * A photo opened for reading by the filesystem. Depending on the configuration, the contents
+ * of the photo are either read directly from the device, or through the block cache (see
+ * block_cache.h), in which case only the blocks which haven't been cached yet are read from
+ * the device.
+ *
+ * Every read from the device is a round trip over USB, therefore once the photo is read
+ * sequentially, the small reads requested by the kernel are merged into a readahead window,
+ * which doubles with every subsequent sequential read up to the configured maximum.
+ *
+ * The reads from the device go through the I/O scheduler (see io_scheduler.h): the reads requested
+ * by users are interactive, while the readahead windows and the reads of the background contexts
+ * (i.e. of the prefetcher) are bulk.
+ */
+
+#pragma once
+
+#include "photo.h"
+#include "fd_pool.h"
+#include "block_cache.h"
+#include "io_scheduler.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * The facilities shared by all the opened photos
+ */
+typedef struct photo_file_context_s
+{
+	fd_pool_h fds;              /// the pool of the descriptors of the files backing the photos
+	block_cache_h cache;        /// the block cache through which the photos are read, NULL if they are read directly
+	size_t readahead;           /// the maximum size of the readahead window, 0 if the reads shouldn't be merged
+	io_scheduler_h scheduler;   /// the scheduler through which the device is read, NULL if it's read immediately
+	bool background;            /// whether no one waits for the reads, so that all of them are bulk
+} photo_file_context_t;
+
+/**
+ * A handle of an opened photo
+ */
+typedef struct photo_file_s* photo_file_h;
+
+/**
+ * Open a photo for reading
+ * @param photo a valid handle of the photo which should be opened
+ * @param context the facilities through which the photo should be read, which must outlive the opened photo
+ * @return a handle of the opened photo or NULL on error, in which case errno is set appropriately
+ * @note when the photo is read through the block cache and its size and modification time are
+ * known from the catalog, the backing file is opened only once a block which isn't cached is read
+ */
+photo_file_h photo_file_open(const photo_h photo, const photo_file_context_t* context);
+
+/**
+ * Get the descriptor of the file backing the opened photo, if the passed range may be read from
+ * it directly (e.g. spliced by FUSE), bypassing photo_file_read(). That is the case when the photo
+ * is not cached and the range isn't a part of a sequential read served from the readahead window.
+ * @param handle a valid handle of an opened photo
+ * @param size the size of the range which is about to be read
+ * @param offset the offset of the range which is about to be read
+ * @return the descriptor of the backing file, or -1 if the range must be read with photo_file_read()
+ * @note if a descriptor is returned, the read is assumed to take place, so that the subsequent reads
+ * are recognized as sequential. The caller is responsible for scheduling it (see io_scheduler_begin()).
+ */
+int photo_file_get_direct_fd(photo_file_h handle, size_t size, off_t offset);
+
+/**
+ * Read a range of the opened photo, in the same way as pread() does
+ * @param handle a valid handle of an opened photo
+ * @param[out] buffer the buffer which should be filled with the data
+ * @param size the number of bytes which should be read
+ * @param offset the offset within the photo where the reading should begin
+ * @return the number of bytes read (less than size only at the end of the photo), or -1 on error,
+ * in which case errno is set appropriately
+ * @note this function is thread-safe
+ */
+ssize_t photo_file_read(photo_file_h handle, void* buffer, size_t size, off_t offset);
+
+/**
+ * Close the opened photo
+ * @param handle a handle of an opened photo which should be closed
+ */
+void photo_file_close(photo_file_h handle);
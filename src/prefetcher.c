@@ -0,0 +1,214 @@
+#include "prefetcher.h"
+#include "logger.h"
+
+#include <glib.h>
+#include <stdlib.h>
+
+/**
+ * A single photo queued for prefetching
+ */
+typedef struct prefetch_job_s
+{
+	uint64_t inode;             /// the inode of the photo (also the key in prefetcher_s::pending)
+	photo_h photo;
+	unsigned int generation;    /// the generation in which the photo has been requested most recently
+} prefetch_job_t;
+
+/**
+ * A structure behind prefetcher_h handle
+ */
+struct prefetcher_s
+{
+	photo_file_context_t files; /// the facilities through which the photos are read into the block cache
+	unsigned int depth;         /// the number of photos prefetched after each opened one
+	uint64_t budget;            /// the number of bytes which may be prefetched after each opened photo
+	GThreadPool* workers;       /// the thread prefetching the queued photos
+
+	GMutex lock;                /// guards all of the fields below
+	GHashTable* pending;        /// photos queued for prefetching <inode, job> [uint64_t*, prefetch_job_t*]
+	unsigned int generation;    /// incremented with every opened photo, older jobs are abandoned
+	uint64_t budget_left;       /// the number of bytes which may still be prefetched in this generation
+	uint64_t last_album;        /// the inode of the album of the most recently opened photo
+	int last_index;             /// the position of the most recently opened photo within its album
+};
+
+static void prefetch_job_free(prefetch_job_t* job)
+{
+	photo_unref(job->photo);
+	free(job);
+}
+
+// reserves the bytes which may be prefetched next, returns 0 once the job has been abandoned
+static size_t prefetch_reserve(prefetcher_h handle, const prefetch_job_t* job, size_t size)
+{
+	g_mutex_lock(&handle->lock);
+
+	size_t reserved = 0;
+	if (job->generation == handle->generation)
+	{
+		reserved = MIN(size, handle->budget_left);
+		handle->budget_left -= reserved;
+	}
+
+	g_mutex_unlock(&handle->lock);
+	return reserved;
+}
+
+static void prefetch_photo(prefetcher_h handle, const prefetch_job_t* job)
+{
+	// don't even open the photo if the job has already been abandoned
+	size_t size = prefetch_reserve(handle, job, BLOCK_CACHE_BLOCK_SIZE);
+	if (size == 0)
+	{
+		return;
+	}
+
+	photo_file_h file = photo_file_open(job->photo, &handle->files);
+	char* buffer = (char*) malloc(BLOCK_CACHE_BLOCK_SIZE);
+	off_t offset = 0;
+
+	if (file != NULL && buffer != NULL)
+	{
+		// reading the photo through the block cache is all it takes to have it cached
+		do
+		{
+			ssize_t result = photo_file_read(file, buffer, size, offset);
+			if (result < (ssize_t) size)
+			{
+				break;
+			}
+
+			offset += result;
+		}
+		while ((size = prefetch_reserve(handle, job, BLOCK_CACHE_BLOCK_SIZE)) > 0);
+
+		LOG_DEBUG("Prefetched %lld bytes of %s", (long long) offset, photo_get_location(job->photo));
+	}
+
+	free(buffer);
+	photo_file_close(file);
+}
+
+static void prefetch_worker(gpointer data, gpointer user_data)
+{
+	prefetch_job_t* job = (prefetch_job_t*) data;
+	prefetcher_h handle = (prefetcher_h) user_data;
+
+	prefetch_photo(handle, job);
+
+	g_mutex_lock(&handle->lock);
+	g_hash_table_remove(handle->pending, &job->inode);
+	g_mutex_unlock(&handle->lock);
+
+	prefetch_job_free(job);
+}
+
+prefetcher_h prefetcher_create(const photo_file_context_t* context, unsigned int depth, uint64_t budget)
+{
+	ASSERT_RET(context != NULL, NULL);
+	ASSERT_RET(context->cache != NULL, NULL);
+
+	prefetcher_h handle = (prefetcher_h) calloc(1, sizeof(struct prefetcher_s));
+	ASSERT_RET(handle != NULL, NULL);
+
+	handle->files = *context;
+	handle->files.readahead = 0;
+	handle->files.background = true;
+	handle->depth = depth;
+	handle->budget = budget;
+	g_mutex_init(&handle->lock);
+	handle->pending = g_hash_table_new(g_int64_hash, g_int64_equal);
+	handle->last_index = -1;
+
+	// a single thread, as the photos are expected to be opened in the order they are queued and
+	// there is no point in competing for the device with the reads which have actually been requested
+	handle->workers = g_thread_pool_new(prefetch_worker, handle, 1, FALSE, NULL);
+
+	if (handle->workers == NULL)
+	{
+		LOG_ERROR("Unable to start the prefetcher");
+		prefetcher_free(handle);
+		return NULL;
+	}
+
+	return handle;
+}
+
+void prefetcher_notify_open(prefetcher_h handle, const album_h album, const photo_h photo)
+{
+	ASSERT_RET(handle != NULL);
+	ASSERT_RET(album != NULL);
+	ASSERT_RET(photo != NULL);
+
+	int index = album_get_sorted_index(album, photo);
+	if (index == -1)
+	{
+		return;
+	}
+
+	g_mutex_lock(&handle->lock);
+
+	// keep moving backwards if the user has just stepped back within the same album
+	int direction = (album_get_inode(album) == handle->last_album && index < handle->last_index) ? -1 : 1;
+
+	handle->last_album = album_get_inode(album);
+	handle->last_index = index;
+	handle->generation++;
+	handle->budget_left = handle->budget;
+
+	for (unsigned int i = 1; i <= handle->depth; i++)
+	{
+		photo_h next = album_get_sorted_photo_at(album, index + direction * (int) i);
+		if (next == NULL)
+		{
+			break;
+		}
+
+		uint64_t inode = photo_get_inode(next);
+		prefetch_job_t* job = (prefetch_job_t*) g_hash_table_lookup(handle->pending, &inode);
+
+		if (job != NULL)
+		{
+			// already queued, just keep it from being abandoned
+			job->generation = handle->generation;
+			photo_unref(next);
+			continue;
+		}
+
+		job = (prefetch_job_t*) malloc(sizeof(prefetch_job_t));
+		if (job == NULL)
+		{
+			photo_unref(next);
+			break;
+		}
+
+		job->inode = inode;
+		job->photo = next;
+		job->generation = handle->generation;
+
+		g_hash_table_insert(handle->pending, &job->inode, job);
+		g_thread_pool_push(handle->workers, job, NULL);
+	}
+
+	g_mutex_unlock(&handle->lock);
+}
+
+void prefetcher_free(prefetcher_h handle)
+{
+	if (handle)
+	{
+		if (handle->workers != NULL)
+		{
+			// abandon all the queued jobs, so that the workers finish quickly
+			g_mutex_lock(&handle->lock);
+			handle->generation++;
+			g_mutex_unlock(&handle->lock);
+
+			g_thread_pool_free(handle->workers, FALSE, TRUE);
+		}
+
+		g_hash_table_unref(handle->pending);
+		g_mutex_clear(&handle->lock);
+		free(handle);
+	}
+}
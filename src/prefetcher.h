@@ -0,0 +1,47 @@
+/*
+ * Image viewers and importers usually open the photos of an album one after another. This module
+ * watches the photos being opened and reads the ones which are most likely to be opened next
+ * into the block cache (see block_cache.h) in the background, so that they are already local by
+ * the time they are actually requested. The photos are predicted from the order in which the
+ * albums are listed, in the direction in which the user has been moving recently.
+ */
+
+#pragma once
+
+#include "album.h"
+#include "photo.h"
+#include "photo_file.h"
+
+#include <stdint.h>
+
+/**
+ * A handle of a prefetcher
+ */
+typedef struct prefetcher_s* prefetcher_h;
+
+/**
+ * Create a new prefetcher
+ * @param context the facilities through which the photos are opened, which must include a block
+ * cache (into which the photos are prefetched) and must outlive the prefetcher
+ * @param depth the number of photos which should be prefetched after each opened one
+ * @param budget the maximum number of bytes which may be prefetched after each opened photo
+ * @return a handle of the prefetcher or NULL on error
+ */
+prefetcher_h prefetcher_create(const photo_file_context_t* context, unsigned int depth, uint64_t budget);
+
+/**
+ * Notify the prefetcher that a photo has been opened, so that the photos following it are
+ * prefetched. The photos queued after the previously opened photo, which are no longer expected
+ * to be opened, are abandoned.
+ * @param handle a valid handle of a prefetcher
+ * @param album the album through which the photo has been opened
+ * @param photo the opened photo
+ * @note this function is thread-safe and returns immediately
+ */
+void prefetcher_notify_open(prefetcher_h handle, const album_h album, const photo_h photo);
+
+/**
+ * Free the prefetcher, waiting for the photo being currently prefetched (if any)
+ * @param handle a handle of a prefetcher which should be freed
+ */
+void prefetcher_free(prefetcher_h handle);
@@ -0,0 +1,149 @@
+#include "session_loop.h"
+#include "logger.h"
+
+#define FUSE_USE_VERSION 29
+
+#include <fuse_lowlevel.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdlib.h>
+
+/**
+ * State shared by all worker threads of a single session loop
+ */
+typedef struct session_loop_s
+{
+	struct fuse_session* se;        /// the session being served
+	struct fuse_chan* ch;           /// the channel of the session from which requests are retrieved
+	sem_t finish;                   /// posted by a worker when the session should be terminated
+	bool failed;                    /// set when any worker encountered an unrecoverable error
+} session_loop_t;
+
+static void* session_loop_worker(void* user_data)
+{
+	session_loop_t* loop = (session_loop_t*) user_data;
+
+	size_t buffer_size = fuse_chan_bufsize(loop->ch);
+	char* buffer = malloc(buffer_size);
+
+	if (buffer == NULL)
+	{
+		LOG_ERROR("Unable to allocate a request buffer for the filesystem worker");
+		loop->failed = true;
+		fuse_session_exit(loop->se);
+		sem_post(&loop->finish);
+		return NULL;
+	}
+
+	while (!fuse_session_exited(loop->se))
+	{
+		struct fuse_chan* ch = loop->ch;
+		struct fuse_buf fbuf = {
+			.mem = buffer,
+			.size = buffer_size
+		};
+
+		// only allow the thread to be cancelled while it's waiting for a new request
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		int res = fuse_session_receive_buf(loop->se, &fbuf, &ch);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (res == -EINTR)
+		{
+			continue;
+		}
+
+		if (res <= 0)
+		{
+			// zero means the filesystem has been unmounted
+			if (res < 0)
+			{
+				loop->failed = true;
+			}
+			break;
+		}
+
+		fuse_session_process_buf(loop->se, &fbuf, ch);
+	}
+
+	free(buffer);
+
+	fuse_session_exit(loop->se);
+	sem_post(&loop->finish);
+	return NULL;
+}
+
+bool session_loop_run(struct fuse_session* se, unsigned int workers)
+{
+	ASSERT_RET(se != NULL, false);
+	ASSERT_RET(workers > 0, false);
+
+	session_loop_t loop = {
+		.se = se,
+		.ch = fuse_session_next_chan(se, NULL),
+		.failed = false
+	};
+
+	ASSERT_RET(loop.ch != NULL, false);
+
+	pthread_t* threads = calloc(workers, sizeof(pthread_t));
+	ASSERT_RET(threads != NULL, false);
+
+	sem_init(&loop.finish, 0, 0);
+
+	// the workers must not receive the signals handled by libfuse, otherwise the loop below would never notice them
+	sigset_t all_signals, previous_signals;
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_BLOCK, &all_signals, &previous_signals);
+
+	unsigned int started = 0;
+	for (; started < workers; started++)
+	{
+		if (pthread_create(&threads[started], NULL, session_loop_worker, &loop) != 0)
+		{
+			LOG_ERROR("Unable to start filesystem worker %u of %u", started + 1, workers);
+			loop.failed = true;
+			fuse_session_exit(se);
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+
+	LOG_DEBUG("Serving filesystem requests with %u worker thread(s)", started);
+
+	while (!fuse_session_exited(se))
+	{
+		// interrupted either by a worker (unmount, error) or by a signal which exits the session
+		sem_wait(&loop.finish);
+	}
+
+	for (unsigned int i = 0; i < started; i++)
+	{
+		pthread_cancel(threads[i]);
+	}
+
+	for (unsigned int i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	sem_destroy(&loop.finish);
+	free(threads);
+
+	return !loop.failed;
+}
+
+void session_loop_configure(struct fuse_conn_info* conn)
+{
+	ASSERT_RET(conn != NULL);
+
+	// despite the naming, SPLICE_WRITE lets libfuse splice the replies into the device, while
+	// SPLICE_READ would only splice the incoming requests, which are tiny for a read-only filesystem
+	unsigned int splice = conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+	conn->want |= splice;
+
+	LOG_DEBUG("Splicing of the read replies is %s", (splice & FUSE_CAP_SPLICE_WRITE) ? "enabled" : "not supported");
+}
@@ -0,0 +1,32 @@
+/*
+ * This module replaces the session loops provided by libfuse. The multithreaded loop of
+ * libfuse spawns threads on demand and offers no way to limit their number, therefore
+ * ipa serves its FUSE sessions with a fixed pool of worker threads instead.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+struct fuse_session;
+struct fuse_conn_info;
+
+/**
+ * Serve the requests of a FUSE session using a fixed number of worker threads. This function
+ * blocks until the session is exited, i.e. until the filesystem is unmounted or the process
+ * receives one of the signals handled by libfuse.
+ * @param se a valid FUSE session with an attached channel
+ * @param workers the number of threads which should be serving the requests (at least one)
+ * @return true if the session finished gracefully, false on error
+ * @note the worker threads are started with all signals blocked, so that the signals are
+ * always delivered to the calling thread
+ */
+bool session_loop_run(struct fuse_session* se, unsigned int workers);
+
+/**
+ * Negotiate the capabilities of a FUSE connection which are common to all the engines, i.e.
+ * the replies to read requests being spliced from the backing files directly into /dev/fuse.
+ * This function should be called from the init callback of an engine.
+ * @param conn the connection information passed to the init callback
+ */
+void session_loop_configure(struct fuse_conn_info* conn);
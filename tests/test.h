@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdio.h>
+
+/**
+ * The number of the failed checks of the running test
+ */
+static int test_failures = 0;
+
+// reports a failed check without stopping the test, so that all the failures are listed at once
+#define CHECK(stmt) do { if (!(stmt)) { \
+	fprintf(stderr, "[FAIL] %s [%s@%s:%d]\n", #stmt, __func__, __FILE__, __LINE__); \
+	test_failures++; \
+} } while(0)
+
+// the exit code of a test
+#define TEST_RESULT() (test_failures == 0 ? 0 : 1)
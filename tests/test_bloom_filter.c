@@ -0,0 +1,107 @@
+#include "test.h"
+#include "bloom_filter.h"
+
+#include <stdio.h>
+
+#define NAME_LENGTH 32
+
+static void make_name(unsigned int i, char* name)
+{
+	snprintf(name, NAME_LENGTH, "IMG_%04u.JPG", i);
+}
+
+static bool contains_all(bloom_filter_h filter, unsigned int count)
+{
+	char name[NAME_LENGTH];
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		make_name(i, name);
+		if (!bloom_filter_may_contain(filter, name))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void test_empty(void)
+{
+	bloom_filter_h empty = bloom_filter_create(0);
+
+	CHECK(empty != NULL);
+	CHECK(bloom_filter_get_capacity(empty) == 0);
+	CHECK(!bloom_filter_may_contain(empty, "IMG_0001.JPG"));
+	CHECK(!bloom_filter_may_contain(empty, ""));
+
+	bloom_filter_free(empty);
+}
+
+// the names are added one by one and the filter is rebuilt twice as large whenever it's full,
+// the same as by the albums, and none of the names may ever be reported as missing
+static void test_rebuilds(void)
+{
+	bloom_filter_h filter = NULL;
+	char name[NAME_LENGTH];
+	unsigned int rebuilds = 0;
+
+	for (unsigned int count = 0; count < 5000; count++)
+	{
+		if (filter == NULL || count >= bloom_filter_get_capacity(filter))
+		{
+			bloom_filter_free(filter);
+			filter = bloom_filter_create(filter == NULL ? 64 : count * 2);
+			rebuilds++;
+
+			for (unsigned int i = 0; i < count; i++)
+			{
+				make_name(i, name);
+				bloom_filter_add(filter, name);
+			}
+
+			CHECK(contains_all(filter, count));
+		}
+
+		make_name(count, name);
+		bloom_filter_add(filter, name);
+	}
+
+	CHECK(rebuilds > 5);
+	CHECK(contains_all(filter, 5000));
+
+	bloom_filter_free(filter);
+}
+
+// about 1% of the names which have never been added are reported as possibly present
+static void test_false_positives(void)
+{
+	bloom_filter_h filter = bloom_filter_create(1000);
+	char name[NAME_LENGTH];
+
+	for (unsigned int i = 0; i < 1000; i++)
+	{
+		make_name(i, name);
+		bloom_filter_add(filter, name);
+	}
+
+	unsigned int false_positives = 0;
+	for (unsigned int i = 0; i < 10000; i++)
+	{
+		snprintf(name, sizeof(name), "desktop-%u.ini", i);
+		false_positives += bloom_filter_may_contain(filter, name) ? 1 : 0;
+	}
+
+	CHECK(false_positives < 300);
+
+	bloom_filter_free(filter);
+}
+
+int main(void)
+{
+	test_empty();
+	test_rebuilds();
+	test_false_positives();
+
+	return TEST_RESULT();
+}
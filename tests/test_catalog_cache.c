@@ -0,0 +1,203 @@
+#include "test.h"
+#include "catalog_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEVICE_INODE 42
+
+static const catalog_key_t key = {
+	.db_size = 4096,
+	.db_mtime = 1500000000,
+	.change_counter = 7
+};
+
+// writes a catalog of two photos in two albums, the second photo belonging to both of them
+static bool write_catalog(const char* path)
+{
+	catalog_writer_h writer = catalog_writer_create();
+	if (writer == NULL)
+	{
+		return false;
+	}
+
+	catalog_photo_t first = { .file_name = "IMG_0001.JPG", .location = "/DCIM/100APPLE/IMG_0001.JPG", .inode = 1001, .asset_pk = 1 };
+	catalog_photo_t second = { .file_name = "IMG_0002.JPG", .location = "/DCIM/100APPLE/IMG_0002.JPG", .inode = 1002, .asset_pk = 2,
+			.has_stat = true, .size = 12345, .mtime = 1500000001, .ctime = 1500000002 };
+
+	uint32_t photos[] = { catalog_writer_add_photo(writer, &first), catalog_writer_add_photo(writer, &second) };
+
+	// added out of order, so that the sorting by name is exercised
+	catalog_album_t holidays = { .name = "Holidays", .inode = 2001, .photos = photos, .photo_count = 2 };
+	catalog_album_t favorites = { .name = "Favorites", .inode = 2002, .photos = &photos[1], .photo_count = 1 };
+
+	catalog_writer_add_album(writer, &holidays);
+	catalog_writer_add_album(writer, &favorites);
+
+	bool saved = catalog_writer_save(writer, path, DEVICE_INODE, &key);
+	catalog_writer_free(writer);
+
+	return saved;
+}
+
+static char* read_file(const char* path, size_t* size)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		return NULL;
+	}
+
+	fseek(file, 0, SEEK_END);
+	*size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	char* data = (char*) malloc(*size);
+	if (data != NULL && fread(data, 1, *size, file) != *size)
+	{
+		free(data);
+		data = NULL;
+	}
+
+	fclose(file);
+	return data;
+}
+
+static void write_file(const char* path, const char* data, size_t size)
+{
+	FILE* file = fopen(path, "wb");
+	if (file != NULL)
+	{
+		fwrite(data, 1, size, file);
+		fclose(file);
+	}
+}
+
+// whether the reader accepts the contents of a catalog file
+static bool accepts(const char* path, const char* data, size_t size)
+{
+	write_file(path, data, size);
+
+	catalog_reader_h reader = catalog_reader_open(path, DEVICE_INODE, &key);
+	catalog_reader_close(reader);
+
+	return reader != NULL;
+}
+
+static void test_read(const char* path)
+{
+	catalog_reader_h reader = catalog_reader_open(path, DEVICE_INODE, &key);
+	CHECK(reader != NULL);
+
+	if (reader == NULL)
+	{
+		return;
+	}
+
+	CHECK(catalog_reader_get_photo_count(reader) == 2);
+	CHECK(catalog_reader_get_album_count(reader) == 2);
+
+	catalog_album_t album;
+	CHECK(catalog_reader_get_album(reader, 0, &album) && strcmp(album.name, "Favorites") == 0);
+	CHECK(catalog_reader_find_album(reader, "Holidays", &album));
+	CHECK(album.inode == 2001 && album.photo_count == 2);
+	CHECK(!catalog_reader_find_album(reader, "Work", &album));
+
+	catalog_photo_t photo;
+	CHECK(catalog_reader_find_album(reader, "Favorites", &album) && album.photo_count == 1);
+	CHECK(catalog_reader_get_photo(reader, album.photos[0], &photo));
+	CHECK(strcmp(photo.file_name, "IMG_0002.JPG") == 0);
+	CHECK(photo.has_stat && photo.size == 12345);
+	CHECK(photo.album_count == 2);
+
+	catalog_reader_close(reader);
+}
+
+static void test_different_database(const char* path)
+{
+	catalog_key_t modified = key;
+	modified.change_counter++;
+
+	CHECK(catalog_reader_open(path, DEVICE_INODE, &modified) == NULL);
+	CHECK(catalog_reader_open(path, DEVICE_INODE + 1, &key) == NULL);
+}
+
+static void test_truncated(const char* path, const char* data, size_t size)
+{
+	for (size_t length = 0; length < size; length++)
+	{
+		CHECK(!accepts(path, data, length));
+	}
+
+	// the same goes for any trailing garbage
+	char* extended = (char*) calloc(1, size + 1);
+	if (extended != NULL)
+	{
+		memcpy(extended, data, size);
+		CHECK(!accepts(path, extended, size + 1));
+		free(extended);
+	}
+}
+
+static void test_corrupted(const char* path, const char* data, size_t size)
+{
+	char* corrupted = (char*) malloc(size);
+	if (corrupted == NULL)
+	{
+		return;
+	}
+
+	// the magic
+	memcpy(corrupted, data, size);
+	corrupted[0] ^= 0xFF;
+	CHECK(!accepts(path, corrupted, size));
+
+	// the format version, which follows the magic
+	memcpy(corrupted, data, size);
+	corrupted[8] ^= 0xFF;
+	CHECK(!accepts(path, corrupted, size));
+
+	// the last string isn't terminated
+	memcpy(corrupted, data, size);
+	corrupted[size - 1] = 'x';
+	CHECK(!accepts(path, corrupted, size));
+
+	free(corrupted);
+}
+
+int main(void)
+{
+	char directory[] = "/tmp/ipa-test-XXXXXX";
+	if (mkdtemp(directory) == NULL)
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+
+	char path[sizeof(directory) + 16];
+	snprintf(path, sizeof(path), "%s/catalog", directory);
+
+	size_t size = 0;
+	char* data = NULL;
+
+	CHECK(write_catalog(path));
+	CHECK((data = read_file(path, &size)) != NULL);
+
+	if (data != NULL)
+	{
+		test_read(path);
+		test_different_database(path);
+		test_truncated(path, data, size);
+		test_corrupted(path, data, size);
+
+		// the original catalog is accepted again, so the above were rejected for their contents
+		CHECK(accepts(path, data, size));
+		free(data);
+	}
+
+	unlink(path);
+	rmdir(directory);
+
+	return TEST_RESULT();
+}
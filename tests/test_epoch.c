@@ -0,0 +1,156 @@
+#include "test.h"
+
+// the records of the readers are private to the module, so it's included rather than linked
+#include "../src/epoch.c"
+
+// the time (in microseconds) for which a retirement which should wait is given to finish prematurely
+#define SETTLE_TIME 50000
+
+typedef struct
+{
+	epoch_h epoch;
+	gint entered;               /// set by the reader once it's within its critical section
+	gint leave;                 /// set when the reader should leave its critical section
+} reader_params_t;
+
+static gpointer reader_thread(gpointer data)
+{
+	reader_params_t* params = (reader_params_t*) data;
+
+	epoch_enter(params->epoch);
+	g_atomic_int_set(&params->entered, 1);
+
+	while (!g_atomic_int_get(&params->leave))
+	{
+		g_usleep(1000);
+	}
+
+	epoch_leave(params->epoch);
+	return NULL;
+}
+
+static void mark_destroyed(void* data)
+{
+	g_atomic_int_set((gint*) data, 1);
+}
+
+typedef struct
+{
+	epoch_h epoch;
+	gint destroyed;             /// set once the retired data is freed
+} retire_params_t;
+
+static gpointer retire_thread(gpointer data)
+{
+	retire_params_t* params = (retire_params_t*) data;
+	epoch_retire(params->epoch, &params->destroyed, mark_destroyed);
+	return NULL;
+}
+
+static unsigned int count_readers(epoch_h epoch)
+{
+	unsigned int count = 0;
+	for (epoch_reader_t* reader = epoch->readers; reader != NULL; reader = reader->next)
+	{
+		count++;
+	}
+
+	return count;
+}
+
+// the data is freed right away when no reader is within its critical section
+static void test_retire_without_readers(void)
+{
+	epoch_h epoch = epoch_create();
+	gint destroyed = 0;
+
+	epoch_enter(epoch);
+	epoch_enter(epoch);
+	epoch_leave(epoch);
+	epoch_leave(epoch);
+
+	epoch_retire(epoch, &destroyed, mark_destroyed);
+	CHECK(destroyed == 1);
+
+	epoch_free(epoch);
+}
+
+// the data isn't freed until a reader which has entered before it was retired leaves
+static void test_retire_waits_for_reader(void)
+{
+	epoch_h epoch = epoch_create();
+	reader_params_t reader = { .epoch = epoch };
+	retire_params_t retire = { .epoch = epoch };
+
+	GThread* reader_handle = g_thread_new("reader", reader_thread, &reader);
+	while (!g_atomic_int_get(&reader.entered))
+	{
+		g_usleep(1000);
+	}
+
+	GThread* retire_handle = g_thread_new("retire", retire_thread, &retire);
+	g_usleep(SETTLE_TIME);
+	CHECK(!g_atomic_int_get(&retire.destroyed));
+
+	g_atomic_int_set(&reader.leave, 1);
+	g_thread_join(retire_handle);
+	CHECK(g_atomic_int_get(&retire.destroyed));
+
+	g_thread_join(reader_handle);
+	epoch_free(epoch);
+}
+
+static gpointer short_reader_thread(gpointer data)
+{
+	epoch_h epoch = (epoch_h) data;
+
+	epoch_enter(epoch);
+	epoch_leave(epoch);
+	return NULL;
+}
+
+// the threads which have exited leave their records to the next ones, instead of adding one each
+static void test_records_reused(void)
+{
+	epoch_h epoch = epoch_create();
+
+	for (unsigned int i = 0; i < 100; i++)
+	{
+		g_thread_join(g_thread_new("reader", short_reader_thread, epoch));
+	}
+
+	CHECK(count_readers(epoch) == 1);
+
+	// a thread which still lives keeps its record, so the next one takes another
+	reader_params_t reader = { .epoch = epoch };
+	GThread* reader_handle = g_thread_new("reader", reader_thread, &reader);
+	while (!g_atomic_int_get(&reader.entered))
+	{
+		g_usleep(1000);
+	}
+
+	g_thread_join(g_thread_new("reader", short_reader_thread, epoch));
+	CHECK(count_readers(epoch) == 2);
+
+	// the exited threads are quiescent, so only the one within its critical section holds up a retirement
+	retire_params_t retire = { .epoch = epoch };
+	GThread* retire_handle = g_thread_new("retire", retire_thread, &retire);
+	g_usleep(SETTLE_TIME);
+	CHECK(!g_atomic_int_get(&retire.destroyed));
+
+	g_atomic_int_set(&reader.leave, 1);
+	g_thread_join(retire_handle);
+	g_thread_join(reader_handle);
+	CHECK(g_atomic_int_get(&retire.destroyed));
+
+	epoch_free(epoch);
+}
+
+int main(void)
+{
+	test_retire_without_readers();
+	test_retire_waits_for_reader();
+	test_records_reused();
+
+	return TEST_RESULT();
+}
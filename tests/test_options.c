@@ -0,0 +1,109 @@
+#include "test.h"
+#include "options.h"
+
+#include <getopt.h>
+#include <string.h>
+
+#define ARGC(argv) ((int) (sizeof(argv) / sizeof(argv[0])))
+
+// parses the arguments anew, getopt keeps its state between the calls otherwise
+static bool parse(int argc, char* argv[], options_t* options)
+{
+	optind = 0;
+	return options_parse(argc, argv, options);
+}
+
+static void test_defaults(void)
+{
+	char* argv[] = { "ipa", "/mnt" };
+	options_t options;
+
+	CHECK(parse(ARGC(argv), argv, &options));
+	CHECK(strcmp(options.mount_location, "/mnt") == 0);
+	CHECK(options.engine == ENGINE_PATH);
+	CHECK(options.attr_ttl == 60);
+	CHECK(options.attr_threads == 8);
+}
+
+static void test_engine(void)
+{
+	char* inode[] = { "ipa", "-e", "inode", "/mnt" };
+	char* unknown[] = { "ipa", "-e", "unknown", "/mnt" };
+	options_t options;
+
+	CHECK(parse(ARGC(inode), inode, &options));
+	CHECK(options.engine == ENGINE_INODE);
+
+	CHECK(!parse(ARGC(unknown), unknown, &options));
+}
+
+// choosing the engine must not reset the options which precede it
+static void test_engine_keeps_attributes(void)
+{
+	char* argv[] = { "ipa", "--attr-ttl=5", "--attr-threads=2", "-e", "path", "/mnt" };
+	options_t options;
+
+	CHECK(parse(ARGC(argv), argv, &options));
+	CHECK(options.engine == ENGINE_PATH);
+	CHECK(options.attr_ttl == 5);
+	CHECK(options.attr_threads == 2);
+}
+
+static void test_attributes(void)
+{
+	char* disabled[] = { "ipa", "--attr-ttl=0", "/mnt" };
+	char* no_threads[] = { "ipa", "--attr-threads=0", "/mnt" };
+	char* not_a_number[] = { "ipa", "--attr-ttl=soon", "/mnt" };
+	options_t options;
+
+	CHECK(parse(ARGC(disabled), disabled, &options));
+	CHECK(options.attr_ttl == 0);
+
+	CHECK(!parse(ARGC(no_threads), no_threads, &options));
+	CHECK(!parse(ARGC(not_a_number), not_a_number, &options));
+}
+
+static void test_immutable(void)
+{
+	char* mutable[] = { "ipa", "/mnt" };
+	char* immutable[] = { "ipa", "--immutable", "/mnt" };
+	char* timeout[] = { "ipa", "--immutable=30", "/mnt" };
+	char* no_timeout[] = { "ipa", "--immutable=0", "/mnt" };
+	options_t options;
+
+	CHECK(parse(ARGC(mutable), mutable, &options));
+	CHECK(!options.immutable);
+	CHECK(options.kernel_timeout == 1);
+
+	CHECK(parse(ARGC(immutable), immutable, &options));
+	CHECK(options.immutable);
+	CHECK(options.kernel_timeout == 86400);
+
+	CHECK(parse(ARGC(timeout), timeout, &options));
+	CHECK(options.immutable);
+	CHECK(options.kernel_timeout == 30);
+
+	CHECK(!parse(ARGC(no_timeout), no_timeout, &options));
+}
+
+static void test_mount_location(void)
+{
+	char* missing[] = { "ipa" };
+	char* extra[] = { "ipa", "/mnt", "/other" };
+	options_t options;
+
+	CHECK(!parse(ARGC(missing), missing, &options));
+	CHECK(!parse(ARGC(extra), extra, &options));
+}
+
+int main(void)
+{
+	test_defaults();
+	test_engine();
+	test_engine_keeps_attributes();
+	test_attributes();
+	test_immutable();
+	test_mount_location();
+
+	return TEST_RESULT();
+}
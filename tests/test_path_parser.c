@@ -0,0 +1,192 @@
+#include "test.h"
+#include "path_parser.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// the parser is linked without the catalog, these stand in for the entities it resolves the paths into
+struct filesystem_s
+{
+	unsigned int version;       /// the version of the catalog reported to the parser
+	unsigned int lookups;       /// the number of devices looked up, i.e. of the paths which have been parsed
+	bool has_device;            /// whether the only device exists
+};
+
+struct db_s { int unused; };
+struct album_s { int unused; };
+struct photo_s { int unused; };
+
+static struct db_s device;
+static struct album_s album;
+static struct photo_s photo;
+
+db_h filesystem_find_database(filesystem_h handle, const char* fs_name)
+{
+	handle->lookups++;
+	return (handle->has_device && strcmp(fs_name, "iPhone") == 0) ? &device : NULL;
+}
+
+unsigned int filesystem_get_catalog_version(filesystem_h handle)
+{
+	return handle->version;
+}
+
+album_h db_find_album(const db_h handle, const char* album_name)
+{
+	return (strcmp(album_name, "Camera Roll") == 0) ? &album : NULL;
+}
+
+photo_h album_find_photo(const album_h handle, const char* file_name)
+{
+	return (strcmp(file_name, "IMG_0001.JPG") == 0) ? &photo : NULL;
+}
+
+const char* album_get_name(const album_h handle)
+{
+	return "Camera Roll";
+}
+
+// the number of parts of the lookup cache and the hash of the paths, as in path_parser.c
+#define CACHE_SHARD_COUNT 16
+
+static unsigned int shard_of(const char* path)
+{
+	unsigned int hash = 5381;
+	for (const char* c = path; *c != 0; c++)
+	{
+		hash = (hash << 5) + hash + (unsigned char) *c;
+	}
+
+	return hash & (CACHE_SHARD_COUNT - 1);
+}
+
+static void test_resolve(void)
+{
+	struct filesystem_s fs = { .version = 1, .has_device = true };
+	path_parser_h parser = path_parser_create(&fs, 64);
+	path_node_t node;
+
+	CHECK(path_parser_resolve(parser, "/", &node));
+	CHECK(node.type == PATH_NODE_ROOT);
+
+	CHECK(path_parser_resolve(parser, "/iPhone", &node));
+	CHECK(node.type == PATH_NODE_DEVICE && node.device == &device && node.album == NULL);
+
+	CHECK(path_parser_resolve(parser, "/iPhone/Camera Roll", &node));
+	CHECK(node.type == PATH_NODE_ALBUM && node.album == &album && node.photo == NULL);
+
+	CHECK(path_parser_resolve(parser, "/iPhone/Camera Roll/IMG_0001.JPG", &node));
+	CHECK(node.type == PATH_NODE_PHOTO && node.photo == &photo);
+
+	CHECK(!path_parser_resolve(parser, "/iPhone/Camera Roll/IMG_0001.JPG/more", &node));
+	CHECK(!path_parser_resolve(parser, "/iPhone/Camera Roll/.DS_Store", &node));
+	CHECK(node.type == 0 && node.device == NULL);
+
+	path_parser_free(parser);
+}
+
+// the paths resolved once, as well as the ones which don't exist, aren't parsed again
+static void test_cached(void)
+{
+	struct filesystem_s fs = { .version = 1, .has_device = true };
+	path_parser_h parser = path_parser_create(&fs, 64);
+	path_node_t node;
+
+	CHECK(path_parser_resolve(parser, "/iPhone/Camera Roll/IMG_0001.JPG", &node));
+	CHECK(!path_parser_resolve(parser, "/iPhone/Camera Roll/.DS_Store", &node));
+	CHECK(fs.lookups == 2);
+
+	CHECK(path_parser_resolve(parser, "/iPhone/Camera Roll/IMG_0001.JPG", &node));
+	CHECK(node.type == PATH_NODE_PHOTO && node.photo == &photo);
+	CHECK(!path_parser_resolve(parser, "/iPhone/Camera Roll/.DS_Store", &node));
+	CHECK(node.type == 0 && node.device == NULL);
+	CHECK(fs.lookups == 2);
+
+	path_parser_free(parser);
+}
+
+// the paths cached within a replaced catalog are parsed again, as their entities might be gone
+static void test_stale_version(void)
+{
+	struct filesystem_s fs = { .version = 1, .has_device = true };
+	path_parser_h parser = path_parser_create(&fs, 64);
+	path_node_t node;
+
+	CHECK(path_parser_resolve(parser, "/iPhone/Camera Roll", &node));
+	CHECK(!path_parser_resolve(parser, "/iPad", &node));
+	CHECK(fs.lookups == 2);
+
+	fs.version = 2;
+	fs.has_device = false;
+
+	CHECK(!path_parser_resolve(parser, "/iPhone/Camera Roll", &node));
+	CHECK(node.device == NULL && node.album == NULL);
+	CHECK(fs.lookups == 3);
+
+	fs.version = 3;
+	fs.has_device = true;
+
+	// neither the existing path nor the missing one is served from the previous catalog
+	CHECK(path_parser_resolve(parser, "/iPhone/Camera Roll", &node));
+	CHECK(node.album == &album);
+	CHECK(!path_parser_resolve(parser, "/iPad", &node));
+	CHECK(fs.lookups == 5);
+
+	path_parser_free(parser);
+}
+
+// finds the missing paths which fall into the same part of the lookup cache as the passed one
+static void find_same_shard(const char* path, char others[][32], size_t count)
+{
+	unsigned int shard = shard_of(path);
+
+	for (unsigned int i = 0, found = 0; found < count; i++)
+	{
+		snprintf(others[found], sizeof(others[found]), "/missing-%u", i);
+		if (shard_of(others[found]) == shard && strcmp(others[found], path) != 0)
+		{
+			found++;
+		}
+	}
+}
+
+// once a part of the cache is full, the least recently used path is evicted
+static void test_eviction(void)
+{
+	// two slots in each part of the cache
+	struct filesystem_s fs = { .version = 1, .has_device = true };
+	path_parser_h parser = path_parser_create(&fs, 2 * CACHE_SHARD_COUNT);
+	path_node_t node;
+
+	char paths[3][32];
+	find_same_shard("/missing", paths, 3);
+
+	CHECK(!path_parser_resolve(parser, paths[0], &node));
+	CHECK(!path_parser_resolve(parser, paths[1], &node));
+	CHECK(fs.lookups == 2);
+
+	// the first path becomes the most recently used one, so the second one is evicted by the third
+	CHECK(!path_parser_resolve(parser, paths[0], &node));
+	CHECK(fs.lookups == 2);
+	CHECK(!path_parser_resolve(parser, paths[2], &node));
+	CHECK(fs.lookups == 3);
+
+	CHECK(!path_parser_resolve(parser, paths[0], &node));
+	CHECK(!path_parser_resolve(parser, paths[2], &node));
+	CHECK(fs.lookups == 3);
+
+	CHECK(!path_parser_resolve(parser, paths[1], &node));
+	CHECK(fs.lookups == 4);
+
+	path_parser_free(parser);
+}
+
+int main(void)
+{
+	test_resolve();
+	test_cached();
+	test_stale_version();
+	test_eviction();
+
+	return TEST_RESULT();
+}